@@ -1,5 +1,9 @@
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <omp.h>
 
 #include "integrator.h"
 
@@ -11,10 +15,27 @@ int scene_id = 0;     // PLEASE DO NOT CHANGE
 
 void setSceneById(std::shared_ptr<Scene> &scene, int id);
 
-int main() {
+int main(int argc, char *argv[]) {
 
     setbuf(stdout, nullptr);
 
+    // usage: main [--threads count], all hardware threads by default
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            int threads = 0;
+            if (std::sscanf(argv[++i], "%d", &threads) != 1 || threads <= 0) {
+                std::cerr << "Invalid thread count " << argv[i] << ", expected a positive integer. Exit." << std::endl;
+                exit(-1);
+            }
+            omp_set_num_threads(threads);
+        } else {
+            std::cerr << "Unknown option " << arg << ". Exit." << std::endl;
+            exit(-1);
+        }
+    }
+    std::cout << "Rendering with " << omp_get_max_threads() << " threads\n";
+
 #ifndef TESTBYGITHUB                 // PLEASE DO NOT CHANGE
     Vec2i img_resolution(400, 400);
 #else                                // PLEASE DO NOT CHANGE
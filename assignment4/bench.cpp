@@ -0,0 +1,597 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <omp.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "config_io.h"
+#include "integrator.h"
+#include "stats.h"
+#include "threading.h"
+
+// Rendering benchmark. Every case renders a fixed scene with the path tracer at a fixed
+// resolution and sample count. The random sequences only depend on the image tile and the
+// pass, so the images are reproducible. Each case runs in its own process, which isolates its
+// peak memory usage.
+//
+// usage: bench [--output results.json] [--baseline baseline.json] [--tolerance 0.1]
+//              [--filter name] [--accel linear_bvh,bvh,none] [--builder lbvh,sbvh,trbvh]
+//              [--threads 1,2,4] [--affinity none|compact|scatter] [--update-references]
+//        bench --box-kernels
+// --accel and --builder sweep the cases over comma separated lists of acceleration structures
+// and BVH builders (the linear BVH built from Morton codes only by default). --threads sweeps
+// the thread counts (the OpenMP default only by default) and reports the scaling efficiency
+// of every case against its first thread count: the speedup divided by the thread ratio. Run it from the
+// build directory, like main. The exit code is 1 if a case regressed against
+// the baseline by more than the tolerance, 2 if a case failed. --box-kernels only runs the
+// microbenchmark of the ray-box tests.
+
+namespace {
+
+struct BenchCase {
+    enum Synthetic { NONE, SPHERES, SOUP, SLIVERS };
+
+    std::string name;
+    std::string config_path;
+    // generated geometry added to the scene of the config
+    Synthetic synthetic = NONE;
+    int synthetic_triangles = 0;
+    // overrides the max_depth of the config if positive
+    int max_depth = 0;
+};
+
+const std::vector<BenchCase> BENCH_CASES = {
+    {"simple", "../configs/simple.json"},
+    {"simple-mirror", "../configs/simple-mirror.json"},
+    {"large-mesh", "../configs/large_mesh.json"},
+    {"synthetic-spheres", "../configs/simple.json", BenchCase::SPHERES, 1 << 18, 4},
+    {"synthetic-soup", "../configs/simple.json", BenchCase::SOUP, 1000000, 4},
+    {"synthetic-slivers", "../configs/simple.json", BenchCase::SLIVERS, 1 << 14, 4},
+};
+
+constexpr int BENCH_RESOLUTION = 128;
+constexpr int BENCH_SPP = 16;
+// the stored references are rendered with more samples
+constexpr int REFERENCE_SPP = 256;
+constexpr unsigned SYNTHETIC_SEED = 171;
+const std::string REFERENCE_DIR = "../references/";
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Current resident memory, read from /proc/self/statm (in pages)
+double residentMegabytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return static_cast<double>(resident * sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
+
+// A grid of 4 x 4 UV spheres inside the Cornell box
+std::shared_ptr<TriangleMesh> makeSpheres(int n_triangles) {
+    const int n_spheres = 16;
+    // a sphere of 'stacks' stacks and 2 * stacks slices has 4 * stacks^2 triangles
+    const int stacks = std::max(2, static_cast<int>(std::sqrt(n_triangles / (4.0 * n_spheres))));
+    const int slices = 2 * stacks;
+    const float radius = 0.15f;
+
+    std::vector<Vec3f> vertices, normals;
+    std::vector<int> v_index;
+    for (int s = 0; s < n_spheres; s++) {
+        Vec3f center(-0.6f + 0.4f * static_cast<float>(s % 4), 0.4f + 0.4f * static_cast<float>(s / 4), 0.3f);
+        const int base = static_cast<int>(vertices.size());
+        for (int i = 0; i <= stacks; i++) {
+            float theta = PI * static_cast<float>(i) / static_cast<float>(stacks);
+            for (int j = 0; j <= slices; j++) {
+                float phi = 2 * PI * static_cast<float>(j) / static_cast<float>(slices);
+                Vec3f n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+                vertices.emplace_back(center + radius * n);
+                normals.push_back(n);
+            }
+        }
+        for (int i = 0; i < stacks; i++) {
+            for (int j = 0; j < slices; j++) {
+                int a = base + i * (slices + 1) + j, b = a + slices + 1;
+                v_index.insert(v_index.end(), {a, b, a + 1, a + 1, b, b + 1});
+            }
+        }
+    }
+    std::vector<int> n_index = v_index;
+    return std::make_shared<TriangleMesh>(std::move(vertices), std::move(normals), std::move(v_index),
+                                          std::move(n_index));
+}
+
+// Small randomly oriented triangles filling a cube in the middle of the box, a hard case for the BVH
+std::shared_ptr<TriangleMesh> makeSoup(int n_triangles) {
+    std::mt19937 rng(SYNTHETIC_SEED);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    std::vector<Vec3f> vertices, normals;
+    std::vector<int> v_index, n_index;
+    vertices.reserve(3 * n_triangles);
+    normals.reserve(n_triangles);
+    v_index.reserve(3 * n_triangles);
+    n_index.reserve(3 * n_triangles);
+    for (int i = 0; i < n_triangles; i++) {
+        Vec3f center(0.5f * uniform(rng), 1.f + 0.5f * uniform(rng), 0.5f * uniform(rng));
+        Vec3f v[3];
+        for (auto &vertex : v) {
+            vertex = center + 0.01f * Vec3f(uniform(rng), uniform(rng), uniform(rng));
+            v_index.push_back(static_cast<int>(vertices.size()));
+            vertices.push_back(vertex);
+        }
+        Vec3f n = (v[1] - v[0]).cross(v[2] - v[0]);
+        normals.emplace_back(n.norm() > 0 ? Vec3f(n.normalized()) : Vec3f(0, 1, 0));
+        n_index.insert(n_index.end(), 3, i);
+    }
+    return std::make_shared<TriangleMesh>(std::move(vertices), std::move(normals), std::move(v_index),
+                                          std::move(n_index));
+}
+
+// Long thin randomly oriented triangles, whose bounding boxes overlap a lot (like the beams and
+// trims of architectural models)
+std::shared_ptr<TriangleMesh> makeSlivers(int n_triangles) {
+    std::mt19937 rng(SYNTHETIC_SEED);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    std::vector<Vec3f> vertices, normals;
+    std::vector<int> v_index;
+    for (int i = 0; i < n_triangles; i++) {
+        Vec3f center(0.6f * uniform(rng), 1.f + 0.6f * uniform(rng), 0.6f * uniform(rng));
+        Vec3f axis = Vec3f(uniform(rng), uniform(rng), uniform(rng)).normalized();
+        Vec3f side = axis.cross(Vec3f(uniform(rng), uniform(rng), uniform(rng))).normalized();
+        Vec3f n = axis.cross(side).normalized();
+        const int base = static_cast<int>(vertices.size());
+        vertices.insert(vertices.end(), {center - 0.2f * axis, center + 0.2f * axis, center + 0.004f * side});
+        normals.insert(normals.end(), 3, n);
+        v_index.insert(v_index.end(), {base, base + 1, base + 2});
+    }
+    std::vector<int> n_index = v_index;
+    return std::make_shared<TriangleMesh>(std::move(vertices), std::move(normals), std::move(v_index),
+                                          std::move(n_index));
+}
+
+// Runs in the child process
+nlohmann::json runCase(const BenchCase &bench_case, AccelType accel, BVHBuilderType builder,
+                       const Config::ThreadConfig &thread_config, bool update_reference) {
+    nlohmann::json result;
+    result["name"] = bench_case.name;
+    result["accel"] = accel;
+    result["builder"] = builder;
+    setupThreads(thread_config);
+    result["threads"] = omp_get_max_threads();
+
+    Config config;
+    std::ifstream fin(bench_case.config_path);
+    if (!fin.is_open()) {
+        throw std::runtime_error("can not open " + bench_case.config_path);
+    }
+    nlohmann::json j;
+    fin >> j;
+    nlohmann::from_json(j, config);
+    // cases whose assets are not in the tree are skipped, not failed
+    for (const auto &object : config.objects) {
+        if (!std::ifstream(object.obj_file_path).good()) {
+            result["skipped"] = "missing " + object.obj_file_path;
+            return result;
+        }
+    }
+    config.image_resolution[0] = config.image_resolution[1] = BENCH_RESOLUTION;
+    // the acceleration structure is built below, once the synthetic geometry is added
+    config.accel = AccelType::NONE;
+    config.spp = update_reference ? REFERENCE_SPP : BENCH_SPP;
+    if (bench_case.max_depth > 0) {
+        config.max_depth = bench_case.max_depth;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto rendered_img = std::make_shared<ImageRGB>(config.image_resolution[0], config.image_resolution[1]);
+    auto camera = std::make_shared<Camera>(config.cam_config, rendered_img);
+    auto scene = std::make_shared<Scene>();
+    initSceneFromConfig(config, scene);
+    if (bench_case.synthetic != BenchCase::NONE) {
+        std::shared_ptr<TriangleMesh> mesh;
+        switch (bench_case.synthetic) {
+            case BenchCase::SPHERES: mesh = makeSpheres(bench_case.synthetic_triangles); break;
+            case BenchCase::SOUP: mesh = makeSoup(bench_case.synthetic_triangles); break;
+            default: mesh = makeSlivers(bench_case.synthetic_triangles); break;
+        }
+        mesh->setMaterial(0);
+        scene->addObject(mesh);
+    }
+    result["scene_seconds"] = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    scene->setAccel(accel);
+    scene->setBVHBuilder(builder, config.sbvh_config, config.treelet_config);
+    scene->build_global_BVH();
+    result["bvh_build_seconds"] = secondsSince(start);
+    result["accel_mb"] = static_cast<double>(scene->accelMemoryFootprint()) / (1024.0 * 1024.0);
+
+    Integrator integrator(camera, scene, config.spp, config.max_depth);
+    start = std::chrono::steady_clock::now();
+    integrator.render();
+    const double render_seconds = secondsSince(start);
+    // memory held after rendering, below the peak (reached by the build) for the out-of-core geometry
+    result["render_rss_mb"] = residentMegabytes();
+    const uint64_t rays = stats::totals()[stats::RAYS];
+    result["render_seconds"] = render_seconds;
+    result["rays"] = rays;
+    result["mrays_per_second"] = static_cast<double>(rays) / render_seconds * 1e-6;
+    // memory traffic of the traversals, the node cache lines and pages are only counted for the linear BVH
+    const auto counters = stats::totals();
+    result["bvh_nodes_per_ray"] = static_cast<double>(counters[stats::BVH_NODES_VISITED]) / static_cast<double>(rays);
+    result["bvh_node_lines_per_ray"] = static_cast<double>(counters[stats::BVH_NODE_LINES]) / static_cast<double>(rays);
+    result["bvh_node_pages_per_ray"] = static_cast<double>(counters[stats::BVH_NODE_PAGES]) / static_cast<double>(rays);
+
+    // root mean square error against the stored reference, in linear radiance
+    const std::string reference_path = REFERENCE_DIR + bench_case.name + ".hdr";
+    if (update_reference) {
+        rendered_img->writeHDRToFile(reference_path);
+    }
+    if (std::ifstream(reference_path).good()) {
+        ImageRGB reference = ImageRGB::readHDRFromFile(reference_path);
+        result["rmse"] = rendered_img->rmse(reference, Vec2i(0, 0), Vec2i(BENCH_RESOLUTION, BENCH_RESOLUTION));
+    } else {
+        result["rmse"] = nullptr;
+    }
+
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    // ru_maxrss is in kilobytes on Linux
+    result["peak_rss_mb"] = static_cast<double>(usage.ru_maxrss) / 1024.0;
+    return result;
+}
+
+// Run the case in a child process and read its result through a pipe. The parent never starts
+// OpenMP threads, so forking is safe.
+nlohmann::json runCaseInChild(const BenchCase &bench_case, AccelType accel, BVHBuilderType builder,
+                              const Config::ThreadConfig &thread_config, bool update_reference) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return {{"name", bench_case.name}, {"error", "pipe failed"}};
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        // silence the progress output of the renderer
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        std::string message;
+        int code = 0;
+        try {
+            message = runCase(bench_case, accel, builder, thread_config, update_reference).dump();
+        } catch (std::exception &ex) {
+            message = nlohmann::json{{"name", bench_case.name}, {"error", ex.what()}}.dump();
+            code = 1;
+        }
+        ssize_t written = write(fds[1], message.data(), message.size());
+        close(fds[1]);
+        _exit(written == static_cast<ssize_t>(message.size()) ? code : 1);
+    }
+    close(fds[1]);
+    std::string message;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        message.append(buffer, n);
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (message.empty()) {
+        return {{"name", bench_case.name}, {"error", "the benchmark process crashed"}};
+    }
+    return nlohmann::json::parse(message);
+}
+
+// Parse a comma separated list of enum names
+template <typename Enum>
+bool parseList(const std::string &text, std::vector<Enum> &values) {
+    values.clear();
+    std::stringstream list(text);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+        Enum value;
+        if (!parseEnum(name, value)) {
+            return false;
+        }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+// Microbenchmark of the ray-box slab tests: every ray of a random set is tested against every
+// box of a random set with each kernel, and the time per box test is reported. A few rays are
+// parallel to an axis and start exactly on a box plane, the NaN case of the slab test. The
+// kernels taking a prepared ray must agree on every box.
+int runBoxKernels() {
+    constexpr int N_PACKS = 64, N_RAYS = 1024, REPEATS = 20;
+    struct alignas(32) Pack8 {
+        float low[3][8], high[3][8];
+    };
+    struct alignas(16) Pack4 {
+        float low[3][4], high[3][4];
+    };
+    std::mt19937 rng(SYNTHETIC_SEED);
+    std::uniform_real_distribution<float> position(-1.f, 1.f), extent(0.f, 0.5f);
+    std::vector<Pack8> packs8(N_PACKS);
+    std::vector<Pack4> packs4(2 * N_PACKS);
+    std::vector<AABB> boxes(8 * N_PACKS);
+    for (int b = 0; b < 8 * N_PACKS; b++) {
+        for (int a = 0; a < 3; a++) {
+            const float low = position(rng), high = low + extent(rng);
+            boxes[b].low_bnd[a] = packs8[b / 8].low[a][b % 8] = packs4[b / 4].low[a][b % 4] = low;
+            boxes[b].upper_bnd[a] = packs8[b / 8].high[a][b % 8] = packs4[b / 4].high[a][b % 4] = high;
+        }
+    }
+    std::vector<Ray> rays;
+    for (int r = 0; r < N_RAYS; r++) {
+        Vec3f origin(2 * position(rng), 2 * position(rng), 2 * position(rng));
+        // aimed at the boxes
+        Vec3f dir = Vec3f(position(rng), position(rng), position(rng)) - origin;
+        if (r % 8 == 0) {
+            const int axis = r / 8 % 3;
+            dir[axis] = r % 16 == 0 ? 0.f : -0.f;
+            origin[axis] = boxes[r % boxes.size()].low_bnd[axis];
+        }
+        rays.emplace_back(origin, dir.normalized());
+    }
+
+    std::vector<int> masks(static_cast<size_t>(N_RAYS) * N_PACKS);
+    auto run = [&](const char *name, auto &&test_pack) {
+        int mismatches = 0;
+        long hits = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < REPEATS; repeat++) {
+            for (int r = 0; r < N_RAYS; r++) {
+                const Ray &ray = rays[r];
+                const SlabRay slab_ray(ray);
+                for (int p = 0; p < N_PACKS; p++) {
+                    const int mask = test_pack(ray, slab_ray, p);
+                    hits += __builtin_popcount(mask);
+                    int &reference = masks[static_cast<size_t>(r) * N_PACKS + p];
+                    if (reference < 0) {
+                        reference = mask;
+                    } else {
+                        mismatches += reference != mask;
+                    }
+                }
+            }
+        }
+        const double seconds = secondsSince(start);
+        printf("%-18s %10.3f %10.2f %10ld %10d\n", name, seconds * 1e9 / (double(REPEATS) * N_RAYS * N_PACKS * 8),
+               double(hits) / REPEATS / (N_RAYS * N_PACKS * 8) * 100, hits / REPEATS, mismatches / REPEATS);
+    };
+
+    printf("%-18s %10s %10s %10s %10s\n", "kernel", "ns/box", "hit (%)", "hits", "mismatches");
+    // the ray prepared (three divides) in every box test, like the former AABB::intersect. The
+    // other kernels are checked against it.
+    std::fill(masks.begin(), masks.end(), -1);
+    run("aabb (ray)", [&](const Ray &ray, const SlabRay &, int p) {
+        int mask = 0;
+        for (int i = 0; i < 8; i++) {
+            float t_in, t_out;
+            mask |= boxes[8 * p + i].intersect(ray, &t_in, &t_out) << i;
+        }
+        return mask;
+    });
+    run("aabb (slab ray)", [&](const Ray &ray, const SlabRay &slab_ray, int p) {
+        int mask = 0;
+        for (int i = 0; i < 8; i++) {
+            float t_in, t_out;
+            mask |= boxes[8 * p + i].intersect(slab_ray, ray.t_min, ray.t_max, &t_in, &t_out) << i;
+        }
+        return mask;
+    });
+    run("scalar x8", [&](const Ray &ray, const SlabRay &slab_ray, int p) {
+        float t_in[8];
+        return intersectBoxes<8>(slab_ray, packs8[p].low, packs8[p].high, ray.t_min, ray.t_max, t_in);
+    });
+    run("sse x4", [&](const Ray &ray, const SlabRay &slab_ray, int p) {
+        float t_in[8];
+        return intersectBoxes4(slab_ray, packs4[2 * p].low, packs4[2 * p].high, ray.t_min, ray.t_max, t_in) |
+               intersectBoxes4(slab_ray, packs4[2 * p + 1].low, packs4[2 * p + 1].high, ray.t_min, ray.t_max,
+                               t_in + 4) << 4;
+    });
+    run("avx x8", [&](const Ray &ray, const SlabRay &slab_ray, int p) {
+        float t_in[8];
+        return intersectBoxes8(slab_ray, packs8[p].low, packs8[p].high, ray.t_min, ray.t_max, t_in);
+    });
+    return 0;
+}
+
+// Relative regressions beyond the tolerance. Small absolute slacks absorb timer noise.
+std::vector<std::string> compare(const nlohmann::json &result, const nlohmann::json &baseline, double tolerance) {
+    std::vector<std::string> regressions;
+    const auto worse = [&](const char *key, bool higher_is_better, double slack) {
+        if (!result.contains(key) || !baseline.contains(key) || result[key].is_null() || baseline[key].is_null()) {
+            return;
+        }
+        double now = result[key].get<double>(), before = baseline[key].get<double>();
+        bool regressed = higher_is_better ? now < before * (1 - tolerance) - slack
+                                          : now > before * (1 + tolerance) + slack;
+        if (regressed) {
+            char text[256];
+            snprintf(text, sizeof(text), "%s (%s, %s, %d threads): %s %.4g -> %.4g",
+                     result["name"].get<std::string>().c_str(), result["accel"].get<std::string>().c_str(),
+                     result["builder"].get<std::string>().c_str(), result["threads"].get<int>(), key, before, now);
+            regressions.emplace_back(text);
+        }
+    };
+    worse("mrays_per_second", true, 0.0);
+    worse("bvh_build_seconds", false, 0.01);
+    worse("peak_rss_mb", false, 1.0);
+    worse("rmse", false, 1e-6);
+    return regressions;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    setbuf(stdout, nullptr);
+
+    std::string output_path = "bench_results.json";
+    std::string baseline_path;
+    std::string filter;
+    double tolerance = 0.1;
+    bool update_references = false;
+    std::vector<AccelType> accels = {AccelType::LINEAR_BVH};
+    std::vector<BVHBuilderType> builders = {BVHBuilderType::LBVH};
+    // 0 for the OpenMP default
+    std::vector<int> thread_counts = {0};
+    ThreadAffinity affinity = ThreadAffinity::NONE;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%lf", &tolerance) != 1 || !(tolerance >= 0)) {
+                std::cerr << "Invalid tolerance " << argv[i] << ", expected a non-negative number. Exit." << std::endl;
+                return 2;
+            }
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--accel" && i + 1 < argc) {
+            if (!parseList(argv[++i], accels)) {
+                std::cerr << "Unknown acceleration structure in " << argv[i] << ". Exit." << std::endl;
+                return 2;
+            }
+        } else if (arg == "--builder" && i + 1 < argc) {
+            if (!parseList(argv[++i], builders)) {
+                std::cerr << "Unknown BVH builder in " << argv[i] << ". Exit." << std::endl;
+                return 2;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            thread_counts.clear();
+            std::stringstream list(argv[++i]);
+            std::string count;
+            while (std::getline(list, count, ',')) {
+                int threads = 0;
+                if (std::sscanf(count.c_str(), "%d", &threads) != 1 || threads <= 0) {
+                    std::cerr << "Invalid thread count " << count << " in " << argv[i]
+                              << ", expected positive integers. Exit." << std::endl;
+                    return 2;
+                }
+                thread_counts.push_back(threads);
+            }
+            if (thread_counts.empty()) {
+                std::cerr << "No thread count in " << argv[i] << ". Exit." << std::endl;
+                return 2;
+            }
+        } else if (arg == "--affinity" && i + 1 < argc) {
+            if (!parseEnum(std::string(argv[++i]), affinity)) {
+                std::cerr << "Unknown thread affinity " << argv[i] << ". Exit." << std::endl;
+                return 2;
+            }
+        } else if (arg == "--update-references") {
+            update_references = true;
+        } else if (arg == "--box-kernels") {
+            return runBoxKernels();
+        } else {
+            std::cerr << "Unknown option " << arg << ". Exit." << std::endl;
+            return 2;
+        }
+    }
+
+    nlohmann::json baseline;
+    if (!baseline_path.empty()) {
+        std::ifstream fin(baseline_path);
+        if (!fin.is_open()) {
+            std::cerr << "Can not open baseline " << baseline_path << ". Exit." << std::endl;
+            return 2;
+        }
+        fin >> baseline;
+    }
+
+    nlohmann::json results;
+    results["resolution"] = BENCH_RESOLUTION;
+    results["spp"] = update_references ? REFERENCE_SPP : BENCH_SPP;
+    results["cases"] = nlohmann::json::array();
+    bool failed = false;
+    std::vector<std::string> regressions;
+
+    printf("%-20s %-11s %-5s %7s %10s %10s %10s %10s %10s %10s\n", "case", "accel", "bvh", "threads", "Mrays/s",
+           "scaling", "build (s)", "render (s)", "rss (MB)", "rmse");
+    for (const BenchCase &bench_case : BENCH_CASES) {
+        if (!filter.empty() && bench_case.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        for (BVHBuilderType builder : builders) {
+            for (AccelType accel : accels) {
+                const std::string accel_name = nlohmann::json(accel).get<std::string>();
+                const std::string builder_name = nlohmann::json(builder).get<std::string>();
+                const std::string name = bench_case.name;
+                // first thread count of the sweep, the scaling efficiency is relative to it
+                nlohmann::json first;
+                for (int threads : thread_counts) {
+                    nlohmann::json result = runCaseInChild(bench_case, accel, builder, {threads, affinity},
+                                                           update_references);
+                    if (result.contains("skipped")) {
+                        results["cases"].push_back(result);
+                        printf("%-20s %-11s %-5s skipped: %s\n", name.c_str(), accel_name.c_str(),
+                               builder_name.c_str(), result["skipped"].get<std::string>().c_str());
+                        break;
+                    }
+                    if (result.contains("error")) {
+                        results["cases"].push_back(result);
+                        printf("%-20s %-11s %-5s failed: %s\n", name.c_str(), accel_name.c_str(),
+                               builder_name.c_str(), result["error"].get<std::string>().c_str());
+                        failed = true;
+                        continue;
+                    }
+                    if (first.is_null()) {
+                        first = result;
+                    }
+                    const double speedup =
+                        result["mrays_per_second"].get<double>() / first["mrays_per_second"].get<double>();
+                    result["scaling_efficiency"] =
+                        speedup * first["threads"].get<double>() / result["threads"].get<double>();
+                    results["cases"].push_back(result);
+                    printf("%-20s %-11s %-5s %7d %10.3f %9.0f%% %10.3f %10.2f %10.1f %10s\n", name.c_str(),
+                           accel_name.c_str(), builder_name.c_str(), result["threads"].get<int>(),
+                           result["mrays_per_second"].get<double>(),
+                           100 * result["scaling_efficiency"].get<double>(), result["bvh_build_seconds"].get<double>(),
+                           result["render_seconds"].get<double>(), result["peak_rss_mb"].get<double>(),
+                           result["rmse"].is_null() ? "-" : std::to_string(result["rmse"].get<double>()).c_str());
+
+                    // results without accel or builder fields come from before the sweeps, with the
+                    // linear BVH built from Morton codes, and those without threads match any count
+                    if (baseline.contains("cases")) {
+                        for (const auto &base : baseline["cases"]) {
+                            if (base.value("name", "") == name && base.value("accel", "linear_bvh") == accel_name &&
+                                base.value("builder", "lbvh") == builder_name &&
+                                base.value("threads", result["threads"].get<int>()) == result["threads"].get<int>()) {
+                                auto found = compare(result, base, tolerance);
+                                regressions.insert(regressions.end(), found.begin(), found.end());
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::ofstream fout(output_path);
+    fout << results.dump(2) << std::endl;
+    std::cout << "Results saved to " << output_path << std::endl;
+
+    for (const std::string &regression : regressions) {
+        std::cout << "Regression: " << regression << std::endl;
+    }
+    if (failed) {
+        return 2;
+    }
+    return regressions.empty() ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "config_io.h"
+#include "image.h"
+#include "render_protocol.h"
+
+// Stand-in client of the render server (server.cpp): renders a turntable of a scene, the camera
+// orbiting around its look_at point about the vertical axis. All frames share the scene, so
+// only the first one pays for loading it and building its BVH.
+//
+// usage: client config.json [--socket path] [--frames count] [--output prefix]
+//
+// Frame i is saved to <prefix>_<i>.png, the prefix being ../turntable by default.
+
+int main(int argc, char *argv[]) {
+    std::string config_path;
+    std::string socket_path = render_protocol::DEFAULT_SOCKET_PATH;
+    std::string output = "../turntable";
+    int frames = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d", &frames) != 1 || frames <= 0) {
+                std::cerr << "Invalid frame count " << argv[i] << ", expected a positive integer. Exit." << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option " << arg << ". Exit." << std::endl;
+            exit(-1);
+        } else {
+            config_path = arg;
+        }
+    }
+    if (config_path.empty()) {
+        config_path = "../configs/simple.json";
+    }
+
+    nlohmann::json config;
+    std::ifstream fin(config_path);
+    if (!fin.is_open()) {
+        std::cerr << "Can not open json file " << config_path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    try {
+        fin >> config;
+    } catch (nlohmann::json::exception &ex) {
+        std::cerr << "Error:" << ex.what() << std::endl;
+        exit(-1);
+    }
+
+    sockaddr_un address{};
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (!render_protocol::socketAddress(socket_path, address) || fd < 0 ||
+        connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+        std::cerr << "Can not connect to the render server at " << socket_path << ". Exit." << std::endl;
+        exit(-1);
+    }
+
+    // the orbit of the camera, in the horizontal plane of its initial position
+    const Vec3f position(config["cam_config"]["position"][0].get<float>(),
+                         config["cam_config"]["position"][1].get<float>(),
+                         config["cam_config"]["position"][2].get<float>());
+    const Vec3f look_at(config["cam_config"]["look_at"][0].get<float>(), config["cam_config"]["look_at"][1].get<float>(),
+                        config["cam_config"]["look_at"][2].get<float>());
+    const Vec3f offset = position - look_at;
+
+    for (int frame = 0; frame < frames; frame++) {
+        const float angle = 2 * PI * static_cast<float>(frame) / static_cast<float>(frames);
+        const Vec3f eye = look_at + Vec3f(std::cos(angle) * offset.x() + std::sin(angle) * offset.z(), offset.y(),
+                                          -std::sin(angle) * offset.x() + std::cos(angle) * offset.z());
+        nlohmann::json job = {{"config", config}, {"camera", {{"position", {eye.x(), eye.y(), eye.z()}}}}};
+
+        std::string answer;
+        if (!render_protocol::sendMessage(fd, job.dump()) || !render_protocol::receiveMessage(fd, answer)) {
+            std::cerr << "The connection to the render server was lost. Exit." << std::endl;
+            exit(-1);
+        }
+        nlohmann::json header = nlohmann::json::parse(answer);
+        if (header["status"] != "ok") {
+            std::cerr << "Frame " << frame << " failed: " << header["message"].get<std::string>() << std::endl;
+            exit(-1);
+        }
+        const int width = header["width"].get<int>(), height = header["height"].get<int>();
+        std::string pixels;
+        if (!render_protocol::receiveMessage(fd, pixels) ||
+            pixels.size() != static_cast<size_t>(width) * height * 3 * sizeof(float)) {
+            std::cerr << "Invalid image received from the render server. Exit." << std::endl;
+            exit(-1);
+        }
+        const auto *values = reinterpret_cast<const float *>(pixels.data());
+        ImageRGB image(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const float *pixel = values + 3 * (static_cast<size_t>(y) * width + x);
+                image.setPixel(x, y, Vec3f(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+        char file_name[32];
+        std::snprintf(file_name, sizeof(file_name), "_%03d.png", frame);
+        image.writeImgToFile(output + file_name);
+        std::printf("frame %d: %s, setup %.3fs, render %.3fs\n", frame,
+                    header["cached"].get<bool>() ? "cached scene" : "new scene", header["setup_seconds"].get<double>(),
+                    header["render_seconds"].get<double>());
+    }
+    close(fd);
+    return 0;
+}
@@ -3,9 +3,32 @@
 
 #include <utility>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "core.h"
 #include "ray.h"
 
+// A ray prepared for the slab tests of a traversal: the inverse direction is computed once per
+// ray instead of three divides per box. It is infinite on the axes the ray is parallel to, and
+// the near plane of every axis is picked by the sign of the direction instead of a min/max.
+struct SlabRay {
+    Vec3f origin;
+    Vec3f inv_dir;
+    // 1 where the direction is negative (-0 included): the near plane is the upper bound
+    int dir_neg[3];
+
+    explicit SlabRay(const Ray &ray);
+};
+
+// Clip the ray interval with the distance 't' to a slab plane. 't' is NaN only when the ray is
+// parallel to the axis and starts on the plane (0 * inf): the slab does not restrict the ray
+// then, and the running bound is kept. Same operand order as maxps/minps, which return their
+// second operand on NaN.
+inline float slabMax(float t, float bound) { return t > bound ? t : bound; }
+inline float slabMin(float t, float bound) { return t < bound ? t : bound; }
+
 struct AABB {
     // the minimum and maximum coordinate for the AABB
     Vec3f low_bnd;
@@ -26,7 +49,20 @@ struct AABB {
 
     // test intersection with given ray.
     // ray distance of entrance and exit point are recorded in t_in and t_out
-    bool intersect(const Ray &ray, float *t_in, float *t_out);
+    bool intersect(const Ray &ray, float *t_in, float *t_out) const;
+
+    // Same test for a prepared ray, clipped to [t_min, t_max]. Branchless and divide-free, for
+    // the traversals.
+    bool intersect(const SlabRay &ray, float t_min, float t_max, float *t_in, float *t_out) const {
+        const Vec3f *bounds[2] = {&low_bnd, &upper_bnd};
+        for (int a = 0; a < 3; a++) {
+            t_min = slabMax(((*bounds[ray.dir_neg[a]])[a] - ray.origin[a]) * ray.inv_dir[a], t_min);
+            t_max = slabMin(((*bounds[1 - ray.dir_neg[a]])[a] - ray.origin[a]) * ray.inv_dir[a], t_max);
+        }
+        *t_in = t_min;
+        *t_out = t_max;
+        return t_min <= t_max && t_max >= 0;
+    }
 
     // Get the AABB center
     [[nodiscard]] Vec3f getCenter() const { return (low_bnd + upper_bnd) / 2; }
@@ -49,20 +85,82 @@ struct BVHNode {
     // Note: Triangles are sorted by morton code before constructing BVH, so instead of storing
     // an std::vector<int> triangles, we can store the start and end index of the triangles.
     int start = -1, end = -1, size = 0;
+
+    // SAH cost of the subtree, only maintained by the treelet optimizer
+    float sah_cost = 0;
 };
 
 // You may need to add your code for BVH construction here.
 
-struct LinearBVHNode {
+// Node of the linearized BVH. The two children of an internal node are stored side by side
+// from an even index, so that in cache-line aligned storage they share one line.
+struct alignas(32) LinearBVHNode {
     AABB aabb;
+    // first triangle of a leaf, -1 for an internal node
+    int start = -1;
     union {
-        int start = -1;
-        int left;
-    };
-    union {
+        // last triangle of a leaf
         int end = -1;
-        int right;
+        // index of the first child of an internal node, the second one follows it
+        int children;
     };
 };
+static_assert(sizeof(LinearBVHNode) == 32, "two linear BVH nodes should fill a cache line");
+
+// Test one ray against N boxes stored as structure of arrays, low[axis][box] and
+// high[axis][box]. Returns the mask of the boxes hit (bit i for box i) and their entry distances.
+// Same results as AABB::intersect for every box.
+template <int N>
+int intersectBoxes(const SlabRay &ray, const float low[3][N], const float high[3][N], float t_min, float t_max,
+                   float t_in[N]) {
+    float near[N], far[N];
+    for (int i = 0; i < N; i++) {
+        near[i] = t_min;
+        far[i] = t_max;
+    }
+    // the planes are picked once per axis, the loops over the boxes vectorize
+    for (int a = 0; a < 3; a++) {
+        const float *near_plane = ray.dir_neg[a] ? high[a] : low[a];
+        const float *far_plane = ray.dir_neg[a] ? low[a] : high[a];
+        for (int i = 0; i < N; i++) {
+            near[i] = slabMax((near_plane[i] - ray.origin[a]) * ray.inv_dir[a], near[i]);
+            far[i] = slabMin((far_plane[i] - ray.origin[a]) * ray.inv_dir[a], far[i]);
+        }
+    }
+    int mask = 0;
+    for (int i = 0; i < N; i++) {
+        t_in[i] = near[i];
+        mask |= (near[i] <= far[i] && far[i] >= 0) << i;
+    }
+    return mask;
+}
+
+#ifdef __SSE__
+// 4 boxes at once with SSE. The arrays must be 16-byte aligned.
+inline int intersectBoxes4(const SlabRay &ray, const float low[3][4], const float high[3][4], float t_min,
+                           float t_max, float t_in[4]) {
+    __m128 near = _mm_set1_ps(t_min), far = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        const float *near_plane = ray.dir_neg[a] ? high[a] : low[a];
+        const float *far_plane = ray.dir_neg[a] ? low[a] : high[a];
+        const __m128 origin = _mm_set1_ps(ray.origin[a]), inv_dir = _mm_set1_ps(ray.inv_dir[a]);
+        near = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_plane), origin), inv_dir), near);
+        far = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_plane), origin), inv_dir), far);
+    }
+    _mm_storeu_ps(t_in, near);
+    const __m128 hit = _mm_and_ps(_mm_cmple_ps(near, far), _mm_cmpge_ps(far, _mm_setzero_ps()));
+    return _mm_movemask_ps(hit);
+}
+#else
+inline int intersectBoxes4(const SlabRay &ray, const float low[3][4], const float high[3][4], float t_min,
+                           float t_max, float t_in[4]) {
+    return intersectBoxes<4>(ray, low, high, t_min, t_max, t_in);
+}
+#endif
+
+// 8 boxes at once, with AVX when the CPU has it (checked once at run time). The arrays must be
+// 32-byte aligned.
+int intersectBoxes8(const SlabRay &ray, const float low[3][8], const float high[3][8], float t_min, float t_max,
+                    float t_in[8]);
 
 #endif  // ACCEL_H_
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef AOV_H_
+#define AOV_H_
+
+#include <vector>
+
+#include "core.h"
+
+// Per-pixel features of the first non-delta hit seen through each pixel (mirrors and smooth
+// glass are followed), averaged over the pixel samples. They guide the denoiser.
+// Pixels missing the scene have zero albedo and normal, and a depth of RAY_DEFAULT_MAX.
+struct AOVBuffers {
+    AOVBuffers(int width, int height)
+        : width(width),
+          height(height),
+          albedo(width * height, Vec3f(0, 0, 0)),
+          normal(width * height, Vec3f(0, 0, 0)),
+          depth(width * height, 0.f),
+          weight(width * height, 0.f) {}
+
+    // Only the thread rendering a pixel may add samples to it
+    void addSample(int index, const Vec3f &sample_albedo, const Vec3f &sample_normal, float sample_depth) {
+        albedo[index] += sample_albedo;
+        normal[index] += sample_normal;
+        depth[index] += sample_depth;
+        weight[index] += 1;
+    }
+
+    // Turn the sums into averages, once all samples have been added
+    void normalize() {
+        for (int i = 0; i < width * height; i++) {
+            if (weight[i] > 0) {
+                albedo[i] /= weight[i];
+                normal[i] = normal[i].norm() > 0 ? Vec3f(normal[i].normalized()) : Vec3f(0, 0, 0);
+                depth[i] /= weight[i];
+                weight[i] = 1;
+            }
+        }
+    }
+
+    int width;
+    int height;
+    std::vector<Vec3f> albedo;
+    std::vector<Vec3f> normal;
+    // distance from the camera along the primary ray
+    std::vector<float> depth;
+    std::vector<float> weight;
+};
+
+// Features of one camera sample, filled by the integrator at the first vertices of the path it
+// traces for the sample. They are left to zero (and RAY_DEFAULT_MAX) if the path ends first.
+struct FeatureSample {
+    Vec3f albedo{0, 0, 0};
+    Vec3f normal{0, 0, 0};
+    float depth = RAY_DEFAULT_MAX;
+    // product of the delta BSDFs followed from the camera
+    Vec3f throughput{1, 1, 1};
+};
+
+#endif  // AOV_H_
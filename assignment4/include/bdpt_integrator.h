@@ -0,0 +1,65 @@
+#ifndef BDPT_INTEGRATOR_H_
+#define BDPT_INTEGRATOR_H_
+
+#include <utility>
+#include <vector>
+
+#include "integrator.h"
+
+// Bidirectional path tracing (Veach 1997). For every camera sample, a camera subpath and a light
+// subpath are traced, and every prefix pair is connected with a shadow ray. All strategies that
+// can generate the same path are weighted with the balance heuristic. The pinhole camera can not
+// be hit by light subpaths, so strategies with a single camera vertex (t = 1) are not used.
+// Only the area light is supported, an environment light is ignored by this integrator.
+class BDPTIntegrator : public Integrator {
+   public:
+    BDPTIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth);
+    Vec3f radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const override;
+
+   private:
+    struct PathVertex {
+        enum Type { CAMERA, LIGHT, SURFACE };
+        PathVertex(Type type, Vec3f pos, Vec3f normal, Vec3f wo)
+            : type(type), pos(std::move(pos)), normal(std::move(normal)), wo(std::move(wo)) {}
+        Type type;
+        Vec3f pos;
+        Vec3f normal;
+        // direction towards the previous vertex of the subpath
+        Vec3f wo;
+        int material_id = -1;
+        // texture color of the material at the vertex
+        Vec3f texture{1, 1, 1};
+        // throughput of the subpath up to this vertex
+        Vec3f beta{0, 0, 0};
+        bool delta = false;
+        // area density of sampling this vertex from the previous one (fwd) and from the next one (rev)
+        float pdf_fwd = 0;
+        float pdf_rev = 0;
+        // time of the path, shared by the camera and light subpaths
+        float time = 0;
+    };
+
+    // Features of the first non-delta vertex of the camera subpath
+    void recordFeatures(FeatureSample &features, const std::vector<PathVertex> &camera_path) const;
+    // Extend the subpath in 'path' (starting with ray, whose direction was sampled with solid
+    // angle density pdf_dir) until max_vertices vertices. Camera subpaths end at the light.
+    void randomWalk(Ray ray, Vec3f beta, float pdf_dir, Sampler &sampler, int max_vertices, bool camera_path,
+                    std::vector<PathVertex> &path) const;
+    // Contribution of the path made of light_path[0..s-1] and camera_path[0..t-1], MIS weighted
+    Vec3f connect(const std::vector<PathVertex> &light_path, const std::vector<PathVertex> &camera_path, int s,
+                  int t, Sampler &sampler) const;
+    [[nodiscard]] float misWeight(const std::vector<PathVertex> &light_path, const std::vector<PathVertex> &camera_path,
+                                  const PathVertex &sampled, int s, int t) const;
+
+    // BSDF value at a surface vertex for light leaving towards wi
+    [[nodiscard]] Vec3f evaluate(const PathVertex &v, const Vec3f &wi) const;
+    // Solid angle density of sampling direction wi at v, given the path arrived from direction wo
+    [[nodiscard]] float pdfDir(const PathVertex &v, const Vec3f &wo, const Vec3f &wi) const;
+    // Area density of sampling 'next' from v, the path arriving at v from 'prev' (unused for lights)
+    [[nodiscard]] float pdfArea(const PathVertex &v, const PathVertex *prev, const PathVertex &next) const;
+    [[nodiscard]] static float convertDensity(float pdf_dir, const PathVertex &from, const PathVertex &to);
+    // Whether the segment between two vertices is unoccluded
+    [[nodiscard]] bool visible(const PathVertex &a, const PathVertex &b) const;
+};
+
+#endif  // BDPT_INTEGRATOR_H_
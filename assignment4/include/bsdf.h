@@ -1,54 +1,114 @@
 #ifndef BSDF_H_
 #define BSDF_H_
 
+#include <variant>
+
 #include "interaction.h"
+#include "utils.h"
 
-class BSDF {
-   public:
-    BSDF() = default;
-    virtual ~BSDF() = default;
-    [[nodiscard]] virtual Vec3f evaluate(Interaction &interaction) const = 0;
-    virtual float pdf(Interaction &interaction) const = 0;
-    virtual Vec3f sample(Interaction &interaction, Sampler &sampler) const = 0;
-    [[nodiscard]] virtual bool isDelta() const = 0;
-};
+// Microfacet BSDFs with a smaller GGX alpha (roughness) are treated as perfectly smooth.
+constexpr float MIN_ROUGHNESS = 1e-3f;
+
+// All BSDFs share the same (non-virtual) interface:
+//   Vec3f evaluate(Interaction &) const, float pdf(Interaction &) const,
+//   Vec3f sample(Interaction &, Sampler &) const, bool isDelta() const,
+//   Vec3f albedo() const (the base color, used as a denoising feature).
+// The color of every BSDF is multiplied by interaction.texture, the texture color at the hit.
+// Convention: interaction.wo points towards the viewer and interaction.wi towards the light,
+// both normalized. For delta BSDFs, evaluate() returns the sampling weight f * |cos| / pdf of the
+// direction produced by sample(), and pdf() returns 1.
 
 // Ideal diffusion surface
-class IdealDiffusion : public BSDF {
+class IdealDiffusion {
    public:
     explicit IdealDiffusion(Vec3f color) : color(std::move(color)) {}
-    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const override;
-    float pdf(Interaction &interaction) const override;
-    Vec3f sample(Interaction &interaction, Sampler &sampler) const override;
-    [[nodiscard]] bool isDelta() const override;  // return false
+
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const {
+        // no light is transmitted through the surface
+        if (interaction.normal.dot(interaction.wi) < 0) {
+            return {0.f, 0.f, 0.f};
+        }
+        return color.cwiseProduct(interaction.texture) / PI;
+    }
+
+    float pdf(Interaction &interaction) const {
+        // cos-theta / pi
+        return interaction.normal.dot(interaction.wi) / PI;
+    }
+
+    Vec3f sample(Interaction &interaction, Sampler &sampler) const;
+
+    [[nodiscard]] static constexpr bool isDelta() { return false; }
+
+    [[nodiscard]] const Vec3f &albedo() const { return color; }
 
    private:
     Vec3f color;
 };
 
-// You can add your own BSDF here
-
 // Ideal Specular (mirror, reflection) surface
-class IdealSpecular : public BSDF {
+class IdealSpecular {
    public:
     explicit IdealSpecular(Vec3f color) : color(std::move(color)) {}
 
-    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const override {
-        return {0.f, 0.f, 0.f};
-    };
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const { return color.cwiseProduct(interaction.texture); }
+
+    float pdf(Interaction &interaction) const { return 1.f; }
+
+    Vec3f sample(Interaction &interaction, Sampler &sampler) const {
+        // the mirror formula is symmetric in the orientation of the normal, so the mirror is two-sided
+        interaction.wi = -interaction.wo + 2 * interaction.wo.dot(interaction.normal) * interaction.normal;
+        return interaction.wi;
+    }
 
-    float pdf(Interaction &interaction) const override {
-        return 0;
-    };
+    [[nodiscard]] static constexpr bool isDelta() { return true; }
 
-    Vec3f sample(Interaction &interaction, Sampler &sampler) const override {
-        return {0.f, 0.f, 0.f};
-    };
+    [[nodiscard]] const Vec3f &albedo() const { return color; }
 
-    [[nodiscard]] bool isDelta() const override;  // return true
+   private:
+    Vec3f color;
+};
+
+// Rough metal with a GGX (Trowbridge-Reitz) microfacet distribution, roughness being the GGX alpha.
+// 'color' is the reflectance at normal incidence (F0 of Schlick's Fresnel approximation).
+// Directions are importance sampled from the distribution of visible normals (Heitz 2018).
+// A roughness below MIN_ROUGHNESS degenerates into a smooth (delta) conductor.
+class MicrofacetConductor {
+   public:
+    MicrofacetConductor(Vec3f color, float roughness);
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
+    float pdf(Interaction &interaction) const;
+    Vec3f sample(Interaction &interaction, Sampler &sampler) const;
+    [[nodiscard]] bool isDelta() const { return alpha < MIN_ROUGHNESS; }
+    [[nodiscard]] const Vec3f &albedo() const { return color; }
+
+   private:
+    Vec3f color;
+    float alpha;
+};
+
+// Rough glass with a GGX microfacet distribution (Walter et al. 2007), reflecting and refracting.
+// 'color' tints the transmitted light, 'ior' is the index of refraction of the inside relative to
+// the outside, where the outside is the side the shading normal points to.
+// A roughness below MIN_ROUGHNESS degenerates into smooth (delta) glass.
+class MicrofacetDielectric {
+   public:
+    MicrofacetDielectric(Vec3f color, float roughness, float ior);
+    [[nodiscard]] Vec3f evaluate(Interaction &interaction) const;
+    float pdf(Interaction &interaction) const;
+    Vec3f sample(Interaction &interaction, Sampler &sampler) const;
+    [[nodiscard]] bool isDelta() const { return alpha < MIN_ROUGHNESS; }
+    [[nodiscard]] const Vec3f &albedo() const { return color; }
 
    private:
     Vec3f color;
+    float alpha;
+    float ior;
 };
 
+// The closed set of materials. The scene keeps them in a flat array indexed by material id and
+// dispatches on the variant tag (std::visit) instead of virtual calls, so the integrator kernels
+// are instantiated per material and the small BSDF methods above get inlined.
+using BSDF = std::variant<IdealDiffusion, IdealSpecular, MicrofacetConductor, MicrofacetDielectric>;
+
 #endif  // BSDF_H_
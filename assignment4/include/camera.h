@@ -5,13 +5,18 @@
 #include "core.h"
 #include "image.h"
 #include "ray.h"
+#include "utils.h"
 
 class Camera {
    public:
     Camera();
     explicit Camera(const Config::CamConfig &config, std::shared_ptr<ImageRGB> &img);
 
-    Ray generateRay(float x, float y);
+    // Ray through image position (x, y) in pixels. The sampler is only used by a thin lens and an
+    // open shutter, for the lens position and the ray time.
+    Ray generateRay(float x, float y, Sampler &sampler) const;
+    // Time uniformly sampled in the shutter interval
+    float sampleTime(Sampler &sampler) const;
     void lookAt(const Vec3f &look_at, const Vec3f &ref_up = {0, 1, 0});
 
     void setPosition(const Vec3f &pos);
@@ -28,6 +33,10 @@ class Camera {
     Vec3f right;
     float focal_len;
     float fov;
+    float lens_radius = 0;
+    float focus_distance = 1;
+    float shutter_open = 0;
+    float shutter_close = 0;
 
     std::shared_ptr<ImageRGB> image;
 };
@@ -7,7 +7,23 @@
 #include <vector>
 #include <map>
 
-enum class MaterialType { DIFFUSE, SPECULAR };
+enum class MaterialType { DIFFUSE, SPECULAR, CONDUCTOR, DIELECTRIC };
+
+enum class IntegratorType { PATH, PHOTON_MAPPING, PROGRESSIVE_PHOTON_MAPPING, BDPT, GUIDED };
+
+// Acceleration structure used by Scene::intersect: none (test every triangle of every object),
+// the pointer-based BVH, the linearized BVH, the linearized BVH with its triangles streamed
+// from a file (see OutOfCoreConfig), or the 4-wide BVH with quantized nodes
+enum class AccelType { NONE, BVH, LINEAR_BVH, OUT_OF_CORE, QUANTIZED_BVH };
+
+// Construction of the BVH shared by all the BVH structures: Morton codes (LBVH), SAH with
+// spatial splits (SBVH, see SBVHConfig), or Morton codes followed by treelet restructuring
+// (TRBVH, see TreeletConfig)
+enum class BVHBuilderType { LBVH, SBVH, TRBVH };
+
+// Placement of the render threads: left to the OS, packed on the CPUs of the first NUMA node
+// before the next one, or spread round-robin over the NUMA nodes
+enum class ThreadAffinity { NONE, COMPACT, SCATTER };
 
 struct Config {
     struct LightConfig {
@@ -16,18 +32,136 @@ struct Config {
         float radiance[3];
     };
 
+    // Environment map lighting, disabled when hdr_path is empty
+    struct EnvConfig {
+        std::string hdr_path;
+        float scale = 1.f;
+    };
+
+    // Settings of the photon mapping integrators
+    struct PhotonConfig {
+        // photons emitted (per pass for progressive photon mapping)
+        int num_photons = 200000;
+        // number of photons used in a density estimate
+        int k_nearest = 64;
+        // maximum gather radius (initial radius for progressive photon mapping)
+        float radius = 0.1f;
+        // radius reduction parameter of progressive photon mapping, in (0, 1)
+        float alpha = 0.7f;
+        // number of progressive photon mapping passes, the spp are spread over them (spp passes when
+        // there are fewer samples, more passes when spp does not split into square grids per pass)
+        int passes = 16;
+    };
+
+    // Settings of the out-of-core geometry, for scenes whose triangles do not fit in memory
+    struct OutOfCoreConfig {
+        // scratch file holding the triangles, removed once opened. The triangles are staged in
+        // a second one (the same path with ".staging") while the scene is loaded.
+        std::string chunk_path = "geometry_chunks.bin";
+        // chunks are made of whole BVH leaves, with at least this number of triangles
+        int chunk_triangles = 4096;
+        // decoded chunks kept in memory, for all threads together
+        int cache_mb = 256;
+    };
+
+    // Settings of the spatial split BVH builder
+    struct SBVHConfig {
+        // spatial splits are tried when the children of the best object split overlap by more
+        // than this fraction of the scene surface area
+        float alpha = 1e-5f;
+        // references added by spatial splits, relative to the number of triangles
+        float max_duplication = 0.3f;
+        // bins of the SAH sweeps
+        int bins = 32;
+    };
+
+    // Settings of the treelet restructuring of the TRBVH builder
+    struct TreeletConfig {
+        // leaves of a treelet (3 to 8), its best topology is searched exhaustively
+        int treelet_size = 7;
+        // bottom-up passes over the tree
+        int passes = 3;
+    };
+
+    // Settings of the texture store, shared by all textured materials
+    struct TextureConfig {
+        // scratch file holding the mip-mapped texture tiles, removed once mapped
+        std::string tile_path = "texture_tiles.bin";
+        // decoded tiles kept in memory, for all threads together
+        int cache_mb = 64;
+    };
+
+    // Settings of the path guiding integrator (SD-tree)
+    struct GuidingConfig {
+        // a spatial leaf is split after recording more than spatial_threshold * sqrt(spp of the pass) samples
+        float spatial_threshold = 4000.f;
+        // a directional quadrant is subdivided when it holds more than this fraction of the energy
+        float energy_threshold = 0.01f;
+        // maximum depth of the directional quadtrees
+        int max_depth = 20;
+        // upper bound of the memory used by the SD-tree, the spatial subdivision stops there
+        int max_memory_mb = 64;
+        // probability of sampling the BSDF instead of the learned distribution
+        float bsdf_fraction = 0.5f;
+    };
+
+    // Edge-avoiding a-trous denoiser, run on the rendered image before it is saved
+    struct DenoiseConfig {
+        bool enabled = false;
+        // number of filter passes, the footprint doubles at every pass (5 passes cover 61 x 61 pixels)
+        int iterations = 5;
+        // widths of the edge-stopping functions: on the demodulated color (halved at every pass),
+        // the normal, the relative depth difference, and the albedo
+        float sigma_color = 0.25f;
+        float sigma_normal = 0.3f;
+        float sigma_depth = 0.1f;
+        float sigma_albedo = 0.1f;
+    };
+
+    // OpenMP threads of the renderer
+    struct ThreadConfig {
+        // 0 for the OpenMP default (OMP_NUM_THREADS, or all hardware threads)
+        int threads = 0;
+        ThreadAffinity affinity = ThreadAffinity::NONE;
+    };
+
+    // Re-render of a region of the image, composited over the float image of a previous render
+    struct CropConfig {
+        // x, y, width, height in pixels, (x, y) being the top-left corner as in image viewers.
+        // An empty window renders the whole image.
+        int window[4] = {0, 0, 0, 0};
+        // samples per pixel of the region, 0 for the spp of the config
+        int spp = 0;
+        // .hdr image the region is composited over, the other pixels are black without it
+        std::string base_image;
+    };
+
     struct CamConfig {
         float position[3];
         float look_at[3];
         float ref_up[3];
         float vertical_fov;
         float focal_length;
+        // thin lens radius, 0 for a pinhole camera
+        float aperture = 0.f;
+        // distance of the plane in focus along the view direction, 0 for the look_at distance
+        float focus_distance = 0.f;
+        // shutter interval in scene time, object keyframes are at times 0 and 1 (the interval
+        // is clamped to them)
+        float shutter_open = 0.f;
+        float shutter_close = 0.f;
     };
 
     struct MaterialConfig {
         float color[3];
         MaterialType type;
         std::string name;
+        // GGX alpha of conductor / dielectric materials, 0 for perfectly smooth surfaces
+        float roughness = 0.f;
+        // index of refraction of dielectric materials
+        float ior = 1.5f;
+        // optional image multiplying the color, looked up with the texture coordinates of the mesh
+        std::string texture;
     };
 
     struct ObjConfig {
@@ -36,14 +170,33 @@ struct Config {
         float translate[3];
         float scale;
         bool has_bvh;
+        // translation at time 1 (keyframe of a moving object), equal to translate for a static one
+        float translate_end[3];
     };
 
     //   RenderConfig render_config;
     int spp;
+    // Wall-clock seconds from the start of the program to the end of the rendering (denoising
+    // and saving come on top). When positive, 1 spp passes are rendered until it runs out and
+    // spp is ignored; at least one pass is always rendered.
+    float time_budget_seconds = 0.f;
     int max_depth;
     int image_resolution[2];
     CamConfig cam_config;
     LightConfig light_config;
+    EnvConfig env_config;
+    IntegratorType integrator = IntegratorType::PATH;
+    AccelType accel = AccelType::LINEAR_BVH;
+    OutOfCoreConfig out_of_core_config;
+    BVHBuilderType bvh_builder = BVHBuilderType::LBVH;
+    SBVHConfig sbvh_config;
+    TreeletConfig treelet_config;
+    TextureConfig texture_config;
+    PhotonConfig photon_config;
+    GuidingConfig guiding_config;
+    DenoiseConfig denoise_config;
+    CropConfig crop_config;
+    ThreadConfig thread_config;
     std::vector<MaterialConfig> materials;
     std::vector<ObjConfig> objects;
 };
@@ -4,19 +4,183 @@
 #define JSON_USE_IMPLICIT_CONVERSIONS 0
 
 #include "config.h"
+#include <algorithm>
 #include <nlohmann/json.hpp>
 
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::LightConfig, position, size, radiance)
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::CamConfig, position, look_at, ref_up, vertical_fov, focal_length)
+inline void to_json(nlohmann::json &j, const Config::CamConfig &cam) {
+    j = nlohmann::json{{"position", cam.position}, {"look_at", cam.look_at}, {"ref_up", cam.ref_up},
+                       {"vertical_fov", cam.vertical_fov}, {"focal_length", cam.focal_length},
+                       {"aperture", cam.aperture}, {"focus_distance", cam.focus_distance},
+                       {"shutter_open", cam.shutter_open}, {"shutter_close", cam.shutter_close}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::CamConfig &cam) {
+    j.at("position").get_to(cam.position);
+    j.at("look_at").get_to(cam.look_at);
+    j.at("ref_up").get_to(cam.ref_up);
+    j.at("vertical_fov").get_to(cam.vertical_fov);
+    j.at("focal_length").get_to(cam.focal_length);
+    // optional fields, depth of field and motion blur
+    cam.aperture = j.value("aperture", cam.aperture);
+    cam.focus_distance = j.value("focus_distance", cam.focus_distance);
+    cam.shutter_open = j.value("shutter_open", cam.shutter_open);
+    cam.shutter_close = j.value("shutter_close", cam.shutter_close);
+}
 
 // add your own bsdf name if needed
-NLOHMANN_JSON_SERIALIZE_ENUM(MaterialType, {{MaterialType::DIFFUSE, "diffuse"}, {MaterialType::SPECULAR, "specular"}})
+NLOHMANN_JSON_SERIALIZE_ENUM(MaterialType, {{MaterialType::DIFFUSE, "diffuse"},
+                                            {MaterialType::SPECULAR, "specular"},
+                                            {MaterialType::CONDUCTOR, "conductor"},
+                                            {MaterialType::DIELECTRIC, "dielectric"}})
+
+inline void to_json(nlohmann::json &j, const Config::MaterialConfig &mat) {
+    j = nlohmann::json{{"color", mat.color}, {"type", mat.type}, {"name", mat.name},
+                       {"roughness", mat.roughness}, {"ior", mat.ior}, {"texture", mat.texture}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::MaterialConfig &mat) {
+    j.at("color").get_to(mat.color);
+    j.at("type").get_to(mat.type);
+    j.at("name").get_to(mat.name);
+    // optional fields, only used by some material types
+    mat.roughness = j.value("roughness", mat.roughness);
+    mat.ior = j.value("ior", mat.ior);
+    mat.texture = j.value("texture", mat.texture);
+}
+
+inline void to_json(nlohmann::json &j, const Config::ObjConfig &obj) {
+    j = nlohmann::json{{"obj_file_path", obj.obj_file_path}, {"material_name", obj.material_name},
+                       {"translate", obj.translate}, {"scale", obj.scale}, {"has_bvh", obj.has_bvh},
+                       {"translate_end", obj.translate_end}};
+}
+
+inline void from_json(const nlohmann::json &j, Config::ObjConfig &obj) {
+    j.at("obj_file_path").get_to(obj.obj_file_path);
+    j.at("material_name").get_to(obj.material_name);
+    j.at("translate").get_to(obj.translate);
+    j.at("scale").get_to(obj.scale);
+    j.at("has_bvh").get_to(obj.has_bvh);
+    // optional, the object does not move by default
+    if (j.contains("translate_end")) {
+        j.at("translate_end").get_to(obj.translate_end);
+    } else {
+        std::copy(std::begin(obj.translate), std::end(obj.translate), std::begin(obj.translate_end));
+    }
+}
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::EnvConfig, hdr_path, scale)
+
+NLOHMANN_JSON_SERIALIZE_ENUM(IntegratorType, {{IntegratorType::PATH, "path"},
+                                              {IntegratorType::PHOTON_MAPPING, "photon"},
+                                              {IntegratorType::PROGRESSIVE_PHOTON_MAPPING, "ppm"},
+                                              {IntegratorType::BDPT, "bdpt"},
+                                              {IntegratorType::GUIDED, "guided"}})
+
+NLOHMANN_JSON_SERIALIZE_ENUM(AccelType, {{AccelType::NONE, "none"},
+                                         {AccelType::BVH, "bvh"},
+                                         {AccelType::LINEAR_BVH, "linear_bvh"},
+                                         {AccelType::OUT_OF_CORE, "out_of_core"},
+                                         {AccelType::QUANTIZED_BVH, "qbvh"}})
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::OutOfCoreConfig, chunk_path, chunk_triangles, cache_mb)
+
+NLOHMANN_JSON_SERIALIZE_ENUM(BVHBuilderType, {{BVHBuilderType::LBVH, "lbvh"},
+                                              {BVHBuilderType::SBVH, "sbvh"},
+                                              {BVHBuilderType::TRBVH, "trbvh"}})
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::SBVHConfig, alpha, max_duplication, bins)
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::TreeletConfig, treelet_size, passes)
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::TextureConfig, tile_path, cache_mb)
+
+NLOHMANN_JSON_SERIALIZE_ENUM(ThreadAffinity, {{ThreadAffinity::NONE, "none"},
+                                              {ThreadAffinity::COMPACT, "compact"},
+                                              {ThreadAffinity::SCATTER, "scatter"}})
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::ThreadConfig, threads, affinity)
+
+// Parse the name of an enum value given on the command line, false if it is unknown
+// (the json conversion would silently map it to the first value)
+template <typename Enum>
+bool parseEnum(const std::string &name, Enum &value) {
+    Enum parsed = nlohmann::json(name).get<Enum>();
+    if (nlohmann::json(parsed).get<std::string>() != name) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::PhotonConfig, num_photons, k_nearest, radius, alpha, passes)
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::GuidingConfig, spatial_threshold, energy_threshold, max_depth,
+                                                max_memory_mb, bsdf_fraction)
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Config::DenoiseConfig, enabled, iterations, sigma_color, sigma_normal,
+                                                sigma_depth, sigma_albedo)
+
+inline void to_json(nlohmann::json &j, const Config::CropConfig &crop) {
+    j = nlohmann::json{{"window", crop.window}, {"spp", crop.spp}, {"base_image", crop.base_image}};
+}
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::MaterialConfig, color, type, name)
+inline void from_json(const nlohmann::json &j, Config::CropConfig &crop) {
+    // all fields are optional
+    if (j.contains("window")) j.at("window").get_to(crop.window);
+    crop.spp = j.value("spp", crop.spp);
+    crop.base_image = j.value("base_image", crop.base_image);
+}
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config::ObjConfig, obj_file_path, material_name, translate, scale, has_bvh)
+inline void to_json(nlohmann::json &j, const Config &config) {
+    j = nlohmann::json{{"spp", config.spp},
+                       {"time_budget_seconds", config.time_budget_seconds},
+                       {"max_depth", config.max_depth},
+                       {"image_resolution", config.image_resolution},
+                       {"cam_config", config.cam_config},
+                       {"light_config", config.light_config},
+                       {"env_config", config.env_config},
+                       {"integrator", config.integrator},
+                       {"accel", config.accel},
+                       {"out_of_core_config", config.out_of_core_config},
+                       {"bvh_builder", config.bvh_builder},
+                       {"sbvh_config", config.sbvh_config},
+                       {"treelet_config", config.treelet_config},
+                       {"texture_config", config.texture_config},
+                       {"photon_config", config.photon_config},
+                       {"guiding_config", config.guiding_config},
+                       {"denoise_config", config.denoise_config},
+                       {"crop_config", config.crop_config},
+                       {"thread_config", config.thread_config},
+                       {"materials", config.materials},
+                       {"objects", config.objects}};
+}
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Config, spp, max_depth, image_resolution, cam_config, light_config, materials, objects)
+inline void from_json(const nlohmann::json &j, Config &config) {
+    j.at("spp").get_to(config.spp);
+    j.at("max_depth").get_to(config.max_depth);
+    j.at("image_resolution").get_to(config.image_resolution);
+    j.at("cam_config").get_to(config.cam_config);
+    j.at("light_config").get_to(config.light_config);
+    j.at("materials").get_to(config.materials);
+    j.at("objects").get_to(config.objects);
+    // optional fields
+    config.time_budget_seconds = j.value("time_budget_seconds", config.time_budget_seconds);
+    if (j.contains("env_config")) j.at("env_config").get_to(config.env_config);
+    if (j.contains("integrator")) j.at("integrator").get_to(config.integrator);
+    if (j.contains("accel")) j.at("accel").get_to(config.accel);
+    if (j.contains("out_of_core_config")) j.at("out_of_core_config").get_to(config.out_of_core_config);
+    if (j.contains("bvh_builder")) j.at("bvh_builder").get_to(config.bvh_builder);
+    if (j.contains("sbvh_config")) j.at("sbvh_config").get_to(config.sbvh_config);
+    if (j.contains("treelet_config")) j.at("treelet_config").get_to(config.treelet_config);
+    if (j.contains("texture_config")) j.at("texture_config").get_to(config.texture_config);
+    if (j.contains("photon_config")) j.at("photon_config").get_to(config.photon_config);
+    if (j.contains("guiding_config")) j.at("guiding_config").get_to(config.guiding_config);
+    if (j.contains("denoise_config")) j.at("denoise_config").get_to(config.denoise_config);
+    if (j.contains("crop_config")) j.at("crop_config").get_to(config.crop_config);
+    if (j.contains("thread_config")) j.at("thread_config").get_to(config.thread_config);
+}
 
 #endif  // CONFIG_IO_H_
\ No newline at end of file
@@ -3,7 +3,9 @@
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
+#include <cstddef>
 #include <memory>
+#include <new>
 #include <vector>
 #include <stack>
 
@@ -22,10 +24,25 @@ constexpr float RAY_DEFAULT_MIN = 1e-5;
 constexpr float RAY_DEFAULT_MAX = 1e7;
 constexpr float PI = 3.141592653579f;
 
-class BSDF;
 class Sampler;
 
-#define USE_GLOBAL_BVH  // Turn on to use BVH acceleration
-#define USE_LINEARIZED_BVH  // Turn on to use compressed linear BVH
+// Allocator of vector storage aligned to cache lines (and so to AVX vectors)
+template <typename T>
+struct CacheAlignedAllocator {
+    using value_type = T;
+    static constexpr size_t ALIGNMENT = 64;
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    explicit CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT))); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U> &) const { return false; }
+};
 
 #endif  // CORE_H_
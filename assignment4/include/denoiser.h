@@ -0,0 +1,15 @@
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+#include "aov.h"
+#include "config.h"
+#include "image.h"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), applied in place to the image.
+// The color is divided by the albedo first, so that only the (smoother) illumination is blurred
+// and textures and material edges are restored afterwards. Every pass is a 5 x 5 B3-spline kernel
+// with holes of 2^pass pixels, whose taps are weighted down across color, normal, depth and
+// albedo discontinuities. The aovs must have been normalized.
+void denoise(ImageRGB &image, const AOVBuffers &aovs, const Config::DenoiseConfig &config);
+
+#endif  // DENOISER_H_
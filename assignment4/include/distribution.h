@@ -0,0 +1,54 @@
+#ifndef DISTRIBUTION_H_
+#define DISTRIBUTION_H_
+
+#include <vector>
+
+#include "core.h"
+
+// Discrete distribution over the bins of a non-negative piecewise-constant function,
+// sampled in O(1) with Walker's alias method (table built with Vose's algorithm).
+class AliasTable {
+   public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<float> &func);
+
+    // Pick a bin with probability proportional to its function value, given u in [0,1).
+    // The probability of the bin is returned in pmf, and a fresh uniform number in [0,1),
+    // recycled from the unused bits of u, is returned in remapped.
+    int sample(float u, float *pmf, float *remapped) const;
+
+    [[nodiscard]] float pmf(int i) const { return bins[i].pmf; }
+    // Sum of the function values (before normalization)
+    [[nodiscard]] float funcSum() const { return func_sum; }
+    [[nodiscard]] int size() const { return static_cast<int>(bins.size()); }
+
+   private:
+    struct Bin {
+        // probability of keeping the bin instead of jumping to its alias
+        float q;
+        int alias;
+        float pmf;
+    };
+    std::vector<Bin> bins;
+    float func_sum = 0;
+};
+
+// Piecewise-constant 2D distribution on [0,1]^2, given by an nu x nv grid of function values
+// (row-major, u varies fastest). A marginal table picks the row, a conditional table per row
+// picks the column, so sampling is O(1).
+class Distribution2D {
+   public:
+    Distribution2D() = default;
+    Distribution2D(const std::vector<float> &func, int nu, int nv);
+
+    // Sample a point in [0,1)^2. pdf is w.r.t. area on [0,1]^2.
+    Vec2f sample(const Vec2f &u, float *pdf) const;
+    [[nodiscard]] float pdf(const Vec2f &uv) const;
+
+   private:
+    int nu = 0, nv = 0;
+    std::vector<AliasTable> conditional;
+    AliasTable marginal;
+};
+
+#endif  // DISTRIBUTION_H_
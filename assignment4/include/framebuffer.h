@@ -0,0 +1,36 @@
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include <vector>
+
+#include "core.h"
+#include "image.h"
+
+// Accumulation buffer of the render passes: the radiance sums and the sample counts of the
+// pixels in separate float planes (R, G, B, weight) instead of an array of Vec3f. The rows are
+// padded to whole AVX vectors and the planes are cache-line aligned, so the per-pixel loops
+// run on aligned vectors.
+class Framebuffer {
+   public:
+    Framebuffer(int width, int height);
+
+    // Reset all pixels to zero samples
+    void clear();
+    // Add the sums of 'count' consecutive pixels of row y from x, each over 'weight' samples
+    void addRow(int x, int y, int count, const Vec3f *radiance, float weight);
+    // Write the average radiance of the pixels [low, high) to 'image', black for the pixels
+    // without samples
+    void resolve(ImageRGB &image, const Vec2i &low, const Vec2i &high) const;
+
+   private:
+    static constexpr int ROW_ALIGNMENT = 8;
+
+    using Plane = std::vector<float, CacheAlignedAllocator<float>>;
+
+    int width, height;
+    // floats per row, a multiple of the AVX width
+    int stride;
+    Plane red, green, blue, weight;
+};
+
+#endif  // FRAMEBUFFER_H_
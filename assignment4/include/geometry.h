@@ -15,41 +15,70 @@ class Triangle;
 class TriangleMesh {
    public:
     TriangleMesh() = default;
-    TriangleMesh(std::vector<Vec3f> vertices, std::vector<Vec3f> normals, std::vector<int> v_index, std::vector<int> n_index);
+    // Texture coordinates are optional, t_index entries may be -1 for vertices without one
+    TriangleMesh(std::vector<Vec3f> vertices, std::vector<Vec3f> normals, std::vector<int> v_index, std::vector<int> n_index,
+                 std::vector<Vec2f> uvs = {}, std::vector<int> t_index = {});
+    // Closest hit of the mesh, if it is closer than the interaction already found
     bool intersect(Ray &ray, Interaction &interaction) const;
-    void setMaterial(std::shared_ptr<BSDF> &new_bsdf);
+    void setMaterial(int new_material_id);
+    // Make the mesh the emitter of light 'new_light_id': its hits are light interactions
+    void setLight(int new_light_id) { light_id = new_light_id; }
+    // Translation of the mesh between the keyframes at times 0 and 1, zero for a static mesh
+    void setMotion(const Vec3f &new_motion) { motion = new_motion; }
 
-    // Generate an outmost AABB which contains all the triangles inside the triangle mesh.
+    // Generate an outmost AABB which contains all the triangles inside the triangle mesh,
+    // at all times.
     [[nodiscard]] AABB getAABB() const;
 
-    // Given a scene AABB box, return all triangles along with their morton code
-    void addToGlobalTriangles(std::vector<Triangle> &global_triangles, AABB &box);
+    // Given a scene AABB box, return all triangles along with their morton code, or only the
+    // triangles [first, end) of the mesh
+    void addToGlobalTriangles(std::vector<Triangle> &global_triangles, const AABB &box, int first = 0,
+                              int end = -1) const;
+    [[nodiscard]] int numTriangles() const { return static_cast<int>(v_indices.size() / 3); }
 
     // calculate morton code given a triangle's gravity center 
     static unsigned int calcMortonCode(const Vec3f& pos, const AABB& box);
 
    private:
-    bool intersectOneTriangle(Ray &ray, Interaction &interaction, const Vec3i &v_idx, const Vec3i &n_idx) const;
-    std::shared_ptr<BSDF> bsdf;
+    bool intersectOneTriangle(const Ray &ray, HitRecord &hit, int triangle) const;
+    void fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const;
+    // Texture coordinates of the vertices of a triangle, (0,0) (1,0) (0,1) when the mesh has none
+    void triangleUVs(int triangle, Vec2f &uv0, Vec2f &uv1, Vec2f &uv2) const;
+    int material_id = -1;
+    // light emitted by the mesh, -1 for ordinary geometry
+    int light_id = -1;
+    Vec3f motion{0, 0, 0};
 
     std::vector<Vec3f> vertices;
     std::vector<Vec3f> normals;
     std::vector<int> v_indices;
     std::vector<int> n_indices;
+    std::vector<Vec2f> uvs;
+    std::vector<int> t_indices;
 };
 
 
 // A triangle class. Contains a single triangle and morton code
 class Triangle {
    public:
-    Triangle(Vec3f v0, Vec3f v1, Vec3f v2, Vec3f n0, Vec3f n1, Vec3f n2, std::shared_ptr<BSDF> material, AABB aabb, unsigned int code):
-        v0(std::move(v0)), v1(std::move(v1)), v2(std::move(v2)), n0(std::move(n0)), n1(std::move(n1)), n2(std::move(n2)), bsdf(std::move(material)), aabb(aabb), morton_code(code) {}
-    bool intersect(Ray &ray, Interaction &interaction) const;
+    Triangle(Vec3f v0, Vec3f v1, Vec3f v2, Vec3f n0, Vec3f n1, Vec3f n2, int material_id, AABB aabb, unsigned int code):
+        v0(std::move(v0)), v1(std::move(v1)), v2(std::move(v2)), n0(std::move(n0)), n1(std::move(n1)), n2(std::move(n2)), material_id(material_id), aabb(aabb), morton_code(code) {}
+    // Record the hit of the ray in 'hit', as triangle 'index', if it is closer than the hit
+    // already recorded
+    bool intersect(const Ray &ray, HitRecord &hit, int index) const;
+    // Position, shading normal, texture coordinates and material of a hit recorded by intersect
+    void fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const;
 
    public:
     Vec3f v0, v1, v2, n0, n1, n2;
+    Vec2f uv0{0, 0}, uv1{1, 0}, uv2{0, 1};
+    // translation between the keyframes, the vertices at time t are v + t * motion
+    Vec3f motion{0, 0, 0};
+    // bounds of the triangle over both keyframes
     AABB aabb;
-    std::shared_ptr<BSDF> bsdf;
+    int material_id;
+    // light the triangle belongs to, -1 for geometry. Emitters are traversed with the geometry.
+    int light_id = -1;
 
    public:
     unsigned int morton_code;
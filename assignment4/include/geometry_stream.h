@@ -0,0 +1,107 @@
+#ifndef GEOMETRY_STREAM_H_
+#define GEOMETRY_STREAM_H_
+
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "lru_cache.h"
+
+// Plain layout of a triangle in the files of the out-of-core geometry
+struct TriangleRecord {
+    float v[3][3];
+    float n[3][3];
+    float uv[3][2];
+    float motion[3];
+    int material_id;
+    int light_id;
+
+    static TriangleRecord fromTriangle(const Triangle &triangle);
+};
+
+// Stand-in of a triangle for the construction of the out-of-core BVH: its bounds, Morton code
+// and index in the staging file. The Morton construction only reads these fields of Triangle.
+struct BuildPrimitive {
+    AABB aabb;
+    unsigned int morton_code = 0;
+    int index = 0;
+};
+
+// Triangles of the out-of-core geometry, written to a scratch file as the meshes are added so
+// that the scene is never expanded in memory. Only the build primitives (and the centroids,
+// until the Morton codes are known) are kept, about a quarter of the size of the triangles.
+class TriangleStager {
+   public:
+    explicit TriangleStager(const std::string &path);
+    ~TriangleStager();
+    TriangleStager(const TriangleStager &) = delete;
+    TriangleStager &operator=(const TriangleStager &) = delete;
+
+    // Append the triangles of the mesh
+    void add(const TriangleMesh &mesh);
+    // Set the Morton codes of the primitives in the scene box and release the centroids
+    void computeMortonCodes(const AABB &box);
+
+    [[nodiscard]] std::vector<BuildPrimitive> &getPrimitives() { return primitives; }
+    // whether a staged triangle moves between the keyframes
+    [[nodiscard]] bool hasMotion() const { return has_motion; }
+
+    // The staged records, indexed by BuildPrimitive::index. No triangle can be added afterwards.
+    const TriangleRecord *map();
+    // Drop the mapped pages read so far from the resident memory
+    void releasePages();
+
+   private:
+    std::string path;
+    int fd = -1;
+    std::vector<TriangleRecord> block;
+    std::vector<BuildPrimitive> primitives;
+    // mid-shutter centroids of the primitives, the positions of their Morton codes
+    std::vector<Vec3f> centroids;
+    bool has_motion = false;
+    const TriangleRecord *records = nullptr;
+    size_t mapped_bytes = 0;
+};
+
+// Out-of-core storage of the scene triangles. The triangles (in BVH order) are written to a
+// scratch file that is memory-mapped read only, in chunks made of whole BVH leaves. Every thread
+// pages the chunks it needs into a small LRU cache of decoded triangles and releases the mapped
+// pages right away, so the resident memory is bounded by the cache size and not by the scene.
+class ChunkedGeometry {
+   public:
+    // The triangles are gathered from the staging file in the order of 'order' (the BVH order
+    // of the primitives). 'chunk_starts' are the first triangle index of every chunk,
+    // increasing, the chunks must not split a BVH leaf. 'cache_bytes' is the cache size of all
+    // threads together.
+    ChunkedGeometry(const std::string &path, TriangleStager &staged, const std::vector<BuildPrimitive> &order,
+                    std::vector<int> chunk_starts, size_t cache_bytes);
+    ~ChunkedGeometry();
+    ChunkedGeometry(const ChunkedGeometry &) = delete;
+    ChunkedGeometry &operator=(const ChunkedGeometry &) = delete;
+
+    // Triangle 'index' in the cache of the calling thread. The following triangles of the same
+    // chunk (thus of the same leaf) are stored after it.
+    const Triangle *fetch(int index);
+
+    [[nodiscard]] int numChunks() const { return static_cast<int>(chunk_starts.size()) - 1; }
+
+   private:
+    // One per thread. The last chunk is kept aside, since consecutive leaves of a ray often
+    // share their chunk.
+    struct alignas(64) ThreadCache {
+        LRUCache<std::vector<Triangle>> chunks;
+        int last_chunk = -1;
+        const Triangle *last_triangles = nullptr;
+    };
+
+    const std::vector<Triangle> &load(ThreadCache &cache, int chunk);
+
+    int fd = -1;
+    const TriangleRecord *records = nullptr;
+    size_t mapped_bytes = 0;
+    // chunk_starts[numChunks()] is the number of triangles
+    std::vector<int> chunk_starts;
+    std::vector<ThreadCache> caches;
+};
+
+#endif  // GEOMETRY_STREAM_H_
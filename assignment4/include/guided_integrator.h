@@ -0,0 +1,34 @@
+#ifndef GUIDED_INTEGRATOR_H_
+#define GUIDED_INTEGRATOR_H_
+
+#include "config.h"
+#include "integrator.h"
+#include "sd_tree.h"
+
+// Path tracing with path guiding (Mueller et al. 2017). The incident radiance is learned online
+// in an SD-tree over training passes of 1, 4, 16, ... spp, each pass sampling the distribution
+// learned in the previous one. At non-delta vertices, the next direction is drawn from a mixture
+// of the BSDF and the learned distribution. Only the final passes, rendering the samples left
+// after training, contribute to the image.
+class GuidedIntegrator : public Integrator {
+   public:
+    GuidedIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth,
+                     const Config::GuidingConfig &config);
+    void render() const override;
+    Vec3f radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const override;
+
+   private:
+    Vec3f radiance(Ray &ray, Interaction &interaction, Sampler &sampler, int depth, FeatureSample *features) const;
+    template <typename BSDFType>
+    Vec3f shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                FeatureSample *features) const;
+
+    Config::GuidingConfig config;
+
+    // trained during the (const) render call
+    mutable SDTree sd_tree;
+    // whether the current pass records into the SD-tree
+    mutable bool training = false;
+};
+
+#endif  // GUIDED_INTEGRATOR_H_
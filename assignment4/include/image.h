@@ -7,6 +7,11 @@
 #include "core.h"
 #include "utils.h"
 
+// Gamma-encode 'count' linear values to 8 bits, the same codes as utils::gammaCorrection
+// (NaN and finite negative values give 0, -inf gives 255). The powers are approximated by vectorized polynomials and
+// the codes corrected against the exact code thresholds.
+void encodeGamma8(const float *linear, uint8_t *codes, size_t count);
+
 class ImageRGB {
    public:
     ImageRGB() = delete;
@@ -14,7 +19,20 @@ class ImageRGB {
     [[nodiscard]] float getAspectRatio() const;
     [[nodiscard]] Vec2i getResolution() const;
     void setPixel(int x, int y, const Vec3f &value);
+    // Set the 'count' consecutive pixels of row y from x
+    void setRow(int x, int y, int count, const Vec3f *values);
+    [[nodiscard]] const Vec3f &getPixel(int x, int y) const { return data[x + resolution.x() * y]; }
     void writeImgToFile(const std::string &file_name);
+    // Write the linear float values as a Radiance .hdr image
+    void writeHDRToFile(const std::string &file_name);
+
+    // Load a float (e.g. Radiance .hdr) image. Row 0 is the bottom row, as in writeImgToFile.
+    static ImageRGB readHDRFromFile(const std::string &file_name);
+
+    // Root mean square difference with an image of the same resolution, over the pixels [low, high)
+    [[nodiscard]] double rmse(const ImageRGB &other, const Vec2i &low, const Vec2i &high) const;
+    // Absolute difference with an image of the same resolution, per channel
+    [[nodiscard]] ImageRGB difference(const ImageRGB &other) const;
 
    private:
     std::vector<Vec3f> data;
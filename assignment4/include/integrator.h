@@ -1,23 +1,89 @@
 #ifndef INTEGRATOR_H_
 #define INTEGRATOR_H_
 
+#include <memory>
+
+#include "aov.h"
 #include "camera.h"
+#include "config.h"
+#include "framebuffer.h"
 #include "interaction.h"
 #include "scene.h"
 
 class Integrator {
    public:
     Integrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth);
-    void render() const;
-    Vec3f radiance(Ray &ray, Sampler &sampler, int depth) const;
+    virtual ~Integrator() = default;
+    virtual void render() const;
+    // Radiance along the ray. 'features' (nullptr if not needed) is filled along a camera path.
+    virtual Vec3f radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const;
+    // Also fill these feature buffers while rendering (they must match the image resolution)
+    void setAOVs(std::shared_ptr<AOVBuffers> buffers) { aovs = std::move(buffers); }
+    // Only render the pixels [low, high) of the image, the other pixels are left untouched
+    void setCropWindow(const Vec2i &low, const Vec2i &high) {
+        crop_low = low;
+        crop_high = high;
+    }
+    // Render 1 spp passes until 'seconds' of wall-clock time have elapsed instead of rendering
+    // spp samples, 0 to disable. Not supported by integrators with their own pass schedule.
+    void setTimeBudget(double seconds) { time_budget = seconds; }
 
-   private:
+   protected:
+    // Side of the square tiles the passes are scheduled by
+    static constexpr int TILE_SIZE = 16;
+
+    // Trace pass_spp_sqrt^2 stratified samples for every pixel and add their sum to accum.
+    // The pass index selects independent random sequences.
+    void renderPass(int pass, int pass_spp_sqrt, Framebuffer &accum) const;
+    // Write the averages of the accumulated samples to the pixels of the crop window
+    void writePixels(const Framebuffer &accum) const;
+    // Direct lighting at a geometry interaction (wo must be set), for any material
     Vec3f directLighting(Interaction &interaction, Sampler &sampler) const;
+    // Record the features of the vertex found by 'ray' at 'depth'. Returns whether they are
+    // still to be found further along the path, behind a delta BSDF.
+    bool recordFeatures(FeatureSample &features, const Ray &ray, const Interaction &interaction, int depth) const;
+
     std::shared_ptr<Camera> camera;
     std::shared_ptr<Scene> scene;
     int max_depth;
     int spp;
     int spp_sqrt;
+    // optional, nullptr when no features are needed
+    std::shared_ptr<AOVBuffers> aovs;
+    // rendered pixels, the whole image by default
+    Vec2i crop_low;
+    Vec2i crop_high;
+    // seconds, 0 to render spp samples
+    double time_budget = 0;
+
+   private:
+    // Radiance sums of the tiles a thread rendered in a pass, in the order it rendered them
+    // (aligned so that the threads do not share the cache lines of the vector headers)
+    struct alignas(64) ThreadTiles {
+        struct Tile {
+            // pixels [low, high) of the tile, clipped to the crop window
+            Vec2i low, high;
+            // first pixel of the tile in 'radiance', rows one after the other
+            size_t offset;
+        };
+        std::vector<Tile> tiles;
+        std::vector<Vec3f> radiance;
+    };
+
+    // Progressive passes until the time budget runs out, see setTimeBudget
+    void renderWithinBudget() const;
+    // Radiance along a ray whose closest intersection has already been found
+    Vec3f radiance(Ray &ray, Interaction &interaction, Sampler &sampler, int depth, FeatureSample *features) const;
+    // Shading kernels, instantiated once per BSDF type of the material variant.
+    template <typename BSDFType>
+    Vec3f shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                FeatureSample *features) const;
+    template <typename BSDFType>
+    Vec3f directLighting(const BSDFType &bsdf, Interaction &interaction, Sampler &sampler) const;
 };
 
+// The integrator selected by the config, rendering the image of the camera
+std::unique_ptr<Integrator> makeIntegrator(const Config &config, std::shared_ptr<Camera> camera,
+                                           std::shared_ptr<Scene> scene);
+
 #endif  // INTEGRATOR_H_
@@ -8,10 +8,27 @@ struct Interaction {
     Vec3f pos{0, 0, 0};
     float dist{RAY_DEFAULT_MAX};
     Vec3f normal{0, 0, 0};
-    std::shared_ptr<BSDF> material{nullptr};
+    // index into the scene material array
+    int material_id{-1};
     Vec3f wi{0, 0, 0};
     Vec3f wo{0, 0, 0};
     Type type{Type::NONE};
+    // interpolated texture coordinates, and sqrt(uv area / surface area) of the triangle hit
+    Vec2f uv{0, 0};
+    float uv_density{0};
+    // texture color of the material at the hit, multiplies the BSDF color
+    Vec3f texture{1, 1, 1};
+    // time of the ray that found the hit, the rays leaving it must have the same time
+    float time{0};
+};
+
+// Closest hit found so far by a traversal: the distance, the triangle and the barycentrics of
+// the hit on it. Only the final hit is turned into an Interaction, once the traversal is done.
+struct HitRecord {
+    float t{RAY_DEFAULT_MAX};
+    // triangle index in the structure traversed, -1 for no hit
+    int prim{-1};
+    float u{0}, v{0};
 };
 
 #endif  // INTERACTION_H_
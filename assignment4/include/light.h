@@ -4,7 +4,9 @@
 #include <vector>
 
 #include "core.h"
+#include "distribution.h"
 #include "geometry.h"
+#include "image.h"
 #include "ray.h"
 
 class Light {
@@ -19,9 +21,13 @@ class Light {
     
     [[nodiscard]] virtual Vec3f sample(Interaction &interaction, float *pdf, Sampler &sampler) const = 0;
     
+    // Brute-force test of the emitter. The BVH of the scene holds the emitter triangles, this is
+    // only used without acceleration structure.
     virtual bool intersect(Ray &ray, Interaction &interaction) const = 0;
 
     [[nodiscard]] virtual Vec3f getNormal() const = 0;
+    // Triangles of the emitter, added to the acceleration structure of the scene
+    [[nodiscard]] virtual const TriangleMesh &getMesh() const = 0;
 
    protected:
     // position of light in world space
@@ -44,6 +50,7 @@ class SquareAreaLight : public Light {
     bool intersect(Ray &ray, Interaction &interaction) const override;
 
     [[nodiscard]] Vec3f getNormal() const override;
+    [[nodiscard]] const TriangleMesh &getMesh() const override { return light_mesh; }
 
    protected:
     // build light mesh from position and size. position locates at the center of rectangle.
@@ -51,4 +58,29 @@ class SquareAreaLight : public Light {
     Vec2f size;
 };
 
+// Infinitely far away light around the scene, given by an equirectangular (latitude-longitude) HDR image.
+// +y is up. Directions are importance sampled proportionally to luminance * sin(theta) of the pixels.
+class EnvironmentLight {
+   public:
+    EnvironmentLight(const std::string &hdr_path, float scale);
+
+    // Radiance arriving from direction dir (pointing away from the scene)
+    [[nodiscard]] Vec3f emission(const Vec3f &dir) const;
+
+    // Sample a direction towards the environment. Returns the radiance from that direction,
+    // the direction and its solid angle pdf are returned through the pointers.
+    Vec3f sample(Vec3f *dir, float *pdf, Sampler &sampler) const;
+
+    // Solid angle pdf of sampling direction dir
+    [[nodiscard]] float pdf(const Vec3f &dir) const;
+
+   private:
+    ImageRGB image;
+    float scale;
+    Distribution2D distribution;
+
+    [[nodiscard]] static Vec2f dirToUV(const Vec3f &dir);
+    [[nodiscard]] static Vec3f uvToDir(const Vec2f &uv);
+};
+
 #endif  // LIGHT_H_
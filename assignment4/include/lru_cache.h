@@ -0,0 +1,55 @@
+#ifndef LRU_CACHE_H_
+#define LRU_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// Least recently used cache of at most 'capacity' values indexed by integer keys. It is not
+// thread safe, the renderer keeps one per thread.
+template <typename Value>
+class LRUCache {
+   public:
+    explicit LRUCache(size_t capacity = 1) : capacity(capacity) {}
+
+    void setCapacity(size_t new_capacity) { capacity = new_capacity; }
+
+    // The cached value of key, or nullptr. A found value becomes the most recently used one.
+    Value *find(uint64_t key) {
+        auto found = entries.find(key);
+        if (found == entries.end()) {
+            return nullptr;
+        }
+        order.splice(order.begin(), order, found->second.first);
+        return &found->second.second;
+    }
+
+    // Add the value of a key that is not cached. fill(Value &) sets the value up; when the cache
+    // is full, it receives the evicted least recently used value, whose storage can be reused.
+    // The returned reference stays valid until the value is evicted.
+    template <typename Fill>
+    Value &insert(uint64_t key, Fill &&fill) {
+        Value value{};
+        if (entries.size() >= capacity && !order.empty()) {
+            auto evicted = entries.find(order.back());
+            value = std::move(evicted->second.second);
+            entries.erase(evicted);
+            order.pop_back();
+        }
+        fill(value);
+        order.push_front(key);
+        auto &entry = entries[key];
+        entry.first = order.begin();
+        entry.second = std::move(value);
+        return entry.second;
+    }
+
+   private:
+    size_t capacity;
+    // most recently used first
+    std::list<uint64_t> order;
+    std::unordered_map<uint64_t, std::pair<std::list<uint64_t>::iterator, Value>> entries;
+};
+
+#endif  // LRU_CACHE_H_
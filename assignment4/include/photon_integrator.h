@@ -0,0 +1,39 @@
+#ifndef PHOTON_INTEGRATOR_H_
+#define PHOTON_INTEGRATOR_H_
+
+#include "config.h"
+#include "integrator.h"
+#include "photon_map.h"
+
+// Photon mapping (Jensen) with direct lighting computed by light sampling. Camera paths follow
+// delta BSDFs and end at the first non-delta surface, where the indirect light is estimated from
+// the density of the photons around it. This captures caustics, e.g. through mirrors and glass.
+// The progressive variant (Knaus & Zwicker 2011) averages passes with fresh photon maps and a
+// gather radius shrinking every pass, which makes the estimate consistent.
+class PhotonMappingIntegrator : public Integrator {
+   public:
+    PhotonMappingIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth,
+                            const Config::PhotonConfig &config, bool progressive);
+    void render() const override;
+    Vec3f radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const override;
+
+   private:
+    // Trace config.num_photons photons from the area light in parallel and build the photon map
+    void buildPhotonMap(int pass) const;
+
+    template <typename BSDFType>
+    Vec3f shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                FeatureSample *features) const;
+    // Density estimate of the reflected indirect radiance at a non-delta surface
+    template <typename BSDFType>
+    Vec3f estimateIndirect(const BSDFType &bsdf, Interaction &interaction) const;
+
+    Config::PhotonConfig config;
+    bool progressive;
+
+    // rebuilt at each pass of the (const) render call
+    mutable PhotonMap photon_map;
+    mutable float gather_radius;
+};
+
+#endif  // PHOTON_INTEGRATOR_H_
@@ -0,0 +1,76 @@
+#ifndef PHOTON_MAP_H_
+#define PHOTON_MAP_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "core.h"
+
+struct Photon {
+    Vec3f pos;
+    // flux carried by the photon
+    Vec3f power;
+    // normalized direction pointing back to where the photon came from
+    Vec3f wi;
+    // split axis of the kd-tree node stored at this photon
+    uint8_t axis = 0;
+};
+
+// Balanced kd-tree over photons (Jensen), stored implicitly in one array: the node of a range
+// [first, last) is its median element and the two subtrees are the ranges on either side.
+// There are no child pointers, and every subtree is contiguous in memory.
+class PhotonMap {
+   public:
+    PhotonMap() = default;
+
+    // Build the kd-tree in parallel. Takes ownership of the photons.
+    void build(std::vector<Photon> new_photons);
+
+    // Find the k photons nearest to pos within sqrt(max_dist_sq). They are returned in 'nearest'
+    // as (squared distance, photon index) pairs, organized as a max-heap on the distance.
+    void kNearest(const Vec3f &pos, int k, float max_dist_sq, std::vector<std::pair<float, int>> &nearest) const;
+
+    // Call func(photon) for every photon within 'radius' of pos.
+    template <typename Func>
+    void forEachInRadius(const Vec3f &pos, float radius, Func &&func) const {
+        if (!photons.empty()) {
+            forEachInRadius(pos, radius * radius, 0, static_cast<int>(photons.size()), func);
+        }
+    }
+
+    [[nodiscard]] const Photon &operator[](int i) const { return photons[i]; }
+    [[nodiscard]] size_t size() const { return photons.size(); }
+    [[nodiscard]] bool empty() const { return photons.empty(); }
+    // Bytes used by the photon map
+    [[nodiscard]] size_t memoryFootprint() const { return photons.capacity() * sizeof(Photon); }
+
+   private:
+    std::vector<Photon> photons;
+
+    void buildRange(int first, int last);
+    void kNearest(const Vec3f &pos, int k, float &max_dist_sq, int first, int last,
+                  std::vector<std::pair<float, int>> &nearest) const;
+
+    template <typename Func>
+    void forEachInRadius(const Vec3f &pos, float radius_sq, int first, int last, Func &func) const {
+        while (first < last) {
+            int mid = (first + last) / 2;
+            const Photon &p = photons[mid];
+            if ((p.pos - pos).squaredNorm() <= radius_sq) {
+                func(p);
+            }
+            float diff = pos[p.axis] - p.pos[p.axis];
+            // recurse into the far side only if the sphere crosses the split plane, loop on the near side
+            if (diff < 0) {
+                if (diff * diff <= radius_sq) forEachInRadius(pos, radius_sq, mid + 1, last, func);
+                last = mid;
+            } else {
+                if (diff * diff <= radius_sq) forEachInRadius(pos, radius_sq, first, mid, func);
+                first = mid + 1;
+            }
+        }
+    }
+};
+
+#endif  // PHOTON_MAP_H_
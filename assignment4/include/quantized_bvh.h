@@ -0,0 +1,57 @@
+#ifndef QUANTIZED_BVH_H_
+#define QUANTIZED_BVH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "accel.h"
+#include "geometry.h"
+#include "interaction.h"
+
+// A 4-wide BVH node in one cache line. The bounds of the children are stored with 8 bits per
+// plane, on a grid local to the node: child bound = origin + q * scale. The grid is rounded
+// outwards, so the decoded boxes always contain the exact ones.
+struct alignas(64) QuantizedBVHNode {
+    float origin[3];
+    // power of two per axis
+    float scale[3];
+    // quantized child bounds, [axis][child]
+    uint8_t low[3][4];
+    uint8_t high[3][4];
+    // LEAF_BIT | first triangle << 3 | (triangle count - 1) for a leaf, the node index otherwise,
+    // EMPTY for unused slots (always after the used ones)
+    uint32_t child[4];
+
+    static constexpr uint32_t LEAF_BIT = 0x80000000u;
+    static constexpr uint32_t EMPTY = 0xffffffffu;
+};
+static_assert(sizeof(QuantizedBVHNode) == 64, "a quantized node should fill one cache line");
+
+// 4-wide BVH with quantized nodes, collapsed from the binary BVH. It takes about half the memory
+// of the linear BVH for the same tree and visits fewer nodes, the boxes are decoded on the fly
+// during the traversal.
+class QuantizedBVH {
+   public:
+    QuantizedBVH() = default;
+
+    // Collapse the binary BVH (whose leaves hold at most 8 triangles) into 4-wide nodes
+    void build(const BVHNode *root);
+
+    // Record the closest hit among 'triangles' (the triangle array the BVH was built on) if it is
+    // closer than the hit already recorded
+    bool intersect(const Ray &ray, HitRecord &hit, const std::vector<Triangle> &triangles) const;
+
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+    // Bytes used by the nodes
+    [[nodiscard]] size_t memoryFootprint() const { return nodes.capacity() * sizeof(QuantizedBVHNode); }
+
+   private:
+    // Returns the index of the node built for 'node', which must be an internal node
+    uint32_t collapse(const BVHNode *node, int depth);
+    static uint32_t encodeLeaf(const BVHNode *leaf);
+
+    std::vector<QuantizedBVHNode> nodes;
+    int max_depth = 0;
+};
+
+#endif  // QUANTIZED_BVH_H_
@@ -3,6 +3,9 @@
 
 #include "core.h"
 
+// Cone spread added by a non-delta bounce
+constexpr float ROUGH_CONE_SPREAD = 0.05f;
+
 struct Ray {
     // origin point of ray
     Vec3f origin;
@@ -11,11 +14,25 @@ struct Ray {
     // min and max distance of the ray
     float t_min;
     float t_max;
+    // Ray cone used to select texture mip levels: width of the footprint at the origin, and its
+    // growth per unit distance. Zero for rays whose footprint is unknown (finest level).
+    float cone_width = 0;
+    float cone_spread = 0;
+    // scene time of the ray, moving objects are interpolated between their keyframes at 0 and 1
+    float time = 0;
 
     explicit Ray(const Vec3f &o, const Vec3f &dir, float t_min = RAY_DEFAULT_MIN, float t_max = RAY_DEFAULT_MAX)
         : origin(o), direction(dir), t_min(t_min), t_max(t_max) {}
 
     [[nodiscard]] Vec3f operator()(float t) const { return origin + t * direction; }
+
+    // Continue the path of 'parent' from its hit at distance 'dist': same time, and the cone
+    // carried over. Rough bounces blur the footprint, they widen the cone by 'extra_spread'.
+    void continuePath(const Ray &parent, float dist, float extra_spread = 0) {
+        time = parent.time;
+        cone_width = parent.cone_width + parent.cone_spread * dist;
+        cone_spread = parent.cone_spread + extra_spread;
+    }
 };
 
 #endif  // RAY_H_
@@ -0,0 +1,80 @@
+#ifndef RENDER_PROTOCOL_H_
+#define RENDER_PROTOCOL_H_
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Messages exchanged with the render server (server.cpp) over a local Unix socket. Every
+// message is a 32-bit length in host byte order followed by that many bytes.
+//
+// A client sends jobs, one JSON message each:
+//   {"config": {...scene config...}, "camera": {...cam_config fields to override...}}
+// and the server answers every job with a JSON header
+//   {"status": "ok", "width": w, "height": h, "cached": bool, "setup_seconds": s, "render_seconds": s}
+// followed by the linear float RGB pixels (w * h * 3 floats, bottom row first), or with
+//   {"status": "error", "message": "..."}
+// alone. A connection may carry any number of jobs, they are rendered in order.
+namespace render_protocol {
+
+// socket used when none is given, relative to the working directory
+constexpr const char *DEFAULT_SOCKET_PATH = "render.sock";
+
+inline bool writeAll(int fd, const void *data, size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void *data, size_t size) {
+    char *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool sendMessage(int fd, const void *data, size_t size) {
+    const auto length = static_cast<uint32_t>(size);
+    return writeAll(fd, &length, sizeof(length)) && writeAll(fd, data, size);
+}
+
+inline bool sendMessage(int fd, const std::string &message) {
+    return sendMessage(fd, message.data(), message.size());
+}
+
+// false when the connection is closed
+inline bool receiveMessage(int fd, std::string &message) {
+    uint32_t length;
+    if (!readAll(fd, &length, sizeof(length))) return false;
+    message.resize(length);
+    return readAll(fd, message.data(), length);
+}
+
+// Socket address of a path, false if the path is too long
+inline bool socketAddress(const std::string &path, sockaddr_un &address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return true;
+}
+
+}  // namespace render_protocol
+
+#endif  // RENDER_PROTOCOL_H_
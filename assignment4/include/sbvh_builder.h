@@ -0,0 +1,67 @@
+#ifndef SBVH_BUILDER_H_
+#define SBVH_BUILDER_H_
+
+#include <limits>
+#include <vector>
+
+#include "accel.h"
+#include "config.h"
+#include "geometry.h"
+
+// Spatial split BVH builder (Stich et al. 2009). Every node picks the best of a binned SAH
+// object split and, when the children of that split overlap, a binned spatial split which
+// clips the triangles against the split plane and references the straddling ones from both
+// sides. The references are then unsplit again where that is cheaper. Spatial splits stop once
+// the number of references reaches (1 + max_duplication) times the number of triangles.
+//
+// The result is a BVHNode hierarchy with leaves of at most 8 triangles, like the Morton
+// builder, so it can be linearized or collapsed in the same way.
+class SBVHBuilder {
+   public:
+    SBVHBuilder(std::vector<Triangle> &triangles, const Config::SBVHConfig &config);
+
+    // Build the hierarchy. 'triangles' is replaced by the triangles referenced by the leaves,
+    // in leaf order (a triangle split by spatial splits appears several times).
+    BVHNode *build();
+
+    [[nodiscard]] int numSpatialSplits() const { return spatial_splits; }
+
+   private:
+    struct Reference {
+        int triangle;
+        // bounds of the part of the triangle inside the node
+        AABB box;
+    };
+
+    struct Split {
+        // SAH cost, infinite until a split is found
+        float cost = std::numeric_limits<float>::infinity();
+        int axis = -1;
+        float position = 0;
+        bool spatial = false;
+        // bounds of the children, for the reference unsplitting
+        AABB left, right;
+        int left_count = 0, right_count = 0;
+    };
+
+    BVHNode *buildNode(std::vector<Reference> &refs, const AABB &box, int depth);
+    BVHNode *makeLeaf(const std::vector<Reference> &refs, const AABB &box);
+    Split findObjectSplit(const std::vector<Reference> &refs) const;
+    Split findSpatialSplit(const std::vector<Reference> &refs, const AABB &box) const;
+    void partitionObject(std::vector<Reference> &refs, const Split &split, std::vector<Reference> &left,
+                         std::vector<Reference> &right) const;
+    void partitionSpatial(std::vector<Reference> &refs, const Split &split, std::vector<Reference> &left,
+                          std::vector<Reference> &right);
+    // Bounds of the parts of the referenced triangle on either side of the plane
+    void splitReference(const Reference &ref, int axis, float position, Reference &left, Reference &right) const;
+
+    std::vector<Triangle> &triangles;
+    std::vector<Triangle> leaf_triangles;
+    Config::SBVHConfig config;
+    float root_area = 0;
+    size_t num_references = 0;
+    size_t max_references = 0;
+    int spatial_splits = 0;
+};
+
+#endif  // SBVH_BUILDER_H_
@@ -6,30 +6,94 @@
 #include "camera.h"
 #include "config.h"
 #include "geometry.h"
+#include "geometry_stream.h"
+#include "quantized_bvh.h"
 #include "image.h"
 #include "interaction.h"
 #include "light.h"
+#include "texture.h"
 
 class Scene {
    public:
     Scene() = default;
+    ~Scene() { deleteHierarchy(bvh_root); }
+    // the scene owns its BVH nodes
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
     void addObject(std::shared_ptr<TriangleMesh> &geometry);
     [[nodiscard]] const std::shared_ptr<Light> &getLight() const;
     void setLight(const std::shared_ptr<Light> &new_light);
+    // The environment light is optional, nullptr if the scene has none
+    [[nodiscard]] const std::shared_ptr<EnvironmentLight> &getEnvLight() const { return env_light; }
+    void setEnvLight(const std::shared_ptr<EnvironmentLight> &new_env_light) { env_light = new_env_light; }
+    // Add a material to the flat material array and return its id. 'texture' is the id of the
+    // texture multiplying its color in the texture store, -1 for none.
+    int addMaterial(const BSDF &material, int texture = -1);
+    // Store of the material textures, finalized
+    void setTextures(std::shared_ptr<TextureStore> new_textures) { textures = std::move(new_textures); }
+    [[nodiscard]] const BSDF &getMaterial(int material_id) const { return materials[material_id]; }
+    // Bounding box of all objects in the scene
+    [[nodiscard]] AABB getAABB() const;
     bool isShadowed(Ray &shadow_ray);
+    // Closest intersection, with the texture color of the material looked up at the hit
     bool intersect(Ray &ray, Interaction &interaction);
 
+    // Select the acceleration structure used by intersect. Call build_global_BVH afterwards
+    // (initSceneFromConfig does both).
+    void setAccel(AccelType new_accel);
+    [[nodiscard]] AccelType getAccel() const { return accel; }
+    void setOutOfCoreConfig(const Config::OutOfCoreConfig &new_config) { out_of_core_config = new_config; }
+    // Select how build_global_BVH builds the hierarchy
+    void setBVHBuilder(BVHBuilderType new_builder, const Config::SBVHConfig &new_sbvh_config,
+                       const Config::TreeletConfig &new_treelet_config) {
+        bvh_builder = new_builder;
+        sbvh_config = new_sbvh_config;
+        treelet_config = new_treelet_config;
+    }
+    // Bytes used by the nodes of the acceleration structure
+    [[nodiscard]] size_t accelMemoryFootprint() const;
+
     // We want a global BVH for the whole scene, instead of constructing
     // an independent BVH for each object (or, class TriangleMesh).
     // Therefore, instead of storing the BVH data and functions in TriangleMesh,
     // we store it in the Scene class.
 
-    // Build BVH (for the whole scene, not for each object)
+    // Build BVH (for the whole scene, not for each object).
+    // With the out-of-core structure, the objects are staged on disk as they are added (select
+    // the structure first) and released, their triangles end in the chunk file, so the BVH can
+    // not be built again.
     void build_global_BVH();
 
    private:
     std::vector<std::shared_ptr<TriangleMesh>> objects;
     std::shared_ptr<Light> light;
+    std::shared_ptr<EnvironmentLight> env_light;
+    std::vector<BSDF> materials;
+    // texture id of every material, -1 for none
+    std::vector<int> material_textures;
+    std::shared_ptr<TextureStore> textures;
+
+    // Closest intersection, without texturing
+    bool intersectClosest(Ray &ray, Interaction &interaction);
+
+    AccelType accel = AccelType::LINEAR_BVH;
+    // Closest-hit query specialized for the selected acceleration structure. It is chosen once
+    // by setAccel, so the traversal loops do not branch on the structure.
+    bool (Scene::*intersect_accel)(Ray &, Interaction &) = &Scene::intersectWith<AccelType::LINEAR_BVH>;
+    template <AccelType accel_type>
+    bool intersectWith(Ray &ray, Interaction &interaction);
+
+    Config::OutOfCoreConfig out_of_core_config;
+    BVHBuilderType bvh_builder = BVHBuilderType::LBVH;
+    Config::SBVHConfig sbvh_config;
+    Config::TreeletConfig treelet_config;
+    // triangles of the out-of-core structure, 'triangles' is empty then
+    std::unique_ptr<ChunkedGeometry> chunked_geometry;
+    // triangles of the out-of-core objects until the structure is built
+    std::unique_ptr<TriangleStager> stager;
+    // bounds of the objects, kept when they are released
+    AABB scene_aabb;
+    bool has_scene_aabb = false;
 
     // In the scene, we don't store a list of TriangleMesh, but we directly store Triangles.
     std::vector<Triangle> triangles;
@@ -37,29 +101,48 @@ class Scene {
     // BVH tree data 
     BVHNode *bvh_root = nullptr;
 
-    // Generate Top-down BVH hierarchy
-    BVHNode *generateHierarchy(int first, int last);
+    // Generate Top-down BVH hierarchy over the primitives sorted by Morton code (the triangles,
+    // or the build primitives of the out-of-core structure)
+    template <typename Primitive>
+    static BVHNode *generateHierarchy(const std::vector<Primitive> &primitives, int first, int last);
 
     // Assist function for 'generateHierarchy'
-    int findSplit(int first, int last);
+    template <typename Primitive>
+    static int findSplit(const std::vector<Primitive> &primitives, int first, int last);
 
     // Create a new Leaf node or Internal Node
-    BVHNode *newLeafNode(int start, int end);
+    template <typename Primitive>
+    static BVHNode *newLeafNode(const std::vector<Primitive> &primitives, int start, int end);
     static BVHNode *newInternalNode(BVHNode *left, BVHNode *right);
+    static void deleteHierarchy(BVHNode *node);
 
-    #ifndef USE_LINEARIZED_BVH
-    // BVH hit
-    bool bvhHit(Ray &ray, Interaction &interaction, BVHNode *node);
-    #endif
+    // BVH hit, 'slab_ray' being 'ray' prepared for the box tests
+    bool bvhHit(Ray &ray, const SlabRay &slab_ray, HitRecord &hit, BVHNode *node);
 
     // Linear BVH data
-    std::vector<LinearBVHNode> linear_bvh_nodes;
-
-    // Linear BVH construction
-    void genLinearBVH(BVHNode *node);
-
-    // Linear BVH hit
-    bool LinearBVHHit(Ray &ray, Interaction &interaction);
+    std::vector<LinearBVHNode, CacheAlignedAllocator<LinearBVHNode>> linear_bvh_nodes;
+    // Bounds of the linear BVH nodes at time 1 when the scene has moving triangles (the node
+    // bounds are then those at time 0), empty for a static scene
+    std::vector<AABB> linear_bvh_end_bounds;
+
+    // 4-wide quantized BVH, built from the pointer-based BVH
+    QuantizedBVH quantized_bvh;
+
+    // Write the mesh to the staging file of the out-of-core structure
+    void stage(const TriangleMesh &mesh);
+    // Morton BVH of the staged triangles, which are then gathered into the chunk file
+    void buildOutOfCore();
+
+    // Linear BVH construction: children pairs clustered into page-sized blocks
+    void genLinearBVH(BVHNode *root);
+    // Compute the node bounds at both keyframes, bottom-up
+    void refitMotionBounds();
+    // Bounds of a linear BVH node at the given time, interpolated between the keyframes
+    [[nodiscard]] AABB linearNodeBounds(int index, float time) const;
+
+    // Linear BVH hit, reading the leaves from the chunked geometry if 'streamed'
+    template <bool streamed>
+    bool LinearBVHHit(Ray &ray, HitRecord &hit);
 };
 
 void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene);
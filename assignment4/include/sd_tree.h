@@ -0,0 +1,84 @@
+#ifndef SD_TREE_H_
+#define SD_TREE_H_
+
+#include <vector>
+
+#include "accel.h"
+#include "core.h"
+
+// Directional distribution over the sphere, stored as a quadtree over the cylindrical mapping
+// (cos(theta), phi) -> [0, 1)^2, which preserves area up to the constant 4 * pi. Every node
+// holds the energy of its four quadrants, and a quadrant without child node is a leaf.
+class DTree {
+   public:
+    DTree();
+
+    // Add an estimate of the incident radiance from dir (divided by its sampling pdf).
+    // Thread-safe, several threads may record into the same tree concurrently.
+    void record(const Vec3f &dir, float value);
+
+    // Sample a direction proportional to the recorded energy, and its solid angle density
+    Vec3f sample(Sampler &sampler) const;
+    [[nodiscard]] float pdf(const Vec3f &dir) const;
+
+    // Replace the structure by a subdivision of 'previous': a quadrant is refined when it
+    // holds more than 'threshold' of the total energy. All energies are reset to zero.
+    void rebuild(const DTree &previous, float threshold, int max_depth);
+
+    [[nodiscard]] float energy() const;
+    // number of recorded samples
+    [[nodiscard]] float samples() const { return sample_count; }
+    void halveSamples() { sample_count /= 2; }
+    [[nodiscard]] size_t memoryFootprint() const { return nodes.capacity() * sizeof(Node); }
+
+   private:
+    struct Node {
+        float sum[4] = {0, 0, 0, 0};
+        // index of the child node of each quadrant, 0 for leaves (the root is never a child)
+        int child[4] = {0, 0, 0, 0};
+        [[nodiscard]] float total() const { return sum[0] + sum[1] + sum[2] + sum[3]; }
+    };
+
+    std::vector<Node> nodes;
+    float sample_count = 0;
+};
+
+// Spatial-directional tree (Mueller et al. 2017, "Practical Path Guiding"). A binary tree halves
+// the scene bounds along alternating axes, and each of its leaves keeps two directional trees:
+// the one learned in the previous training pass, used for sampling, and the one being recorded.
+// The structure only changes in refine(), between passes; during a pass, lookups are read-only
+// and the recording is done with atomic additions.
+class SDTree {
+   public:
+    struct Leaf {
+        DTree sampling;
+        DTree building;
+    };
+
+    explicit SDTree(const AABB &bounds);
+
+    Leaf &lookup(const Vec3f &pos);
+
+    // End a training pass: split the leaves with more than spatial_threshold samples, until the
+    // memory footprint reaches max_bytes, then learn the directional distributions recorded in
+    // the pass and refine the structure of the next ones.
+    void refine(float spatial_threshold, float energy_threshold, int max_depth, size_t max_bytes);
+
+    [[nodiscard]] size_t numLeaves() const { return leaves.size(); }
+    [[nodiscard]] size_t memoryFootprint() const;
+
+   private:
+    struct Node {
+        int axis = 0;
+        // index of the two children, 0 for leaves
+        int child[2] = {0, 0};
+        // index into leaves, for leaf nodes
+        int leaf = -1;
+    };
+
+    AABB bounds;
+    std::vector<Node> nodes;
+    std::vector<Leaf> leaves;
+};
+
+#endif  // SD_TREE_H_
@@ -0,0 +1,79 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <omp.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Render statistics: counters of the hot paths, kept per thread and merged when reported.
+// They are only compiled in with the RENDER_STATS CMake option, the STATS_* macros expand to
+// nothing otherwise.
+namespace stats {
+
+enum Counter {
+    // closest-hit queries to the scene (all rays, including the shadow rays)
+    RAYS,
+    SHADOW_RAYS,
+    PRIMARY_RAYS,
+    BVH_NODES_VISITED,
+    TRIANGLE_TESTS,
+    // cache lines (64 bytes) and pages (4 KiB) of linear BVH nodes entered by the traversals: a
+    // node read from another line or page than the previous node read for the same ray
+    BVH_NODE_LINES,
+    BVH_NODE_PAGES,
+    // surface and light vertices found by camera paths
+    PATH_VERTICES,
+    // chunks paged in by the out-of-core geometry
+    GEOMETRY_CHUNK_LOADS,
+    NUM_COUNTERS
+};
+
+// One cache line per thread, so that the threads do not share the lines they write to
+struct alignas(64) ThreadCounters {
+    uint64_t values[NUM_COUNTERS] = {};
+    // time spent in render passes by the thread
+    double busy_seconds = 0;
+};
+
+// Counters of the calling thread, allocated on first use. The pointer is constant-initialized,
+// so that accessing it does not go through a thread_local initialization guard.
+ThreadCounters *registerThread();
+inline thread_local ThreadCounters *thread_counters = nullptr;
+inline ThreadCounters &local() {
+    if (!thread_counters) thread_counters = registerThread();
+    return *thread_counters;
+}
+
+constexpr bool enabled() {
+#ifdef RENDER_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Merged counters of all threads
+std::array<uint64_t, NUM_COUNTERS> totals();
+
+// Merge the counters of all threads, print a summary and optionally dump it to a json file.
+// 'seconds' is the wall time of the render, for the ray throughput.
+void report(double seconds, const std::string &json_path = "");
+
+}  // namespace stats
+
+// STATS_TIMER_START(name) declares a timer, STATS_TIMER_STOP(name) adds the time since to the
+// busy time of the thread
+#ifdef RENDER_STATS
+#define STATS_ADD(counter, n) (stats::local().values[stats::counter] += (n))
+#define STATS_TIMER_START(name) const double name = omp_get_wtime()
+#define STATS_TIMER_STOP(name) (stats::local().busy_seconds += omp_get_wtime() - (name))
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_TIMER_START(name) ((void)0)
+#define STATS_TIMER_STOP(name) ((void)0)
+#endif
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+
+#endif  // STATS_H_
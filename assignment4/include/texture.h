@@ -0,0 +1,70 @@
+#ifndef TEXTURE_H_
+#define TEXTURE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "core.h"
+#include "lru_cache.h"
+
+// Store of all the image textures of the scene. Every texture is mip-mapped and cut into square
+// tiles of 8-bit sRGB texels, which are written to a scratch file and memory-mapped read only.
+// Lookups go through a small per-thread LRU cache of tiles (the mapped pages are released once
+// a tile is cached), so the memory held for textures is bounded by the cache size whatever the
+// number and size of the textures.
+class TextureStore {
+   public:
+    explicit TextureStore(const Config::TextureConfig &config);
+    ~TextureStore();
+    TextureStore(const TextureStore &) = delete;
+    TextureStore &operator=(const TextureStore &) = delete;
+
+    // Load an 8-bit image (png, jpg, ...), build its mip chain and write its tiles. Returns the
+    // texture id. All textures must be loaded before finalize().
+    int load(const std::string &path);
+    // Map the tile file, lookups are possible from now on
+    void finalize();
+
+    // Trilinearly filtered linear color at uv (repeated outside [0,1]). 'width' is the size of
+    // the footprint in uv units, which selects the mip levels.
+    [[nodiscard]] Vec3f lookup(int texture, const Vec2f &uv, float width) const;
+
+    [[nodiscard]] int numTextures() const { return static_cast<int>(textures.size()); }
+
+   private:
+    static constexpr int TILE_SIZE = 32;
+    static constexpr size_t TILE_BYTES = TILE_SIZE * TILE_SIZE * 4;
+
+    struct Level {
+        int width, height;
+        int tiles_x;
+        size_t first_tile;
+    };
+    struct Texture {
+        std::vector<Level> levels;
+    };
+    using Tile = std::vector<uint8_t>;
+
+    struct alignas(64) ThreadCache {
+        LRUCache<Tile> tiles;
+        size_t last_tile = SIZE_MAX;
+        const uint8_t *last_texels = nullptr;
+    };
+
+    void writeLevel(const std::vector<Vec3f> &texels, int width, int height);
+    [[nodiscard]] Vec3f bilinear(const Level &level, const Vec2f &uv) const;
+    [[nodiscard]] Vec3f texel(const Level &level, int x, int y) const;
+    [[nodiscard]] const uint8_t *tile(size_t index) const;
+
+    Config::TextureConfig config;
+    std::vector<Texture> textures;
+    int fd = -1;
+    size_t num_tiles = 0;
+    const uint8_t *tile_data = nullptr;
+    size_t mapped_bytes = 0;
+    mutable std::vector<ThreadCache> caches;
+};
+
+#endif  // TEXTURE_H_
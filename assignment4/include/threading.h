@@ -0,0 +1,18 @@
+#ifndef THREADING_H_
+#define THREADING_H_
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+// Set the number of OpenMP threads and pin every thread to a CPU according to the affinity.
+// Call it before the first parallel region: OpenMP keeps the same threads for the following
+// regions of the same size, which keep their CPU. Returns a one line summary of the placement.
+std::string setupThreads(const Config::ThreadConfig &config);
+
+// NUMA node of every CPU the process may run on, indexed by CPU id (-1 for the CPUs it may not
+// run on). All CPUs are on node 0 when the system does not expose its NUMA topology.
+std::vector<int> cpuNodes();
+
+#endif  // THREADING_H_
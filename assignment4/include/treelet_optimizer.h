@@ -0,0 +1,41 @@
+#ifndef TREELET_OPTIMIZER_H_
+#define TREELET_OPTIMIZER_H_
+
+#include "accel.h"
+#include "config.h"
+
+// Treelet restructuring of a built BVH (Karras and Aila 2013), run after the Morton builder.
+// Bottom-up, every internal node is the root of a treelet: its descendants are expanded (the
+// largest first) until the treelet has treelet_size leaves, and the topology of the treelet
+// with the lowest SAH cost is found exhaustively over the subsets of its leaves. The treelet
+// is relinked when that is cheaper. The subtrees are processed in parallel with OpenMP tasks.
+//
+// Only the internal nodes are rearranged: the leaves keep their triangle ranges, so the result
+// can be linearized or collapsed like the Morton tree.
+class TreeletOptimizer {
+   public:
+    explicit TreeletOptimizer(const Config::TreeletConfig &config);
+
+    // Restructure the hierarchy in place
+    void optimize(BVHNode *root);
+
+    // SAH cost of the tree before and after, relative to the surface area of the root
+    [[nodiscard]] float initialCost() const { return initial_cost; }
+    [[nodiscard]] float finalCost() const { return final_cost; }
+    [[nodiscard]] int numRestructured() const { return restructured; }
+
+    // largest treelet, the optimization visits the 3^n partitions of its leaves
+    static constexpr int MAX_TREELET_SIZE = 8;
+
+   private:
+    // One pass over the subtree, bottom-up. The costs of the nodes below are up to date after it.
+    void optimizeSubtree(BVHNode *node);
+    // Relink the treelet rooted at 'root' if a cheaper topology exists. Returns true if it did.
+    bool restructure(BVHNode *root) const;
+
+    Config::TreeletConfig config;
+    float initial_cost = 0, final_cost = 0;
+    int restructured = 0;
+};
+
+#endif  // TREELET_OPTIMIZER_H_
@@ -29,6 +29,22 @@ static inline Vec3f deNan(const Vec3f& vec, float val) {
     return tmp;
 }
 
+// Power heuristic (beta = 2) MIS weight of a sample drawn with pdf_a, also drawable with pdf_b
+static inline float powerHeuristic(float pdf_a, float pdf_b) {
+    float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0.f;
+}
+
+// Integer hash (Wellons' lowbias32) to decorrelate consecutive random seeds
+static inline uint32_t hashSeed(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
 // A function to check if a radiance color vector is valid.
 static bool is_invalid(const Vec3f& v) {
     return (std::isnan(v.x()) || std::isnan(v.y()) || std::isnan(v.z()) ||  // isnan
@@ -43,7 +59,12 @@ class Sampler {
     Sampler() = default;
     float get1D() { return dis(engine); }
     Vec2f get2D() { return {dis(engine), dis(engine)}; }
-    void setSeed(int i) { engine.seed(i); }
+    // Consecutive seeds are scrambled first, since the linear congruential engine
+    // would produce correlated sequences for them. The high half of a 64-bit seed is folded in
+    // (seeds below 2^32 are hashed as they are).
+    void setSeed(uint64_t i) {
+        engine.seed(utils::hashSeed(static_cast<uint32_t>(i) ^ utils::hashSeed(static_cast<uint32_t>(i >> 32))));
+    }
 
    private:
     std::default_random_engine engine;
@@ -4,26 +4,88 @@
 #include "integrator.h"
 #include "config_io.h"
 #include "config.h"
+#include "denoiser.h"
+#include "stats.h"
+#include "threading.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
 #include <fstream>
+#include <optional>
 
 int main(int argc, char *argv[]) {
     setbuf(stdout, nullptr);
+    // the time budget also covers loading the scene
+    const auto program_start = std::chrono::steady_clock::now();
+
+    // usage: main [config.json] [--stats stats.json] [--accel none|bvh|linear_bvh]
+    //             [--crop x,y,width,height] [--crop-spp spp] [--base image.hdr]
+    //             [--time-budget seconds] [--threads count] [--affinity none|compact|scatter]
+    std::string config_path;
+    std::string stats_path;
+    std::string accel_name;
+    std::optional<std::array<int, 4>> crop_window;
+    int crop_spp = 0;
+    std::string base_image;
+    float time_budget = 0;
+    int threads = 0;
+    std::string affinity_name;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stats" && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (arg == "--accel" && i + 1 < argc) {
+            accel_name = argv[++i];
+        } else if (arg == "--crop" && i + 1 < argc) {
+            std::array<int, 4> window{};
+            if (std::sscanf(argv[++i], "%d,%d,%d,%d", &window[0], &window[1], &window[2], &window[3]) != 4) {
+                std::cerr << "Invalid crop window " << argv[i] << ", expected x,y,width,height. Exit." << std::endl;
+                exit(-1);
+            }
+            crop_window = window;
+        } else if (arg == "--crop-spp" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d", &crop_spp) != 1 || crop_spp <= 0) {
+                std::cerr << "Invalid crop sample count " << argv[i] << ", expected a positive integer. Exit."
+                          << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--base" && i + 1 < argc) {
+            base_image = argv[++i];
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%f", &time_budget) != 1 || !(time_budget > 0)) {
+                std::cerr << "Invalid time budget " << argv[i] << ", expected a positive number of seconds. Exit."
+                          << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d", &threads) != 1 || threads <= 0) {
+                std::cerr << "Invalid thread count " << argv[i] << ", expected a positive integer. Exit." << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--affinity" && i + 1 < argc) {
+            affinity_name = argv[++i];
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown option " << arg << ". Exit." << std::endl;
+            exit(-1);
+        } else {
+            config_path = arg;
+        }
+    }
 
     // load config from json file
     Config config;
     std::ifstream fin;
-    if (argc == 1) {
+    if (config_path.empty()) {
         std::cout << "No json specified, use default path." << std::endl;
-        fin.open("../configs/simple.json");
-    } else {
-        fin.open(argv[1]);
+        config_path = "../configs/simple.json";
     }
+    fin.open(config_path);
     if (!fin.is_open()) {
         std::cerr << "Can not open json file. Exit." << std::endl;
         exit(0);
     } else {
-        std::cout << "Json file loaded from " << argv[1] << std::endl;
+        std::cout << "Json file loaded from " << config_path << std::endl;
     }
 
     // parse json object to Config
@@ -37,28 +99,120 @@ int main(int argc, char *argv[]) {
         std::cerr << "Error:" << ex.what() << std::endl;
         exit(-1);
     }
+    // the command line overrides the acceleration structure of the config
+    if (!accel_name.empty() && !parseEnum(accel_name, config.accel)) {
+        std::cerr << "Unknown acceleration structure " << accel_name << ". Exit." << std::endl;
+        exit(-1);
+    }
+    // and the crop window
+    if (crop_window) std::copy(crop_window->begin(), crop_window->end(), config.crop_config.window);
+    if (crop_spp > 0) config.crop_config.spp = crop_spp;
+    if (!base_image.empty()) config.crop_config.base_image = base_image;
+    // and the time budget
+    if (time_budget > 0) config.time_budget_seconds = time_budget;
+    // and the threads
+    if (threads > 0) config.thread_config.threads = threads;
+    if (!affinity_name.empty() && !parseEnum(affinity_name, config.thread_config.affinity)) {
+        std::cerr << "Unknown thread affinity " << affinity_name << ". Exit." << std::endl;
+        exit(-1);
+    }
+    std::cout << "Rendering with " << setupThreads(config.thread_config) << std::endl;
     std::cout << "Parsed json to config. Start building scene..." << std::endl;
 
     // initialize all settings from config
     // set image resolution.
-    auto rendered_img = std::make_shared<ImageRGB>(config.image_resolution[0], config.image_resolution[1]);
-    std::cout << "Image resolution: " << config.image_resolution[0] << " x " << config.image_resolution[1] << std::endl;
+    const int width = config.image_resolution[0], height = config.image_resolution[1];
+    auto rendered_img = std::make_shared<ImageRGB>(width, height);
+    std::cout << "Image resolution: " << width << " x " << height << std::endl;
+
+    // The crop window, clamped to the image, in image rows from the bottom
+    const Config::CropConfig &crop = config.crop_config;
+    const bool cropped = crop.window[2] > 0 && crop.window[3] > 0;
+    Vec2i crop_low(0, 0), crop_high(width, height);
+    if (cropped) {
+        crop_low = Vec2i(std::clamp(crop.window[0], 0, width),
+                         std::clamp(height - crop.window[1] - crop.window[3], 0, height));
+        crop_high = Vec2i(std::clamp(crop.window[0] + crop.window[2], 0, width),
+                          std::clamp(height - crop.window[1], 0, height));
+        if (crop.spp > 0) {
+            config.spp = crop.spp;
+        }
+        std::cout << "Crop window: " << crop_high.x() - crop_low.x() << " x " << crop_high.y() - crop_low.y()
+                  << " pixels at (" << crop.window[0] << ", " << crop.window[1] << "), " << config.spp << " spp"
+                  << std::endl;
+    }
+    // the region is composited over the previous render
+    std::optional<ImageRGB> base;
+    if (!crop.base_image.empty()) {
+        base = ImageRGB::readHDRFromFile(crop.base_image);
+        if (base->getResolution() != rendered_img->getResolution()) {
+            std::cerr << "The base image " << crop.base_image << " does not have the image resolution. Exit."
+                      << std::endl;
+            exit(-1);
+        }
+        *rendered_img = *base;
+    }
     // set camera
     auto camera = std::make_shared<Camera>(config.cam_config, rendered_img);
     // construct scene.
     auto scene = std::make_shared<Scene>();
     initSceneFromConfig(config, scene);
     // init integrator
-    Integrator integrator(camera, scene, config.spp, config.max_depth);
+    std::unique_ptr<Integrator> integrator = makeIntegrator(config, camera, scene);
+    if (cropped) {
+        integrator->setCropWindow(crop_low, crop_high);
+    }
+    if (config.time_budget_seconds > 0) {
+        if (config.integrator == IntegratorType::PROGRESSIVE_PHOTON_MAPPING ||
+            config.integrator == IntegratorType::GUIDED) {
+            std::cout << "The time budget is ignored, this integrator has its own pass schedule." << std::endl;
+        } else {
+            // what is left once the scene is built, at least one pass is rendered anyway
+            const double remaining = config.time_budget_seconds -
+                                     std::chrono::duration<double>(std::chrono::steady_clock::now() - program_start).count();
+            std::cout << "Time budget: " << config.time_budget_seconds << "s, " << std::max(remaining, 0.0)
+                      << "s left for rendering" << std::endl;
+            integrator->setTimeBudget(std::max(remaining, 1e-3));
+        }
+    }
+    // the denoiser needs the features of the first hits
+    std::shared_ptr<AOVBuffers> aovs;
+    if (config.denoise_config.enabled && cropped) {
+        std::cout << "Denoising is skipped, the features are only known in the crop window." << std::endl;
+    } else if (config.denoise_config.enabled) {
+        aovs = std::make_shared<AOVBuffers>(config.image_resolution[0], config.image_resolution[1]);
+        integrator->setAOVs(aovs);
+    }
     std::cout << "Start Rendering..." << std::endl;
     auto start = std::chrono::steady_clock::now();
 
     // render scene
-    integrator.render();
+    integrator->render();
     auto end = std::chrono::steady_clock::now();
     auto time = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
     std::cout << "\nRender Finished in " << time << "s." << std::endl;
+    // (without the counters compiled in, only tell when a stats file was asked for)
+    if (stats::enabled() || !stats_path.empty()) {
+        stats::report(std::chrono::duration<double>(end - start).count(), stats_path);
+    }
+    if (aovs) {
+        start = std::chrono::steady_clock::now();
+        aovs->normalize();
+        denoise(*rendered_img, *aovs, config.denoise_config);
+        end = std::chrono::steady_clock::now();
+        std::cout << "Denoised in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                  << "ms." << std::endl;
+    }
     rendered_img->writeImgToFile("../result.png");
+    // the float image, to composite later re-renders over
+    rendered_img->writeHDRToFile("../result.hdr");
     std::cout << "Image saved to disk." << std::endl;
+    if (base) {
+        // what the re-render changed
+        std::cout << "RMSE against the base image in the crop window: "
+                  << rendered_img->rmse(*base, crop_low, crop_high) << std::endl;
+        rendered_img->difference(*base).writeImgToFile("../result_diff.png");
+        std::cout << "Difference image saved to disk." << std::endl;
+    }
     return 0;
 }
\ No newline at end of file
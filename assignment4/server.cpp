@@ -0,0 +1,216 @@
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+#include <omp.h>
+
+#include "config_io.h"
+#include "integrator.h"
+#include "denoiser.h"
+#include "lru_cache.h"
+#include "render_protocol.h"
+#include "threading.h"
+
+// Render server: a long-running process rendering jobs received over a local Unix socket (see
+// render_protocol.h for the messages). The scenes of the last jobs are kept with their BVH, so
+// a job which only differs from a previous one by the camera or the render settings skips
+// loading the meshes and building the acceleration structure.
+//
+// usage: server [--socket path] [--cache-scenes count] [--threads count]
+//               [--affinity none|compact|scatter]
+//
+// The paths in the configs are relative to the working directory of the server. The crop
+// window and the thread settings of the configs are ignored, the whole image is always
+// rendered with the threads of the server.
+
+namespace {
+
+struct CachedScene {
+    // the scene settings the scene was built from, to tell hash collisions apart
+    std::string key;
+    std::shared_ptr<Scene> scene;
+};
+
+// The settings initSceneFromConfig reads, with the defaults filled in
+std::string sceneKey(const Config &config) {
+    nlohmann::json all = config;
+    nlohmann::json scene;
+    for (const char *field : {"light_config", "env_config", "materials", "objects", "accel", "out_of_core_config",
+                              "bvh_builder", "sbvh_config", "treelet_config", "texture_config"}) {
+        scene[field] = all[field];
+    }
+    return scene.dump();
+}
+
+// Scene loading exits on a missing file, which must not take the server down
+bool missingFile(const Config &config, std::string &path) {
+    std::vector<std::string> paths;
+    for (const auto &object : config.objects) paths.push_back(object.obj_file_path);
+    for (const auto &material : config.materials) {
+        if (!material.texture.empty()) paths.push_back(material.texture);
+    }
+    if (!config.env_config.hdr_path.empty()) paths.push_back(config.env_config.hdr_path);
+    for (const std::string &file : paths) {
+        if (!std::ifstream(file).good()) {
+            path = file;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sendError(int fd, const std::string &message) {
+    std::cout << "Job failed: " << message << std::endl;
+    return render_protocol::sendMessage(fd, nlohmann::json{{"status", "error"}, {"message", message}}.dump());
+}
+
+// Render one job and send the answer. Returns false when the connection is lost.
+bool handleJob(const std::string &request, LRUCache<CachedScene> &scenes, int fd) {
+    const double job_start = omp_get_wtime();
+    Config config;
+    try {
+        nlohmann::json job = nlohmann::json::parse(request);
+        nlohmann::json config_json = job.at("config");
+        if (job.contains("camera")) {
+            config_json.at("cam_config").update(job.at("camera"));
+        }
+        nlohmann::from_json(config_json, config);
+    } catch (nlohmann::json::exception &ex) {
+        return sendError(fd, std::string("invalid job: ") + ex.what());
+    }
+    const int width = config.image_resolution[0], height = config.image_resolution[1];
+    if (width <= 0 || height <= 0) {
+        return sendError(fd, "invalid image resolution");
+    }
+
+    // the scene of a previous job, or a new one
+    const std::string key = sceneKey(config);
+    const uint64_t hash = std::hash<std::string>{}(key);
+    CachedScene *cached = scenes.find(hash);
+    const bool hit = cached && cached->key == key;
+    if (!hit) {
+        std::string missing;
+        if (missingFile(config, missing)) {
+            return sendError(fd, "can not open " + missing);
+        }
+        auto scene = std::make_shared<Scene>();
+        initSceneFromConfig(config, scene);
+        if (cached) {
+            *cached = {key, scene};
+        } else {
+            cached = &scenes.insert(hash, [&](CachedScene &entry) { entry = {key, scene}; });
+        }
+    }
+    const double setup_seconds = omp_get_wtime() - job_start;
+    std::cout << (hit ? "Scene found in the cache" : "Scene built") << " in " << setup_seconds << "s." << std::endl;
+
+    auto rendered_img = std::make_shared<ImageRGB>(width, height);
+    auto camera = std::make_shared<Camera>(config.cam_config, rendered_img);
+    std::unique_ptr<Integrator> integrator = makeIntegrator(config, camera, cached->scene);
+    if (config.time_budget_seconds > 0) {
+        integrator->setTimeBudget(std::max(config.time_budget_seconds - setup_seconds, 1e-3));
+    }
+    std::shared_ptr<AOVBuffers> aovs;
+    if (config.denoise_config.enabled) {
+        aovs = std::make_shared<AOVBuffers>(width, height);
+        integrator->setAOVs(aovs);
+    }
+    const double render_start = omp_get_wtime();
+    integrator->render();
+    if (aovs) {
+        aovs->normalize();
+        denoise(*rendered_img, *aovs, config.denoise_config);
+    }
+    const double render_seconds = omp_get_wtime() - render_start;
+    std::cout << "\nRender Finished in " << render_seconds << "s." << std::endl;
+
+    std::vector<float> pixels;
+    pixels.reserve(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const Vec3f &pixel = rendered_img->getPixel(x, y);
+            pixels.insert(pixels.end(), {pixel.x(), pixel.y(), pixel.z()});
+        }
+    }
+    nlohmann::json header = {{"status", "ok"},           {"width", width},
+                             {"height", height},         {"cached", hit},
+                             {"setup_seconds", setup_seconds}, {"render_seconds", render_seconds}};
+    return render_protocol::sendMessage(fd, header.dump()) &&
+           render_protocol::sendMessage(fd, pixels.data(), pixels.size() * sizeof(float));
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    setbuf(stdout, nullptr);
+
+    std::string socket_path = render_protocol::DEFAULT_SOCKET_PATH;
+    int cache_scenes = 4;
+    Config::ThreadConfig thread_config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "--cache-scenes" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d", &cache_scenes) != 1 || cache_scenes <= 0) {
+                std::cerr << "Invalid scene cache size " << argv[i] << ", expected a positive integer. Exit."
+                          << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%d", &thread_config.threads) != 1 || thread_config.threads <= 0) {
+                std::cerr << "Invalid thread count " << argv[i] << ", expected a positive integer. Exit." << std::endl;
+                exit(-1);
+            }
+        } else if (arg == "--affinity" && i + 1 < argc) {
+            if (!parseEnum(std::string(argv[++i]), thread_config.affinity)) {
+                std::cerr << "Unknown thread affinity " << argv[i] << ". Exit." << std::endl;
+                exit(-1);
+            }
+        } else {
+            std::cerr << "Unknown option " << arg << ". Exit." << std::endl;
+            exit(-1);
+        }
+    }
+
+    sockaddr_un address{};
+    if (!render_protocol::socketAddress(socket_path, address)) {
+        std::cerr << "Socket path " << socket_path << " is too long. Exit." << std::endl;
+        exit(-1);
+    }
+    const int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // a socket file left by a previous server
+    unlink(socket_path.c_str());
+    if (server_fd < 0 || bind(server_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(server_fd, 8) < 0) {
+        std::cerr << "Can not listen on " << socket_path << ": " << std::strerror(errno) << ". Exit." << std::endl;
+        exit(-1);
+    }
+    // a client leaving early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "Render server listening on " << socket_path << ", caching up to " << cache_scenes
+              << " scenes, rendering with " << setupThreads(thread_config) << std::endl;
+
+    LRUCache<CachedScene> scenes(cache_scenes);
+    // Connections are served one after the other, every render uses all the threads
+    while (true) {
+        const int fd = accept(server_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        std::string request;
+        while (render_protocol::receiveMessage(fd, request)) {
+            if (!handleJob(request, scenes, fd)) {
+                break;
+            }
+        }
+        close(fd);
+    }
+    close(server_fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
@@ -1,5 +1,11 @@
 #include "accel.h"
 
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 AABB::AABB(const Vec3f &v1, const Vec3f &v2, const Vec3f &v3) {
     low_bnd = v1.cwiseMin(v2.cwiseMin(v3));
     upper_bnd = v1.cwiseMax(v2.cwiseMax(v3));
@@ -29,29 +35,52 @@ bool AABB::isOverlap(const AABB &other) const {
             (this->low_bnd[2] >= other.low_bnd[2] && this->low_bnd[2] <= other.upper_bnd[2]));
 }
 
-bool AABB::intersect(const Ray &ray, float *t_in, float *t_out) {
+bool AABB::intersect(const Ray &ray, float *t_in, float *t_out) const {
     // intersection test for bounding box
     // ray distance for two intersection points are returned by pointers.
-    float dir_frac_x = (ray.direction[0] == 0.0) ? 1.0e32 : 1.0 / ray.direction[0];
-    float dir_frac_y = (ray.direction[1] == 0.0) ? 1.0e32 : 1.0 / ray.direction[1];
-    float dir_frac_z = (ray.direction[2] == 0.0) ? 1.0e32 : 1.0 / ray.direction[2];
-
-    float tx1 = (low_bnd[0] - ray.origin[0]) * dir_frac_x;
-    float tx2 = (upper_bnd[0] - ray.origin[0]) * dir_frac_x;
-    float ty1 = (low_bnd[1] - ray.origin[1]) * dir_frac_y;
-    float ty2 = (upper_bnd[1] - ray.origin[1]) * dir_frac_y;
-    float tz1 = (low_bnd[2] - ray.origin[2]) * dir_frac_z;
-    float tz2 = (upper_bnd[2] - ray.origin[2]) * dir_frac_z;
+    return intersect(SlabRay(ray), ray.t_min, ray.t_max, t_in, t_out);
+}
 
-    *t_in = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
-    *t_out = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+SlabRay::SlabRay(const Ray &ray) : origin(ray.origin) {
+    for (int a = 0; a < 3; a++) {
+        // 1 / 0 is +-inf, the sign of the zero gives the side of the near plane
+        inv_dir[a] = 1.f / ray.direction[a];
+        dir_neg[a] = std::signbit(ray.direction[a]) ? 1 : 0;
+    }
+}
 
-    // When t_out < 0 and the ray is intersecting with AABB, the whole AABB is
-    // behind us
-    *t_in = std::max(*t_in, ray.t_min);
-    *t_out = std::min(*t_out, ray.t_max);
-    if (*t_out < 0) return false;
+#if defined(__x86_64__) || defined(__i386__)
+namespace {
 
-    return *t_out >= *t_in;
+__attribute__((target("avx"))) int intersectBoxes8AVX(const SlabRay &ray, const float low[3][8],
+                                                       const float high[3][8], float t_min, float t_max,
+                                                       float t_in[8]) {
+    __m256 near = _mm256_set1_ps(t_min), far = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        const float *near_plane = ray.dir_neg[a] ? high[a] : low[a];
+        const float *far_plane = ray.dir_neg[a] ? low[a] : high[a];
+        const __m256 origin = _mm256_set1_ps(ray.origin[a]), inv_dir = _mm256_set1_ps(ray.inv_dir[a]);
+        // (max/min return their second operand on NaN, like slabMax and slabMin)
+        near = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_plane), origin), inv_dir), near);
+        far = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_plane), origin), inv_dir), far);
+    }
+    _mm256_storeu_ps(t_in, near);
+    const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ),
+                                     _mm256_cmp_ps(far, _mm256_setzero_ps(), _CMP_GE_OQ));
+    return _mm256_movemask_ps(hit);
 }
 
+}  // namespace
+
+int intersectBoxes8(const SlabRay &ray, const float low[3][8], const float high[3][8], float t_min, float t_max,
+                    float t_in[8]) {
+    static const bool has_avx = __builtin_cpu_supports("avx");
+    return has_avx ? intersectBoxes8AVX(ray, low, high, t_min, t_max, t_in)
+                   : intersectBoxes<8>(ray, low, high, t_min, t_max, t_in);
+}
+#else
+int intersectBoxes8(const SlabRay &ray, const float low[3][8], const float high[3][8], float t_min, float t_max,
+                    float t_in[8]) {
+    return intersectBoxes<8>(ray, low, high, t_min, t_max, t_in);
+}
+#endif
@@ -0,0 +1,325 @@
+#include "bdpt_integrator.h"
+
+#include <iostream>
+#include <utility>
+
+#include "stats.h"
+#include "utils.h"
+
+BDPTIntegrator::BDPTIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth)
+    : Integrator(std::move(cam), std::move(scene), spp, max_depth) {
+    if (this->scene->getEnvLight()) {
+        std::cerr << "Warning: the environment light is ignored by the BDPT integrator." << std::endl;
+    }
+}
+
+Vec3f BDPTIntegrator::radiance(Ray &ray, Sampler &sampler, int /*depth*/, FeatureSample *features) const {
+    // Camera subpath. The pinhole camera vertex is never connected to, its pdfs are unused.
+    std::vector<PathVertex> camera_path;
+    camera_path.reserve(max_depth + 2);
+    PathVertex camera_vertex{PathVertex::CAMERA, ray.origin, ray.direction, Vec3f(0, 0, 0)};
+    camera_vertex.beta = Vec3f(1, 1, 1);
+    camera_vertex.time = ray.time;
+    camera_path.push_back(camera_vertex);
+    randomWalk(ray, Vec3f(1, 1, 1), 1.f, sampler, max_depth + 2, true, camera_path);
+    STATS_ADD(PATH_VERTICES, camera_path.size() - 1);
+    if (features) {
+        recordFeatures(*features, camera_path);
+    }
+
+    // Light subpath, starting with a uniform point on the light and a cosine-weighted direction
+    std::vector<PathVertex> light_path;
+    light_path.reserve(max_depth + 1);
+    const std::shared_ptr<Light> &light = scene->getLight();
+    Interaction emit;
+    emit.normal = light->getNormal();
+    PathVertex light_vertex{PathVertex::LIGHT, light->sample(emit, nullptr, sampler), light->getNormal(),
+                            Vec3f(0, 0, 0)};
+    const float pdf_pos = light->pdf(emit, light_vertex.pos);
+    light_vertex.beta = light->emission(light_vertex.pos, -light_vertex.normal);
+    light_vertex.pdf_fwd = pdf_pos;
+    light_vertex.time = ray.time;
+    light_path.push_back(light_vertex);
+
+    Vec3f dir = IdealDiffusion(Vec3f(1, 1, 1)).sample(emit, sampler);
+    float pdf_dir = std::max(0.f, dir.dot(light_vertex.normal)) / PI;
+    if (pdf_dir > 0) {
+        // Le * cos / (pdf_pos * pdf_dir)
+        Vec3f beta = light_vertex.beta * dir.dot(light_vertex.normal) / (pdf_pos * pdf_dir);
+        Ray light_ray(light_vertex.pos, dir);
+        light_ray.time = ray.time;
+        randomWalk(light_ray, beta, pdf_dir, sampler, max_depth + 1, false, light_path);
+    }
+
+    // Connect all prefixes, the path of s + t vertices has s + t - 2 bounces
+    Vec3f L(0, 0, 0);
+    const int n_camera = static_cast<int>(camera_path.size());
+    const int n_light = static_cast<int>(light_path.size());
+    for (int t = 2; t <= n_camera; t++) {
+        for (int s = 0; s <= n_light; s++) {
+            if (s + t - 2 > max_depth) {
+                continue;
+            }
+            L += connect(light_path, camera_path, s, t, sampler);
+        }
+    }
+    return L;
+}
+
+void BDPTIntegrator::recordFeatures(FeatureSample &features, const std::vector<PathVertex> &camera_path) const {
+    if (camera_path.size() > 1) {
+        features.depth = (camera_path[1].pos - camera_path[0].pos).norm();
+    }
+    // Like Integrator::recordFeatures, through the delta vertices. The environment is ignored.
+    for (int k = 1; k < static_cast<int>(camera_path.size()); k++) {
+        const PathVertex &vertex = camera_path[k];
+        // normals facing the camera
+        features.normal = vertex.normal.dot(vertex.wo) < 0 ? Vec3f(-vertex.normal) : vertex.normal;
+        if (vertex.type == PathVertex::LIGHT) {
+            features.albedo = vertex.beta;
+            return;
+        }
+        if (!vertex.delta || k >= max_depth) {
+            features.albedo = std::visit([](const auto &bsdf) { return bsdf.albedo(); },
+                                         scene->getMaterial(vertex.material_id))
+                                  .cwiseProduct(vertex.texture)
+                                  .cwiseProduct(vertex.beta);
+            return;
+        }
+    }
+    features.normal = Vec3f(0, 0, 0);
+}
+
+void BDPTIntegrator::randomWalk(Ray ray, Vec3f beta, float pdf_dir, Sampler &sampler, int max_vertices,
+                                bool camera_path, std::vector<PathVertex> &path) const {
+    while (static_cast<int>(path.size()) < max_vertices) {
+        Interaction interaction;
+        scene->intersect(ray, interaction);
+        if (interaction.type == Interaction::NONE) {
+            break;
+        }
+
+        PathVertex vertex{PathVertex::SURFACE, interaction.pos, interaction.normal, -ray.direction.normalized()};
+        vertex.beta = beta;
+        vertex.time = ray.time;
+        vertex.pdf_fwd = convertDensity(pdf_dir, path.back(), vertex);
+
+        // Lights do not reflect. Only camera subpaths keep them, as the s = 0 strategy.
+        if (interaction.type == Interaction::LIGHT) {
+            if (camera_path) {
+                vertex.type = PathVertex::LIGHT;
+                vertex.normal = scene->getLight()->getNormal();
+                vertex.pdf_fwd = convertDensity(pdf_dir, path.back(), vertex);
+                path.push_back(vertex);
+            }
+            break;
+        }
+        vertex.material_id = interaction.material_id;
+        vertex.texture = interaction.texture;
+        interaction.wo = vertex.wo;
+
+        // Sample the next direction, remember the density of the reverse direction
+        float pdf_rev_dir = 0;
+        bool alive = std::visit(
+            [&](const auto &bsdf) {
+                Vec3f wi = bsdf.sample(interaction, sampler);
+                if (bsdf.isDelta()) {
+                    vertex.delta = true;
+                    beta = beta.cwiseProduct(bsdf.evaluate(interaction));
+                    pdf_dir = 0;
+                } else {
+                    pdf_dir = bsdf.pdf(interaction);
+                    if (pdf_dir <= 0) {
+                        return false;
+                    }
+                    beta = beta.cwiseProduct(bsdf.evaluate(interaction)) * std::abs(wi.dot(interaction.normal)) /
+                           pdf_dir;
+                    Interaction reverse = interaction;
+                    reverse.wo = wi;
+                    reverse.wi = interaction.wo;
+                    pdf_rev_dir = bsdf.pdf(reverse);
+                }
+                Ray next(interaction.pos, wi);
+                next.continuePath(ray, interaction.dist, vertex.delta ? 0.f : ROUGH_CONE_SPREAD);
+                ray = next;
+                return true;
+            },
+            scene->getMaterial(interaction.material_id));
+
+        path.back().pdf_rev = convertDensity(pdf_rev_dir, vertex, path.back());
+        path.push_back(vertex);
+        if (!alive || beta.isZero()) {
+            break;
+        }
+    }
+}
+
+Vec3f BDPTIntegrator::connect(const std::vector<PathVertex> &light_path, const std::vector<PathVertex> &camera_path,
+                              int s, int t, Sampler &sampler) const {
+    const PathVertex &pt = camera_path[t - 1];
+    PathVertex sampled{PathVertex::LIGHT, Vec3f(0, 0, 0), Vec3f(0, 0, 0), Vec3f(0, 0, 0)};
+    Vec3f L(0, 0, 0);
+
+    if (s == 0) {
+        // the camera subpath hit the light by itself
+        if (pt.type != PathVertex::LIGHT) {
+            return L;
+        }
+        L = pt.beta.cwiseProduct(scene->getLight()->emission(pt.pos, -pt.wo));
+    } else {
+        // lights and delta vertices can not be connected
+        if (pt.type != PathVertex::SURFACE || pt.delta) {
+            return L;
+        }
+
+        if (s == 1) {
+            // sample a new point on the light instead of using the light subpath vertex
+            const std::shared_ptr<Light> &light = scene->getLight();
+            Interaction emit;
+            sampled.pos = light->sample(emit, nullptr, sampler);
+            sampled.normal = light->getNormal();
+            sampled.pdf_fwd = light->pdf(emit, sampled.pos);
+            Vec3f d = sampled.pos - pt.pos;
+            Vec3f le = light->emission(sampled.pos, d.normalized());
+            sampled.beta = le / sampled.pdf_fwd;
+            if (le.isZero() || !visible(pt, sampled)) {
+                return L;
+            }
+            float G = std::abs(pt.normal.dot(d.normalized())) * std::abs(sampled.normal.dot(d.normalized())) /
+                      d.squaredNorm();
+            L = pt.beta.cwiseProduct(evaluate(pt, d.normalized())).cwiseProduct(sampled.beta) * G;
+        } else {
+            const PathVertex &qs = light_path[s - 1];
+            if (qs.type != PathVertex::SURFACE || qs.delta) {
+                return L;
+            }
+            Vec3f d = qs.pos - pt.pos;
+            Vec3f w = d.normalized();
+            float G = std::abs(pt.normal.dot(w)) * std::abs(qs.normal.dot(w)) / d.squaredNorm();
+            L = qs.beta.cwiseProduct(evaluate(qs, -w)).cwiseProduct(evaluate(pt, w)).cwiseProduct(pt.beta) * G;
+            if (L.isZero() || !visible(pt, qs)) {
+                return {0.f, 0.f, 0.f};
+            }
+        }
+    }
+
+    if (L.isZero()) {
+        return L;
+    }
+    return L * misWeight(light_path, camera_path, sampled, s, t);
+}
+
+float BDPTIntegrator::misWeight(const std::vector<PathVertex> &light_path, const std::vector<PathVertex> &camera_path,
+                                const PathVertex &sampled, int s, int t) const {
+    // the only strategy for light seen directly from the camera
+    if (s + t == 2) {
+        return 1.f;
+    }
+
+    // Local copies of both subpaths, where the densities at the connection are updated as if
+    // the vertices had been sampled from the other side.
+    std::vector<PathVertex> light(light_path.begin(), light_path.begin() + s);
+    std::vector<PathVertex> camera(camera_path.begin(), camera_path.begin() + t);
+    if (s == 1) {
+        light[0] = sampled;
+    }
+
+    PathVertex &pt = camera[t - 1];
+    PathVertex &pt_minus = camera[t - 2];
+    if (s > 0) {
+        PathVertex &qs = light[s - 1];
+        pt.pdf_rev = pdfArea(qs, s > 1 ? &light[s - 2] : nullptr, pt);
+        pt_minus.pdf_rev = pdfArea(pt, &qs, pt_minus);
+        qs.pdf_rev = pdfArea(pt, &pt_minus, qs);
+        if (s > 1) {
+            light[s - 2].pdf_rev = pdfArea(qs, &pt, light[s - 2]);
+        }
+        qs.delta = false;
+    } else {
+        // pt is on the light: density of sampling it as the light subpath origin, and of emitting towards pt_minus
+        pt.pdf_rev = scene->getLight()->pdf(Interaction(), pt.pos);
+        pt_minus.pdf_rev = pdfArea(pt, nullptr, pt_minus);
+    }
+    pt.delta = false;
+
+    // Sum the ratios p_i / p_s of all other strategies, walking away from the connection on both sides.
+    // Zero densities come from delta vertices, which are skipped anyway.
+    auto remap0 = [](float f) { return f != 0 ? f : 1.f; };
+    float sum_ri = 0;
+    float ri = 1;
+    for (int i = t - 1; i > 1; i--) {
+        ri *= remap0(camera[i].pdf_rev) / remap0(camera[i].pdf_fwd);
+        if (!camera[i].delta && !camera[i - 1].delta) {
+            sum_ri += ri;
+        }
+    }
+    ri = 1;
+    for (int i = s - 1; i >= 0; i--) {
+        ri *= remap0(light[i].pdf_rev) / remap0(light[i].pdf_fwd);
+        // the area light is not a delta light
+        bool delta_prev = i > 0 && light[i - 1].delta;
+        if (!light[i].delta && !delta_prev) {
+            sum_ri += ri;
+        }
+    }
+    return 1.f / (1.f + sum_ri);
+}
+
+Vec3f BDPTIntegrator::evaluate(const PathVertex &v, const Vec3f &wi) const {
+    if (v.type != PathVertex::SURFACE) {
+        return {0.f, 0.f, 0.f};
+    }
+    Interaction interaction;
+    interaction.normal = v.normal;
+    interaction.wo = v.wo;
+    interaction.wi = wi;
+    interaction.texture = v.texture;
+    return std::visit([&](const auto &bsdf) { return bsdf.evaluate(interaction); }, scene->getMaterial(v.material_id));
+}
+
+float BDPTIntegrator::pdfDir(const PathVertex &v, const Vec3f &wo, const Vec3f &wi) const {
+    switch (v.type) {
+        case PathVertex::LIGHT: {
+            // cosine-weighted emission
+            return std::max(0.f, v.normal.dot(wi)) / PI;
+        }
+        case PathVertex::SURFACE: {
+            Interaction interaction;
+            interaction.normal = v.normal;
+            interaction.wo = wo;
+            interaction.wi = wi;
+            return std::visit(
+                [&](const auto &bsdf) { return bsdf.isDelta() ? 0.f : bsdf.pdf(interaction); },
+                scene->getMaterial(v.material_id));
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+float BDPTIntegrator::pdfArea(const PathVertex &v, const PathVertex *prev, const PathVertex &next) const {
+    Vec3f wi = (next.pos - v.pos).normalized();
+    Vec3f wo = prev ? Vec3f((prev->pos - v.pos).normalized()) : Vec3f(0, 0, 0);
+    return convertDensity(pdfDir(v, wo, wi), v, next);
+}
+
+float BDPTIntegrator::convertDensity(float pdf_dir, const PathVertex &from, const PathVertex &to) {
+    Vec3f d = to.pos - from.pos;
+    float dist_sq = d.squaredNorm();
+    if (dist_sq == 0) {
+        return 0;
+    }
+    if (to.type == PathVertex::CAMERA) {
+        return pdf_dir / dist_sq;
+    }
+    return pdf_dir * std::abs(to.normal.dot(d / std::sqrt(dist_sq))) / dist_sq;
+}
+
+bool BDPTIntegrator::visible(const PathVertex &a, const PathVertex &b) const {
+    Vec3f d = b.pos - a.pos;
+    float dist = d.norm();
+    Ray shadow_ray(a.pos, d / dist, RAY_DEFAULT_MIN, dist * (1.f - 1e-4f));
+    shadow_ray.time = a.time;
+    return !scene->isShadowed(shadow_ray);
+}
@@ -2,15 +2,6 @@
 #include "utils.h"
 
 
-Vec3f IdealDiffusion::evaluate(Interaction &interaction) const {
-    return color / PI;
-}
-
-float IdealDiffusion::pdf(Interaction &interaction) const {
-    // cos-theta / pi
-    return interaction.normal.dot(interaction.wi) / PI;
-}
-
 Vec3f IdealDiffusion::sample(Interaction &interaction, Sampler &sampler) const {
     // Get a uniform distribution sample in [0,1]^2
     Vec2f sample = sampler.get2D();
@@ -29,12 +20,258 @@ Vec3f IdealDiffusion::sample(Interaction &interaction, Sampler &sampler) const {
     return interaction.wi;
 }
 
-// return whether the bsdf is perfect transparent or perfect reflection
-bool IdealDiffusion::isDelta() const {
-    return false;
+// GGX microfacet helpers. All directions are expressed in the local shading frame,
+// where the shading normal is (0, 0, 1).
+namespace {
+
+// Orthonormal basis around the shading normal.
+struct Frame {
+    Vec3f s, t, n;
+
+    explicit Frame(const Vec3f &normal) : n(normal) {
+        // Duff et al. 2017, "Building an Orthonormal Basis, Revisited"
+        float sign = std::copysign(1.f, n.z());
+        float a = -1.f / (sign + n.z());
+        float b = n.x() * n.y() * a;
+        s = Vec3f(1.f + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+        t = Vec3f(b, sign + n.y() * n.y() * a, -n.y());
+    }
+
+    [[nodiscard]] Vec3f toLocal(const Vec3f &v) const { return {v.dot(s), v.dot(t), v.dot(n)}; }
+    [[nodiscard]] Vec3f toWorld(const Vec3f &v) const { return v.x() * s + v.y() * t + v.z() * n; }
+};
+
+// Normal distribution function D(h)
+float ggxD(const Vec3f &h, float alpha) {
+    if (h.z() <= 0) return 0;
+    float a2 = alpha * alpha;
+    float d = h.z() * h.z() * (a2 - 1.f) + 1.f;
+    return a2 / (PI * d * d);
+}
+
+// Smith's Lambda function
+float ggxLambda(const Vec3f &w, float alpha) {
+    float cos2 = w.z() * w.z();
+    if (cos2 <= 0) return 0;
+    float tan2 = std::max(0.f, 1.f - cos2) / cos2;
+    return 0.5f * (std::sqrt(1.f + alpha * alpha * tan2) - 1.f);
+}
+
+float ggxG1(const Vec3f &w, float alpha) {
+    return 1.f / (1.f + ggxLambda(w, alpha));
+}
+
+// Height-correlated masking-shadowing
+float ggxG2(const Vec3f &wo, const Vec3f &wi, float alpha) {
+    return 1.f / (1.f + ggxLambda(wo, alpha) + ggxLambda(wi, alpha));
 }
 
-// return whether the bsdf is perfect transparent or perfect reflection
-bool IdealSpecular::isDelta() const {
+// Density of visible normals D_wo(h), the pdf of sampleGGXVisibleNormal.
+float ggxVisibleNormalPdf(const Vec3f &wo, const Vec3f &h, float alpha) {
+    if (wo.z() <= 0) return 0;
+    return ggxG1(wo, alpha) * std::max(0.f, wo.dot(h)) * ggxD(h, alpha) / wo.z();
+}
+
+// Heitz 2018, "Sampling the GGX Distribution of Visible Normals". Requires wo.z() > 0.
+Vec3f sampleGGXVisibleNormal(const Vec3f &wo, float alpha, const Vec2f &u) {
+    // stretch the view direction to the hemisphere configuration
+    Vec3f vh = Vec3f(alpha * wo.x(), alpha * wo.y(), wo.z()).normalized();
+
+    // orthonormal basis around vh
+    float len_sq = vh.x() * vh.x() + vh.y() * vh.y();
+    Vec3f t1 = len_sq > 0 ? Vec3f(-vh.y(), vh.x(), 0) / std::sqrt(len_sq) : Vec3f(1, 0, 0);
+    Vec3f t2 = vh.cross(t1);
+
+    // sample the projected area of the visible hemisphere
+    float r = std::sqrt(u.x());
+    float phi = 2.f * PI * u.y();
+    float p1 = r * std::cos(phi);
+    float p2 = r * std::sin(phi);
+    float s = 0.5f * (1.f + vh.z());
+    p2 = (1.f - s) * std::sqrt(std::max(0.f, 1.f - p1 * p1)) + s * p2;
+
+    // reproject onto the hemisphere and unstretch
+    Vec3f nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.f, 1.f - p1 * p1 - p2 * p2)) * vh;
+    return Vec3f(alpha * nh.x(), alpha * nh.y(), std::max(1e-6f, nh.z())).normalized();
+}
+
+Vec3f fresnelSchlick(const Vec3f &f0, float cos_theta) {
+    float m = std::pow(1.f - std::clamp(cos_theta, 0.f, 1.f), 5.f);
+    return f0 + (Vec3f::Ones() - f0) * m;
+}
+
+// Unpolarized Fresnel reflectance of a dielectric interface.
+// cos_i is measured on the incident side, eta = eta_transmitted / eta_incident.
+float fresnelDielectric(float cos_i, float eta) {
+    cos_i = std::clamp(cos_i, 0.f, 1.f);
+    float sin2_t = (1.f - cos_i * cos_i) / (eta * eta);
+    if (sin2_t >= 1.f) return 1.f;  // total internal reflection
+    float cos_t = std::sqrt(1.f - sin2_t);
+    float r_s = (cos_i - eta * cos_t) / (cos_i + eta * cos_t);
+    float r_p = (eta * cos_i - cos_t) / (eta * cos_i + cos_t);
+    return 0.5f * (r_s * r_s + r_p * r_p);
+}
+
+Vec3f reflect(const Vec3f &wo, const Vec3f &h) {
+    return -wo + 2.f * wo.dot(h) * h;
+}
+
+// Refract wo through a surface with normal h (on the same side as wo). Returns false on total internal reflection.
+bool refract(const Vec3f &wo, const Vec3f &h, float eta, Vec3f &wt) {
+    float cos_i = wo.dot(h);
+    float sin2_t = std::max(0.f, 1.f - cos_i * cos_i) / (eta * eta);
+    if (sin2_t >= 1.f) return false;
+    float cos_t = std::sqrt(1.f - sin2_t);
+    wt = -wo / eta + (cos_i / eta - cos_t) * h;
     return true;
 }
+
+}  // namespace
+
+MicrofacetConductor::MicrofacetConductor(Vec3f color, float roughness)
+    : color(std::move(color)), alpha(std::max(roughness, 0.f)) {
+}
+
+Vec3f MicrofacetConductor::evaluate(Interaction &interaction) const {
+    // Two-sided: flip the frame if we look at the back of the surface
+    Vec3f n = interaction.normal.dot(interaction.wo) < 0 ? -interaction.normal : interaction.normal;
+    if (isDelta()) {
+        return fresnelSchlick(color.cwiseProduct(interaction.texture), n.dot(interaction.wo));
+    }
+
+    Frame frame(n);
+    Vec3f wo = frame.toLocal(interaction.wo);
+    Vec3f wi = frame.toLocal(interaction.wi);
+    if (wo.z() <= 0 || wi.z() <= 0) {
+        return {0.f, 0.f, 0.f};
+    }
+    Vec3f h = (wo + wi).normalized();
+    return fresnelSchlick(color.cwiseProduct(interaction.texture), wi.dot(h)) * ggxD(h, alpha) * ggxG2(wo, wi, alpha) / (4.f * wo.z() * wi.z());
+}
+
+float MicrofacetConductor::pdf(Interaction &interaction) const {
+    if (isDelta()) {
+        return 1.f;
+    }
+    Vec3f n = interaction.normal.dot(interaction.wo) < 0 ? -interaction.normal : interaction.normal;
+    Frame frame(n);
+    Vec3f wo = frame.toLocal(interaction.wo);
+    Vec3f wi = frame.toLocal(interaction.wi);
+    if (wo.z() <= 0 || wi.z() <= 0) {
+        return 0;
+    }
+    Vec3f h = (wo + wi).normalized();
+    return ggxVisibleNormalPdf(wo, h, alpha) / (4.f * wo.dot(h));
+}
+
+Vec3f MicrofacetConductor::sample(Interaction &interaction, Sampler &sampler) const {
+    Vec3f n = interaction.normal.dot(interaction.wo) < 0 ? -interaction.normal : interaction.normal;
+    if (isDelta()) {
+        interaction.wi = reflect(interaction.wo, n);
+        return interaction.wi;
+    }
+
+    Frame frame(n);
+    Vec3f wo = frame.toLocal(interaction.wo);
+    Vec3f h = sampleGGXVisibleNormal(wo, alpha, sampler.get2D());
+    interaction.wi = frame.toWorld(reflect(wo, h)).normalized();
+    return interaction.wi;
+}
+
+MicrofacetDielectric::MicrofacetDielectric(Vec3f color, float roughness, float ior)
+    : color(std::move(color)), alpha(std::max(roughness, 0.f)), ior(ior) {
+}
+
+Vec3f MicrofacetDielectric::evaluate(Interaction &interaction) const {
+    // Work in the frame where wo is in the upper hemisphere; eta is relative to the side of wo.
+    bool entering = interaction.normal.dot(interaction.wo) >= 0;
+    Frame frame(entering ? interaction.normal : Vec3f(-interaction.normal));
+    float eta = entering ? ior : 1.f / ior;
+    Vec3f wo = frame.toLocal(interaction.wo);
+    Vec3f wi = frame.toLocal(interaction.wi);
+    bool reflection = wi.z() > 0;
+
+    if (isDelta()) {
+        // Reflection is chosen with probability F, so both weights reduce to the tint. The
+        // transmitted radiance is scaled by 1/eta^2, like in the rough case below.
+        return reflection ? Vec3f(1.f, 1.f, 1.f) : Vec3f(color.cwiseProduct(interaction.texture) / (eta * eta));
+    }
+    if (wo.z() == 0 || wi.z() == 0) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    // generalized half vector, oriented towards the upper hemisphere
+    Vec3f h = reflection ? Vec3f(wo + wi) : Vec3f(wo + eta * wi);
+    if (h.squaredNorm() == 0) {
+        return {0.f, 0.f, 0.f};
+    }
+    h.normalize();
+    if (h.z() < 0) h = -h;
+    // discard back-facing microfacets
+    if (wo.dot(h) <= 0 || (reflection ? wi.dot(h) <= 0 : wi.dot(h) >= 0)) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    float F = fresnelDielectric(wo.dot(h), eta);
+    float DG = ggxD(h, alpha) * ggxG2(wo, wi, alpha);
+    if (reflection) {
+        float f = F * DG / (4.f * wo.z() * wi.z());
+        return {f, f, f};
+    }
+    // Radiance is scaled by 1/eta^2 across the boundary, which cancels the eta^2 of the Jacobian.
+    float denom = wo.dot(h) + eta * wi.dot(h);
+    float f = (1.f - F) * DG * std::abs(wi.dot(h) * wo.dot(h) / (wi.z() * wo.z() * denom * denom));
+    return color.cwiseProduct(interaction.texture) * f;
+}
+
+float MicrofacetDielectric::pdf(Interaction &interaction) const {
+    if (isDelta()) {
+        return 1.f;
+    }
+    bool entering = interaction.normal.dot(interaction.wo) >= 0;
+    Frame frame(entering ? interaction.normal : Vec3f(-interaction.normal));
+    float eta = entering ? ior : 1.f / ior;
+    Vec3f wo = frame.toLocal(interaction.wo);
+    Vec3f wi = frame.toLocal(interaction.wi);
+    bool reflection = wi.z() > 0;
+    if (wo.z() == 0 || wi.z() == 0) {
+        return 0;
+    }
+
+    Vec3f h = reflection ? Vec3f(wo + wi) : Vec3f(wo + eta * wi);
+    if (h.squaredNorm() == 0) {
+        return 0;
+    }
+    h.normalize();
+    if (h.z() < 0) h = -h;
+    if (wo.dot(h) <= 0 || (reflection ? wi.dot(h) <= 0 : wi.dot(h) >= 0)) {
+        return 0;
+    }
+
+    float F = fresnelDielectric(wo.dot(h), eta);
+    float pdf_h = ggxVisibleNormalPdf(wo, h, alpha);
+    if (reflection) {
+        return F * pdf_h / (4.f * wo.dot(h));
+    }
+    float denom = wo.dot(h) + eta * wi.dot(h);
+    return (1.f - F) * pdf_h * eta * eta * std::abs(wi.dot(h)) / (denom * denom);
+}
+
+Vec3f MicrofacetDielectric::sample(Interaction &interaction, Sampler &sampler) const {
+    bool entering = interaction.normal.dot(interaction.wo) >= 0;
+    Frame frame(entering ? interaction.normal : Vec3f(-interaction.normal));
+    float eta = entering ? ior : 1.f / ior;
+    Vec3f wo = frame.toLocal(interaction.wo);
+
+    // smooth glass samples the geometric normal itself
+    Vec3f h = isDelta() ? Vec3f(0, 0, 1) : sampleGGXVisibleNormal(wo, alpha, sampler.get2D());
+
+    // choose reflection or refraction proportionally to the Fresnel term
+    float F = fresnelDielectric(wo.dot(h), eta);
+    Vec3f wi;
+    if (sampler.get1D() < F || !refract(wo, h, eta, wi)) {
+        wi = reflect(wo, h);
+    }
+    interaction.wi = frame.toWorld(wi).normalized();
+    return interaction.wi;
+}
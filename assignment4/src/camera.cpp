@@ -1,21 +1,62 @@
 #include "camera.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <iostream>
+
 Camera::Camera() : position(0, 0, 4), fov(45), focal_len(1) {
     lookAt({0, 0, 0}, {0, 1, 0});
 }
 
 Camera::Camera(const Config::CamConfig &config, std::shared_ptr<ImageRGB> &img)
-    : position(config.position), fov(config.vertical_fov), focal_len(config.focal_length) {
+    : position(config.position),
+      fov(config.vertical_fov),
+      focal_len(config.focal_length),
+      lens_radius(config.aperture),
+      // the geometry only moves between its keyframes at times 0 and 1, the BVH bounds do not
+      // hold outside of them
+      shutter_open(std::clamp(config.shutter_open, 0.f, 1.f)),
+      shutter_close(std::clamp(config.shutter_close, 0.f, 1.f)) {
+    if (shutter_open != config.shutter_open || shutter_close != config.shutter_close) {
+        std::cerr << "Warning: the shutter interval is clamped to the keyframe times [0, 1]." << std::endl;
+    }
     image = img;
     lookAt(Vec3f(config.look_at), Vec3f(config.ref_up));
+    focus_distance = config.focus_distance > 0 ? config.focus_distance : (Vec3f(config.look_at) - position).norm();
 }
 
-Ray Camera::generateRay(float dx, float dy) {
+Ray Camera::generateRay(float dx, float dy, Sampler &sampler) const {
     auto resolution = image->getResolution();
     dx = dx / static_cast<float>(resolution.x()) * 2 - 1;
     dy = dy / static_cast<float>(resolution.y()) * 2 - 1;
-    return Ray{position, dx * right + dy * up + forward};
+    // (the forward component of dir is 1)
+    Vec3f dir = dx * right + dy * up + forward;
+    Ray ray{position, dir.normalized()};
+    if (lens_radius > 0) {
+        // Thin lens: all the rays through the pixel converge on the plane in focus.
+        // The lens sample is mapped to the disk with the concentric mapping.
+        Vec2f u = 2 * sampler.get2D() - Vec2f(1, 1);
+        float r = u.x(), phi = PI / 4 * (u.y() / u.x());
+        if (std::abs(u.y()) > std::abs(u.x())) {
+            r = u.y();
+            phi = PI / 2 - PI / 4 * (u.x() / u.y());
+        }
+        if (u.x() == 0 && u.y() == 0) r = 0;
+        Vec3f origin =
+            position + lens_radius * r * (std::cos(phi) * right.normalized() + std::sin(phi) * up.normalized());
+        ray = Ray{origin, (position + focus_distance * dir - origin).normalized()};
+    }
+    ray.time = sampleTime(sampler);
+    // the cone of a camera ray covers one pixel
+    ray.cone_spread = 2 * up.norm() / static_cast<float>(resolution.y());
+    return ray;
+}
+
+float Camera::sampleTime(Sampler &sampler) const {
+    if (shutter_close <= shutter_open) {
+        return shutter_open;
+    }
+    return shutter_open + (shutter_close - shutter_open) * sampler.get1D();
 }
 
 void Camera::lookAt(const Vec3f &look_at, const Vec3f &ref_up) {
@@ -0,0 +1,120 @@
+#include "denoiser.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// demodulation is skipped for albedo channels below this value
+constexpr float MIN_ALBEDO = 1e-3f;
+
+// One float array per channel (structure of arrays), so that the filter loops over contiguous
+// memory and can be vectorized.
+using Planes = std::array<std::vector<float>, 3>;
+
+Planes makePlanes(int n) {
+    return {std::vector<float>(n), std::vector<float>(n), std::vector<float>(n)};
+}
+
+}  // namespace
+
+void denoise(ImageRGB &image, const AOVBuffers &aovs, const Config::DenoiseConfig &config) {
+    const int width = aovs.width;
+    const int height = aovs.height;
+    const int n = width * height;
+
+    Planes color = makePlanes(n), filtered = makePlanes(n), albedo = makePlanes(n), normal = makePlanes(n);
+    std::vector<float> depth(n);
+    for (int i = 0; i < n; i++) {
+        const Vec3f &pixel = image.getPixel(i % width, i / width);
+        for (int k = 0; k < 3; k++) {
+            float a = aovs.albedo[i][k];
+            albedo[k][i] = a;
+            normal[k][i] = aovs.normal[i][k];
+            color[k][i] = a > MIN_ALBEDO ? pixel[k] / a : pixel[k];
+        }
+        depth[i] = std::max(aovs.depth[i], 1e-4f);
+    }
+
+    const float kernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+    const float inv_normal = 1 / (config.sigma_normal * config.sigma_normal);
+    const float inv_depth = 1 / (config.sigma_depth * config.sigma_depth);
+    const float inv_albedo = 1 / (config.sigma_albedo * config.sigma_albedo);
+
+    for (int pass = 0; pass < config.iterations; pass++) {
+        const int step = 1 << pass;
+        // the color edge-stopping function gets narrower as the noise is removed
+        const float sigma_color = config.sigma_color / static_cast<float>(step);
+        const float inv_color = 1 / (sigma_color * sigma_color);
+
+        #pragma omp parallel default(none) \
+            shared(width, height, step, inv_color, inv_normal, inv_depth, inv_albedo, kernel, color, filtered, albedo, normal, depth)
+        {
+            // weighted sums of the current row: r, g, b and the weights
+            std::vector<float> sums(4 * width);
+            float *sum_r = sums.data(), *sum_g = sum_r + width, *sum_b = sum_g + width, *sum_w = sum_b + width;
+
+            #pragma omp for schedule(static)
+            for (int y = 0; y < height; y++) {
+                std::fill(sums.begin(), sums.end(), 0.f);
+                const int row = y * width;
+
+                // Loop over the taps outside and over the pixels of the row inside, so that the
+                // inner loop reads contiguous memory for every plane
+                for (int j = -2; j <= 2; j++) {
+                    const int qy = y + j * step;
+                    if (qy < 0 || qy >= height) continue;
+                    for (int i = -2; i <= 2; i++) {
+                        const int offset = i * step;
+                        // taps falling outside of the image are skipped
+                        const int x_begin = std::max(0, -offset);
+                        const int x_end = std::min(width, width - offset);
+                        const int q_row = qy * width + offset;
+                        const float h = kernel[i + 2] * kernel[j + 2];
+
+                        #pragma omp simd
+                        for (int x = x_begin; x < x_end; x++) {
+                            const int p = row + x, q = q_row + x;
+                            float dc = 0, dn = 0, da = 0;
+                            for (int k = 0; k < 3; k++) {
+                                float c = color[k][p] - color[k][q];
+                                float nn = normal[k][p] - normal[k][q];
+                                float a = albedo[k][p] - albedo[k][q];
+                                dc += c * c;
+                                dn += nn * nn;
+                                da += a * a;
+                            }
+                            float dz = (depth[p] - depth[q]) / depth[p];
+                            float w = h * std::exp(-(dc * inv_color + dn * inv_normal + dz * dz * inv_depth +
+                                                     da * inv_albedo));
+                            sum_r[x] += w * color[0][q];
+                            sum_g[x] += w * color[1][q];
+                            sum_b[x] += w * color[2][q];
+                            sum_w[x] += w;
+                        }
+                    }
+                }
+
+                // the center tap always has a positive weight
+                #pragma omp simd
+                for (int x = 0; x < width; x++) {
+                    filtered[0][row + x] = sum_r[x] / sum_w[x];
+                    filtered[1][row + x] = sum_g[x] / sum_w[x];
+                    filtered[2][row + x] = sum_b[x] / sum_w[x];
+                }
+            }
+        }
+        std::swap(color, filtered);
+    }
+
+    // Modulate the filtered illumination with the albedo again
+    for (int i = 0; i < n; i++) {
+        Vec3f pixel;
+        for (int k = 0; k < 3; k++) {
+            pixel[k] = albedo[k][i] > MIN_ALBEDO ? color[k][i] * albedo[k][i] : color[k][i];
+        }
+        image.setPixel(i % width, i / width, pixel);
+    }
+}
@@ -0,0 +1,89 @@
+#include "distribution.h"
+
+#include <algorithm>
+
+AliasTable::AliasTable(const std::vector<float> &func) : bins(func.size()) {
+    const int n = static_cast<int>(func.size());
+    for (float f : func) {
+        func_sum += f;
+    }
+
+    // All-zero functions fall back to a uniform distribution
+    for (int i = 0; i < n; i++) {
+        bins[i].pmf = func_sum > 0 ? func[i] / func_sum : 1.f / static_cast<float>(n);
+    }
+
+    // Vose's algorithm: pair every under-full bin with an over-full one
+    std::vector<int> small, large;
+    std::vector<float> scaled(n);
+    for (int i = 0; i < n; i++) {
+        scaled[i] = bins[i].pmf * static_cast<float>(n);
+        (scaled[i] < 1.f ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(), l = large.back();
+        small.pop_back();
+        bins[s].q = scaled[s];
+        bins[s].alias = l;
+        scaled[l] -= 1.f - scaled[s];
+        if (scaled[l] < 1.f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Leftovers are full up to rounding errors
+    for (int i : small) {
+        bins[i].q = 1.f;
+        bins[i].alias = i;
+    }
+    for (int i : large) {
+        bins[i].q = 1.f;
+        bins[i].alias = i;
+    }
+}
+
+int AliasTable::sample(float u, float *pmf, float *remapped) const {
+    const int n = size();
+    float x = u * static_cast<float>(n);
+    int i = std::min(static_cast<int>(x), n - 1);
+    float frac = std::min(x - static_cast<float>(i), 1.f - 1e-7f);
+
+    const Bin &bin = bins[i];
+    int chosen;
+    if (frac < bin.q) {
+        chosen = i;
+        if (remapped) *remapped = std::min(frac / bin.q, 1.f - 1e-7f);
+    } else {
+        chosen = bin.alias;
+        if (remapped) *remapped = std::min((frac - bin.q) / (1.f - bin.q), 1.f - 1e-7f);
+    }
+    if (pmf) *pmf = bins[chosen].pmf;
+    return chosen;
+}
+
+Distribution2D::Distribution2D(const std::vector<float> &func, int nu, int nv) : nu(nu), nv(nv) {
+    conditional.reserve(nv);
+    std::vector<float> row_sums(nv);
+    for (int v = 0; v < nv; v++) {
+        conditional.emplace_back(std::vector<float>(func.begin() + v * nu, func.begin() + (v + 1) * nu));
+        row_sums[v] = conditional.back().funcSum();
+    }
+    marginal = AliasTable(row_sums);
+}
+
+Vec2f Distribution2D::sample(const Vec2f &u, float *pdf) const {
+    float pmf_v, pmf_u, remapped_v, remapped_u;
+    int v = marginal.sample(u.y(), &pmf_v, &remapped_v);
+    int col = conditional[v].sample(u.x(), &pmf_u, &remapped_u);
+
+    // discrete probabilities to densities on [0,1]^2
+    *pdf = pmf_v * pmf_u * static_cast<float>(nu * nv);
+    return {(static_cast<float>(col) + remapped_u) / static_cast<float>(nu),
+            (static_cast<float>(v) + remapped_v) / static_cast<float>(nv)};
+}
+
+float Distribution2D::pdf(const Vec2f &uv) const {
+    int col = std::clamp(static_cast<int>(uv.x() * static_cast<float>(nu)), 0, nu - 1);
+    int v = std::clamp(static_cast<int>(uv.y() * static_cast<float>(nv)), 0, nv - 1);
+    return marginal.pmf(v) * conditional[v].pmf(col) * static_cast<float>(nu * nv);
+}
@@ -0,0 +1,55 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+
+Framebuffer::Framebuffer(int width, int height)
+    : width(width),
+      height(height),
+      stride((width + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT) {
+    const size_t size = static_cast<size_t>(stride) * height;
+    red.assign(size, 0.f);
+    green.assign(size, 0.f);
+    blue.assign(size, 0.f);
+    weight.assign(size, 0.f);
+}
+
+void Framebuffer::clear() {
+    for (Plane *plane : {&red, &green, &blue, &weight}) {
+        std::fill(plane->begin(), plane->end(), 0.f);
+    }
+}
+
+void Framebuffer::addRow(int x, int y, int count, const Vec3f *radiance, float weight_per_pixel) {
+    const size_t row = static_cast<size_t>(y) * stride + x;
+    float *r = red.data() + row, *g = green.data() + row, *b = blue.data() + row, *w = weight.data() + row;
+    // (the Vec3f are 3 consecutive floats, the loop deinterleaves them)
+    const float *sums = radiance->data();
+    for (int i = 0; i < count; i++) {
+        r[i] += sums[3 * i];
+        g[i] += sums[3 * i + 1];
+        b[i] += sums[3 * i + 2];
+        w[i] += weight_per_pixel;
+    }
+}
+
+void Framebuffer::resolve(ImageRGB &image, const Vec2i &low, const Vec2i &high) const {
+    const int count = high.x() - low.x();
+    if (count <= 0) {
+        return;
+    }
+    std::vector<Vec3f> averages(count);
+    for (int y = low.y(); y < high.y(); y++) {
+        const size_t row = static_cast<size_t>(y) * stride + low.x();
+        const float *r = red.data() + row, *g = green.data() + row, *b = blue.data() + row,
+                    *w = weight.data() + row;
+        float *out = averages.front().data();
+        for (int i = 0; i < count; i++) {
+            // (a division, so that the averages are exactly those of the Vec3f accumulation)
+            const float n = w[i] > 0 ? w[i] : 1.f;
+            out[3 * i] = r[i] / n;
+            out[3 * i + 1] = g[i] / n;
+            out[3 * i + 2] = b[i] / n;
+        }
+        image.setRow(low.x(), y, count, averages.data());
+    }
+}
@@ -1,14 +1,28 @@
 #include "geometry.h"
+#include "stats.h"
 
 #include <iostream>
 #include <utility>
 
 TriangleMesh::TriangleMesh(std::vector<Vec3f> vertices, std::vector<Vec3f> normals, std::vector<int> v_index,
-                           std::vector<int> n_index)
+                           std::vector<int> n_index, std::vector<Vec2f> uvs, std::vector<int> t_index)
     : vertices(std::move(vertices)),
       normals(std::move(normals)),
       v_indices(std::move(v_index)),
-      n_indices(std::move(n_index)) {
+      n_indices(std::move(n_index)),
+      uvs(std::move(uvs)),
+      t_indices(std::move(t_index)) {
+}
+
+// Interpolate the texture coordinates at barycentrics (u, v) and compute the uv density, which
+// converts a footprint on the surface into a footprint in texture space
+static void setTextureCoordinates(Interaction &interaction, float u, float v, const Vec3f &v0v1, const Vec3f &v0v2,
+                                  const Vec2f &uv0, const Vec2f &uv1, const Vec2f &uv2) {
+    interaction.uv = (1 - u - v) * uv0 + u * uv1 + v * uv2;
+    const Vec2f d1 = uv1 - uv0, d2 = uv2 - uv0;
+    const float uv_area = std::abs(d1.x() * d2.y() - d1.y() * d2.x());
+    const float area = v0v1.cross(v0v2).norm();
+    interaction.uv_density = area > 0 ? std::sqrt(uv_area / area) : 0.f;
 }
 
 bool TriangleMesh::intersect(Ray &ray, Interaction &interaction) const {
@@ -17,27 +31,37 @@ bool TriangleMesh::intersect(Ray &ray, Interaction &interaction) const {
     // So we do not need to consider BVH intersection within this class. BVH codes are commented.
 
     // Loop through all triangles in the mesh and test intersection for each triangle.
+    HitRecord hit;
+    hit.t = interaction.dist;
     for (int i = 0; i < v_indices.size() / 3; i++) {
-        Vec3i v_idx(v_indices[3 * i], v_indices[3 * i + 1], v_indices[3 * i + 2]);
-        Vec3i n_idx(n_indices[3 * i], n_indices[3 * i + 1], n_indices[3 * i + 2]);
-        Interaction temp;
-        if (intersectOneTriangle(ray, temp, v_idx, n_idx) && (temp.dist < interaction.dist)) {
-            interaction = temp;
-        }
+        intersectOneTriangle(ray, hit, i);
+    }
+    if (hit.prim < 0) {
+        return false;
     }
+    fillInteraction(ray, hit, interaction);
+    return true;
+}
 
-    return interaction.type != Interaction::Type::NONE;
+void TriangleMesh::setMaterial(int new_material_id) {
+    material_id = new_material_id;
 }
 
-void TriangleMesh::setMaterial(std::shared_ptr<BSDF> &new_bsdf) {
-    bsdf = new_bsdf;
+void TriangleMesh::triangleUVs(int triangle, Vec2f &uv0, Vec2f &uv1, Vec2f &uv2) const {
+    Vec2f *uv[3] = {&uv0, &uv1, &uv2};
+    const Vec2f defaults[3] = {{0, 0}, {1, 0}, {0, 1}};
+    for (int k = 0; k < 3; k++) {
+        const int t_idx = t_indices.empty() ? -1 : t_indices[3 * triangle + k];
+        *uv[k] = t_idx >= 0 ? uvs[t_idx] : defaults[k];
+    }
 }
 
-bool TriangleMesh::intersectOneTriangle(Ray &ray, Interaction &interaction, const Vec3i &v_idx,
-                                        const Vec3i &n_idx) const {
-    Vec3f v0 = vertices[v_idx[0]];
-    Vec3f v1 = vertices[v_idx[1]];
-    Vec3f v2 = vertices[v_idx[2]];
+bool TriangleMesh::intersectOneTriangle(const Ray &ray, HitRecord &hit, int triangle) const {
+    STATS_INC(TRIANGLE_TESTS);
+    Vec3i v_idx(v_indices[3 * triangle], v_indices[3 * triangle + 1], v_indices[3 * triangle + 2]);
+    Vec3f v0 = vertices[v_idx[0]] + ray.time * motion;
+    Vec3f v1 = vertices[v_idx[1]] + ray.time * motion;
+    Vec3f v2 = vertices[v_idx[2]] + ray.time * motion;
     Vec3f v0v1 = v1 - v0;
     Vec3f v0v2 = v2 - v0;
     Vec3f pvec = ray.direction.cross(v0v2);
@@ -52,16 +76,29 @@ bool TriangleMesh::intersectOneTriangle(Ray &ray, Interaction &interaction, cons
     float v = ray.direction.dot(qvec) * invDet;
     if (v < 0 || u + v > 1) return false;
     float t = v0v2.dot(qvec) * invDet;
-    if (t < ray.t_min || t > ray.t_max) return false;
+    // (written so that the NaN distance of a degenerate triangle is rejected)
+    if (t < ray.t_min || t > ray.t_max || !(t < hit.t)) return false;
 
-    interaction.dist = t;
-    interaction.pos = ray(t);
-    interaction.normal = (u * normals[n_idx[1]] + v * normals[n_idx[2]] + (1 - u - v) * normals[n_idx[0]]).normalized();
-    interaction.material = bsdf;
-    interaction.type = Interaction::Type::GEOMETRY;
+    hit = {t, triangle, u, v};
     return true;
 }
 
+void TriangleMesh::fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const {
+    const int triangle = hit.prim;
+    Vec3i v_idx(v_indices[3 * triangle], v_indices[3 * triangle + 1], v_indices[3 * triangle + 2]);
+    Vec3i n_idx(n_indices[3 * triangle], n_indices[3 * triangle + 1], n_indices[3 * triangle + 2]);
+    const float u = hit.u, v = hit.v;
+    interaction.dist = hit.t;
+    interaction.pos = ray(hit.t);
+    interaction.normal = (u * normals[n_idx[1]] + v * normals[n_idx[2]] + (1 - u - v) * normals[n_idx[0]]).normalized();
+    Vec2f uv0, uv1, uv2;
+    triangleUVs(triangle, uv0, uv1, uv2);
+    setTextureCoordinates(interaction, u, v, vertices[v_idx[1]] - vertices[v_idx[0]],
+                          vertices[v_idx[2]] - vertices[v_idx[0]], uv0, uv1, uv2);
+    interaction.material_id = material_id;
+    interaction.type = light_id >= 0 ? Interaction::Type::LIGHT : Interaction::Type::GEOMETRY;
+}
+
 // Excerpt From: https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
 // Expands a 10-bit integer into 30 bits by inserting 2 zeros after each bit.
 inline static unsigned int expandBits(unsigned int v) {
@@ -105,26 +142,40 @@ AABB TriangleMesh::getAABB() const {
         const Vec3f v2 = vertices[v_indices[3 * i + 2]];
         aabb.merge(v0, v1, v2);
     }
+    // the mesh translates linearly, its bounds at the last keyframe cover the motion
+    if (!motion.isZero()) {
+        aabb.merge(AABB(aabb.low_bnd + motion, aabb.upper_bnd + motion));
+    }
     return aabb;
 }
 
-void TriangleMesh::addToGlobalTriangles(std::vector<Triangle> &global_triangles, AABB &box) {
-    for (int i = 0; i < v_indices.size() / 3; i++) {
+void TriangleMesh::addToGlobalTriangles(std::vector<Triangle> &global_triangles, const AABB &box, int first,
+                                        int end) const {
+    if (end < 0) {
+        end = numTriangles();
+    }
+    for (int i = first; i < end; i++) {
         const Vec3f v0 = vertices[v_indices[3 * i]];
         const Vec3f v1 = vertices[v_indices[3 * i + 1]];
         const Vec3f v2 = vertices[v_indices[3 * i + 2]];
         
-        const Vec3f n0 = normals[v_indices[3 * i]];
-        const Vec3f n1 = normals[v_indices[3 * i + 1]];
-        const Vec3f n2 = normals[v_indices[3 * i + 2]];
-
-        global_triangles.emplace_back(
-            v0, v1, v2, n0, n1, n2, bsdf, AABB(v0, v1, v2), calcMortonCode((v0 + v1 + v2) / 3, box)
+        const Vec3f n0 = normals[n_indices[3 * i]];
+        const Vec3f n1 = normals[n_indices[3 * i + 1]];
+        const Vec3f n2 = normals[n_indices[3 * i + 2]];
+
+        // moving triangles are bounded over both keyframes and sorted by their mid-shutter position
+        AABB aabb(v0, v1, v2);
+        aabb.merge(v0 + motion, v1 + motion, v2 + motion);
+        Triangle &triangle = global_triangles.emplace_back(
+            v0, v1, v2, n0, n1, n2, material_id, aabb, calcMortonCode((v0 + v1 + v2) / 3 + motion / 2, box)
         );
+        triangleUVs(i, triangle.uv0, triangle.uv1, triangle.uv2);
+        triangle.motion = motion;
+        triangle.light_id = light_id;
     }
 }
 
-bool Triangle::intersect(Ray &ray, Interaction &interaction) const {
+bool Triangle::intersect(const Ray &ray, HitRecord &hit, int index) const {
     Vec3f v0v1 = v1 - v0;
     Vec3f v0v2 = v2 - v0;
     Vec3f pvec = ray.direction.cross(v0v2);
@@ -132,19 +183,26 @@ bool Triangle::intersect(Ray &ray, Interaction &interaction) const {
     float det = v0v1.dot(pvec);
     float invDet = 1.0f / det;
 
-    Vec3f tvec = ray.origin - v0;
+    // a translation does not change the edges, only the first vertex moves
+    Vec3f tvec = ray.origin - v0 - ray.time * motion;
     float u = tvec.dot(pvec) * invDet;
     if (u < 0 || u > 1) return false;
     Vec3f qvec = tvec.cross(v0v1);
     float v = ray.direction.dot(qvec) * invDet;
     if (v < 0 || u + v > 1) return false;
     float t = v0v2.dot(qvec) * invDet;
-    if (t < ray.t_min || t > ray.t_max) return false;
+    // (written so that the NaN distance of a degenerate triangle is rejected)
+    if (t < ray.t_min || t > ray.t_max || !(t < hit.t)) return false;
 
-    interaction.dist = t;
-    interaction.pos = ray(t);
-    interaction.normal = (u * n1 + v * n2 + (1 - u - v) * n0).normalized();
-    interaction.type = Interaction::Type::GEOMETRY;
-    interaction.material = bsdf;
+    hit = {t, index, u, v};
     return true;
 }
+
+void Triangle::fillInteraction(const Ray &ray, const HitRecord &hit, Interaction &interaction) const {
+    interaction.dist = hit.t;
+    interaction.pos = ray(hit.t);
+    interaction.normal = (hit.u * n1 + hit.v * n2 + (1 - hit.u - hit.v) * n0).normalized();
+    setTextureCoordinates(interaction, hit.u, hit.v, v1 - v0, v2 - v0, uv0, uv1, uv2);
+    interaction.type = light_id >= 0 ? Interaction::Type::LIGHT : Interaction::Type::GEOMETRY;
+    interaction.material_id = material_id;
+}
@@ -0,0 +1,212 @@
+#include "geometry_stream.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+
+// triangles written to the files at once
+constexpr size_t WRITE_BLOCK_RECORDS = 1 << 16;
+
+// Append the records of the block to the file and clear the block
+static void writeRecords(int fd, const std::string &path, std::vector<TriangleRecord> &block) {
+    const char *data = reinterpret_cast<const char *>(block.data());
+    size_t size = block.size() * sizeof(TriangleRecord);
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) {
+            std::cerr << "Can not write the geometry file " << path << ". Exit." << std::endl;
+            exit(-1);
+        }
+        data += written;
+        size -= written;
+    }
+    block.clear();
+}
+
+// Open a scratch file, it is removed from the disk once closed
+static int openScratchFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        std::cerr << "Can not create the geometry file " << path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    unlink(path.c_str());
+    return fd;
+}
+
+static const TriangleRecord *mapRecords(int fd, const std::string &path, size_t bytes) {
+    void *mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Can not map the geometry file " << path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    return static_cast<const TriangleRecord *>(mapping);
+}
+
+TriangleRecord TriangleRecord::fromTriangle(const Triangle &triangle) {
+    TriangleRecord record{};
+    const Vec3f *v[3] = {&triangle.v0, &triangle.v1, &triangle.v2};
+    const Vec3f *n[3] = {&triangle.n0, &triangle.n1, &triangle.n2};
+    const Vec2f *uv[3] = {&triangle.uv0, &triangle.uv1, &triangle.uv2};
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < 3; k++) {
+            record.v[i][k] = (*v[i])[k];
+            record.n[i][k] = (*n[i])[k];
+        }
+        record.uv[i][0] = uv[i]->x();
+        record.uv[i][1] = uv[i]->y();
+        record.motion[i] = triangle.motion[i];
+    }
+    record.material_id = triangle.material_id;
+    record.light_id = triangle.light_id;
+    return record;
+}
+
+TriangleStager::TriangleStager(const std::string &staging_path) : path(staging_path) {
+    fd = openScratchFile(path);
+    block.reserve(WRITE_BLOCK_RECORDS);
+}
+
+TriangleStager::~TriangleStager() {
+    if (records) munmap(const_cast<TriangleRecord *>(records), mapped_bytes);
+    if (fd >= 0) close(fd);
+}
+
+void TriangleStager::add(const TriangleMesh &mesh) {
+    assert(!records);
+    // The mesh is expanded a block at a time, the Morton codes are set once the scene box is known
+    const AABB unit_box(Vec3f(0, 0, 0), Vec3f(1, 1, 1));
+    std::vector<Triangle> triangles;
+    for (int first = 0; first < mesh.numTriangles(); first += WRITE_BLOCK_RECORDS) {
+        triangles.clear();
+        mesh.addToGlobalTriangles(triangles, unit_box, first,
+                                  std::min<int>(first + WRITE_BLOCK_RECORDS, mesh.numTriangles()));
+        for (const Triangle &triangle : triangles) {
+            primitives.push_back({triangle.aabb, 0, static_cast<int>(primitives.size())});
+            // (the position of the Morton code of addToGlobalTriangles)
+            centroids.push_back((triangle.v0 + triangle.v1 + triangle.v2) / 3 + triangle.motion / 2);
+            has_motion = has_motion || !triangle.motion.isZero();
+            block.push_back(TriangleRecord::fromTriangle(triangle));
+            if (block.size() == WRITE_BLOCK_RECORDS) writeRecords(fd, path, block);
+        }
+    }
+}
+
+void TriangleStager::computeMortonCodes(const AABB &box) {
+    for (size_t i = 0; i < primitives.size(); i++) {
+        primitives[i].morton_code = TriangleMesh::calcMortonCode(centroids[i], box);
+    }
+    std::vector<Vec3f>().swap(centroids);
+}
+
+const TriangleRecord *TriangleStager::map() {
+    if (!records) {
+        writeRecords(fd, path, block);
+        mapped_bytes = std::max<size_t>(primitives.size() * sizeof(TriangleRecord), 1);
+        records = mapRecords(fd, path, mapped_bytes);
+    }
+    return records;
+}
+
+void TriangleStager::releasePages() {
+    if (records) madvise(const_cast<TriangleRecord *>(records), mapped_bytes, MADV_DONTNEED);
+}
+
+ChunkedGeometry::ChunkedGeometry(const std::string &path, TriangleStager &staged,
+                                 const std::vector<BuildPrimitive> &order, std::vector<int> starts,
+                                 size_t cache_bytes)
+    : chunk_starts(std::move(starts)), caches(omp_get_max_threads()) {
+    chunk_starts.push_back(static_cast<int>(order.size()));
+
+    // Gather the staged records in BVH order and write them in blocks, the file may be much
+    // larger than the memory left
+    fd = openScratchFile(path);
+    const TriangleRecord *staged_records = staged.map();
+    std::vector<TriangleRecord> block;
+    block.reserve(WRITE_BLOCK_RECORDS);
+    for (const BuildPrimitive &primitive : order) {
+        block.push_back(staged_records[primitive.index]);
+        if (block.size() == WRITE_BLOCK_RECORDS) {
+            writeRecords(fd, path, block);
+            // the staged pages are read in Morton order, scattered over the file
+            staged.releasePages();
+        }
+    }
+    writeRecords(fd, path, block);
+    staged.releasePages();
+
+    mapped_bytes = std::max<size_t>(order.size() * sizeof(TriangleRecord), 1);
+    records = mapRecords(fd, path, mapped_bytes);
+
+    size_t largest = 1;
+    for (int c = 0; c < numChunks(); c++) {
+        largest = std::max<size_t>(largest, chunk_starts[c + 1] - chunk_starts[c]);
+    }
+    // at least two chunks per thread, so that a ray going back and forth does not thrash
+    const size_t chunks_per_thread = std::max<size_t>(2, cache_bytes / caches.size() / (largest * sizeof(Triangle)));
+    for (ThreadCache &cache : caches) {
+        cache.chunks.setCapacity(chunks_per_thread);
+    }
+}
+
+ChunkedGeometry::~ChunkedGeometry() {
+    if (records) munmap(const_cast<TriangleRecord *>(records), mapped_bytes);
+    if (fd >= 0) close(fd);
+}
+
+const Triangle *ChunkedGeometry::fetch(int index) {
+    assert(omp_get_thread_num() < static_cast<int>(caches.size()));
+    ThreadCache &cache = caches[omp_get_thread_num()];
+    int chunk = static_cast<int>(std::upper_bound(chunk_starts.begin(), chunk_starts.end(), index) -
+                                 chunk_starts.begin()) - 1;
+    if (chunk != cache.last_chunk) {
+        cache.last_triangles = load(cache, chunk).data();
+        cache.last_chunk = chunk;
+    }
+    return cache.last_triangles + (index - chunk_starts[chunk]);
+}
+
+const std::vector<Triangle> &ChunkedGeometry::load(ThreadCache &cache, int chunk) {
+    if (std::vector<Triangle> *found = cache.chunks.find(chunk)) {
+        return *found;
+    }
+    STATS_INC(GEOMETRY_CHUNK_LOADS);
+
+    // The triangles of the evicted chunk (if any) are reused
+    return cache.chunks.insert(chunk, [&](std::vector<Triangle> &triangles) {
+        triangles.clear();
+        const int begin = chunk_starts[chunk], end = chunk_starts[chunk + 1];
+        triangles.reserve(end - begin);
+        for (int i = begin; i < end; i++) {
+            const TriangleRecord &record = records[i];
+            Vec3f v[3], n[3];
+            for (int k = 0; k < 3; k++) {
+                v[k] = Vec3f(record.v[k][0], record.v[k][1], record.v[k][2]);
+                n[k] = Vec3f(record.n[k][0], record.n[k][1], record.n[k][2]);
+            }
+            // the bounding box and morton code are only needed by the BVH construction
+            Triangle &triangle =
+                triangles.emplace_back(v[0], v[1], v[2], n[0], n[1], n[2], record.material_id, AABB(), 0);
+            triangle.uv0 = Vec2f(record.uv[0][0], record.uv[0][1]);
+            triangle.uv1 = Vec2f(record.uv[1][0], record.uv[1][1]);
+            triangle.uv2 = Vec2f(record.uv[2][0], record.uv[2][1]);
+            triangle.motion = Vec3f(record.motion[0], record.motion[1], record.motion[2]);
+            triangle.light_id = record.light_id;
+        }
+
+        // The decoded copy is all we need, drop the mapped pages from the resident memory. Pages
+        // shared with the neighbour chunks are simply read again if they are needed.
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t first = (begin * sizeof(TriangleRecord)) / page * page;
+        const size_t last = std::min(end * sizeof(TriangleRecord), mapped_bytes);
+        madvise(reinterpret_cast<char *>(const_cast<TriangleRecord *>(records)) + first, last - first,
+                MADV_DONTNEED);
+    });
+}
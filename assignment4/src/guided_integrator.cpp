@@ -0,0 +1,160 @@
+#include "guided_integrator.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "stats.h"
+#include "utils.h"
+
+GuidedIntegrator::GuidedIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp, int max_depth,
+                                   const Config::GuidingConfig &config)
+    : Integrator(std::move(cam), std::move(scene), spp, max_depth),
+      config(config),
+      sd_tree(this->scene->getAABB()) {
+}
+
+void GuidedIntegrator::render() const {
+    Vec2i resolution = camera->getImage()->getResolution();
+    Framebuffer accum(resolution.x(), resolution.y());
+    const int budget = spp_sqrt * spp_sqrt;
+    const size_t max_bytes = static_cast<size_t>(config.max_memory_mb) * 1024 * 1024;
+
+    // Training passes with 1, 4, 16, ... spp, using up to half of the samples
+    int pass = 0, pass_spp_sqrt = 1, n_samples = 0;
+    training = true;
+    while (n_samples + pass_spp_sqrt * pass_spp_sqrt <= budget / 2) {
+        renderPass(pass, pass_spp_sqrt, accum);
+        n_samples += pass_spp_sqrt * pass_spp_sqrt;
+        // the spatial threshold grows with the square root of the samples per pass
+        sd_tree.refine(config.spatial_threshold * static_cast<float>(pass_spp_sqrt), config.energy_threshold,
+                       config.max_depth, max_bytes);
+        printf("\rGuiding pass %d: %d spp, %zu spatial leaves, %.2f MB\n", pass, pass_spp_sqrt * pass_spp_sqrt,
+               sd_tree.numLeaves(), static_cast<double>(sd_tree.memoryFootprint()) / (1024.0 * 1024.0));
+        pass++;
+        pass_spp_sqrt *= 2;
+    }
+
+    // The image is made of the remaining samples only, rendered with the final distribution.
+    // The training passes, sampled with coarser distributions, are much noisier and discarded.
+    training = false;
+    accum.clear();
+    // All the remaining samples, in square passes: the largest that fits, then the rest
+    const int final_samples = budget - n_samples;
+    for (int remaining = final_samples; remaining > 0; pass++) {
+        int final_spp_sqrt = static_cast<int>(std::sqrt(static_cast<float>(remaining)));
+        while (final_spp_sqrt * final_spp_sqrt > remaining) final_spp_sqrt--;
+        renderPass(pass, final_spp_sqrt, accum);
+        remaining -= final_spp_sqrt * final_spp_sqrt;
+    }
+    printf("\rGuided rendering: %d spp after %d training spp\n", final_samples, n_samples);
+    writePixels(accum);
+}
+
+Vec3f GuidedIntegrator::radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const {
+    if (depth >= max_depth) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    Interaction interaction;
+    scene->intersect(ray, interaction);
+    return radiance(ray, interaction, sampler, depth, features);
+}
+
+Vec3f GuidedIntegrator::radiance(Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                                 FeatureSample *features) const {
+    if (depth >= max_depth) {
+        return {0.f, 0.f, 0.f};
+    }
+    // the features are only carried on behind delta BSDFs
+    if (features && !recordFeatures(*features, ray, interaction, depth)) {
+        features = nullptr;
+    }
+
+    switch (interaction.type) {
+        case Interaction::NONE: {
+            if (scene->getEnvLight()) {
+                return scene->getEnvLight()->emission(ray.direction);
+            }
+            return {0.f, 0.f, 0.f};
+        }
+        // only reached by camera rays and after delta bounces
+        case Interaction::LIGHT: {
+            STATS_INC(PATH_VERTICES);
+            return scene->getLight()->emission(interaction.normal, ray.direction);
+        }
+        case Interaction::GEOMETRY: {
+            STATS_INC(PATH_VERTICES);
+            return std::visit(
+                [&](const auto &bsdf) { return shade(bsdf, ray, interaction, sampler, depth, features); },
+                scene->getMaterial(interaction.material_id));
+        }
+        default: {
+            return {0.f, 0.f, 0.f};
+        }
+    }
+}
+
+template <typename BSDFType>
+Vec3f GuidedIntegrator::shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler,
+                              int depth, FeatureSample *features) const {
+    interaction.wo = -ray.direction.normalized();
+
+    // delta BSDFs can not be guided
+    if (bsdf.isDelta()) {
+        Vec3f wi = bsdf.sample(interaction, sampler);
+        Ray nextRay(interaction.pos, wi);
+        nextRay.continuePath(ray, interaction.dist);
+        const Vec3f f = bsdf.evaluate(interaction);
+        if (features) {
+            features->throughput = features->throughput.cwiseProduct(f);
+        }
+        return f.cwiseProduct(radiance(nextRay, sampler, depth + 1, features));
+    }
+
+    Vec3f L = directLighting(interaction, sampler);
+
+    // Sample the BSDF or the learned distribution, once the leaf has learned one
+    SDTree::Leaf &leaf = sd_tree.lookup(interaction.pos);
+    const bool guided = leaf.sampling.energy() > 0;
+    const float bsdf_fraction = guided ? config.bsdf_fraction : 1.f;
+    Vec3f wi;
+    if (sampler.get1D() < bsdf_fraction) {
+        wi = bsdf.sample(interaction, sampler);
+    } else {
+        wi = leaf.sampling.sample(sampler);
+        interaction.wi = wi;
+    }
+    // pdf of the mixture
+    const float bsdf_pdf = std::max(0.f, bsdf.pdf(interaction));
+    float pdf = bsdf_fraction * bsdf_pdf;
+    if (guided) {
+        pdf += (1 - bsdf_fraction) * leaf.sampling.pdf(wi);
+    }
+    if (pdf <= 0) {
+        return L;
+    }
+    Vec3f weight = bsdf.evaluate(interaction) * std::abs(wi.dot(interaction.normal)) / pdf;
+
+    Ray nextRay(interaction.pos, wi);
+    nextRay.continuePath(ray, interaction.dist, ROUGH_CONE_SPREAD);
+    Interaction next;
+    scene->intersect(nextRay, next);
+
+    // Incident radiance along wi. The area light is accounted for by direct lighting, and the
+    // environment is MIS weighted against the BSDF density: the weights of both strategies
+    // still sum up to one, and the mixture density is positive wherever the BSDF's is.
+    Vec3f Li(0, 0, 0);
+    if (next.type == Interaction::NONE && scene->getEnvLight()) {
+        Li = scene->getEnvLight()->emission(wi);
+        L += weight.cwiseProduct(Li) * utils::powerHeuristic(bsdf_pdf, scene->getEnvLight()->pdf(wi));
+    } else if (next.type == Interaction::GEOMETRY) {
+        Li = radiance(nextRay, next, sampler, depth + 1, nullptr);
+        L += weight.cwiseProduct(Li);
+    }
+
+    // Only what is estimated here is learned: directions towards the area light would be wasted
+    if (training) {
+        leaf.building.record(wi, Li.mean() / pdf);
+    }
+    return L;
+}
@@ -1,8 +1,139 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 
 #include "image.h"
 
+namespace {
+
+// values per parallel work item of encodeGamma8
+constexpr size_t GAMMA_CHUNK = 4096;
+// bound of the error of gammaCodes' approximation, in codes (it is 0.0012 over [0, 1])
+constexpr float GAMMA_MAX_ERROR = 0.004f;
+
+// Smallest value of every code: gammaCorrection(v) >= k exactly when v >= thresholds[k]. Found
+// by bisecting the bit patterns of the floats in [0, 1], on which the code is non-decreasing.
+const std::array<float, 256> &gammaThresholds() {
+    static const std::array<float, 256> thresholds = [] {
+        std::array<float, 256> t{};
+        t[0] = 0.f;
+        for (int k = 1; k < 256; k++) {
+            uint32_t low = 0, high = 0x3f800000;  // bits of 0 and 1
+            while (low < high) {
+                const uint32_t mid = low + (high - low) / 2;
+                float v;
+                std::memcpy(&v, &mid, sizeof(v));
+                if (utils::gammaCorrection(v) >= k) {
+                    high = mid;
+                } else {
+                    low = mid + 1;
+                }
+            }
+            std::memcpy(&t[k], &low, sizeof(float));
+        }
+        return t;
+    }();
+    return thresholds;
+}
+
+// Codes of the values, like encodeGamma8, or -1 for the values to look up in the thresholds.
+// The code is that of 255 * 2^(log2(v) / 2.2), with polynomials of the mantissa for log2 and of
+// the fraction for exp2. Their error is below GAMMA_MAX_ERROR codes over all the floats in
+// [0, 1], so the truncation only differs from that of the exact power within this distance of
+// a code boundary. The loop has no branch and no call, it vectorizes.
+__attribute__((always_inline)) inline void gammaCodes(const float *linear, int32_t *codes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        // Clamped to [0, 1] like the power in gammaCorrection, on the bit patterns since float
+        // selects could trap and keep the loop from being vectorized
+        int32_t raw;
+        std::memcpy(&raw, &linear[i], sizeof(raw));
+        const int32_t bits = std::min(std::max(raw, 0), 0x3f800000);
+        const auto exponent = static_cast<float>((bits >> 23) - 127);
+        const int32_t mantissa_bits = (bits & 0x007fffff) | 0x3f800000;
+        float mantissa;
+        std::memcpy(&mantissa, &mantissa_bits, sizeof(mantissa));
+        // log2(1 + m) on [0, 1)
+        const float m = mantissa - 1.f;
+        const float log_mantissa =
+            1.4390929690222265e-05f +
+            m * (1.4415920772205149f +
+                 m * (-0.7072534336796545f +
+                      m * (0.4115614825929902f + m * (-0.18983244683935122f + m * 0.04392862796991791f))));
+        // -58 < y <= 0, its truncation leaves a fraction in (-1, 0]
+        const float y = (exponent + log_mantissa) * (1.f / 2.2f);
+        const auto whole = static_cast<int32_t>(y);
+        const float f = y - static_cast<float>(whole);
+        const float power =
+            0.9999999452375892f +
+            f * (0.693143201652742f +
+                 f * (0.24017948957713273f +
+                      f * (0.055299607373334905f + f * (0.009210875858557422f + f * 0.0009475537658672406f))));
+        const int32_t scale_bits = (whole + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &scale_bits, sizeof(scale));
+        const float code = 255.f * (power * scale);
+
+        const auto nearest = static_cast<int32_t>(code + 0.5f);
+        const int32_t uncertain = static_cast<int32_t>(nearest > 0) &
+                                  static_cast<int32_t>(std::fabs(code - static_cast<float>(nearest)) < GAMMA_MAX_ERROR);
+        const int32_t result = (static_cast<int32_t>(code) & (uncertain - 1)) | -uncertain;
+        // 1 and above give 255, the other negative values and NaN give 0, and -inf gives 255 like
+        // powf(-inf, 1 / 2.2) = inf
+        const int32_t saturated = -static_cast<int32_t>(raw >= 0x3f800000);
+        const int32_t valid = static_cast<int32_t>(raw > 0) & static_cast<int32_t>(raw <= 0x7f800000);
+        const int32_t negative_infinity = -static_cast<int32_t>(raw == static_cast<int32_t>(0xff800000u));
+        codes[i] = (((result & ~saturated) | (255 & saturated)) & -valid) | (255 & negative_infinity);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) void gammaCodesAVX2(const float *linear, int32_t *codes, size_t count) {
+    gammaCodes(linear, codes, count);
+}
+#endif
+
+void encodeGamma8Chunk(const float *linear, uint8_t *codes, size_t count) {
+    int32_t wide_codes[GAMMA_CHUNK];
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        gammaCodesAVX2(linear, wide_codes, count);
+    } else {
+        gammaCodes(linear, wide_codes, count);
+    }
+#else
+    gammaCodes(linear, wide_codes, count);
+#endif
+    const std::array<float, 256> &thresholds = gammaThresholds();
+    for (size_t i = 0; i < count; i++) {
+        int32_t code = wide_codes[i];
+        if (code < 0) {
+            // (about 1% of the values)
+            code = static_cast<int32_t>(std::upper_bound(thresholds.begin() + 1, thresholds.end(), linear[i]) -
+                                        thresholds.begin()) - 1;
+        }
+        codes[i] = static_cast<uint8_t>(code);
+    }
+}
+
+}  // namespace
+
+void encodeGamma8(const float *linear, uint8_t *codes, size_t count) {
+    const auto chunks = static_cast<int64_t>((count + GAMMA_CHUNK - 1) / GAMMA_CHUNK);
+    #pragma omp parallel for schedule(static) if (chunks > 1)
+    for (int64_t c = 0; c < chunks; c++) {
+        const size_t first = static_cast<size_t>(c) * GAMMA_CHUNK;
+        encodeGamma8Chunk(linear + first, codes + first, std::min(GAMMA_CHUNK, count - first));
+    }
+}
+
 ImageRGB::ImageRGB(int width, int height) : resolution(width, height) {
     data.resize(width * height);
 }
@@ -19,14 +150,63 @@ void ImageRGB::setPixel(int x, int y, const Vec3f &value) {
     data[x + resolution.x() * y] = value;
 }
 
+void ImageRGB::setRow(int x, int y, int count, const Vec3f *values) {
+    std::copy(values, values + count, data.begin() + x + resolution.x() * y);
+}
+
 void ImageRGB::writeImgToFile(const std::string &file_name) {
     std::vector<uint8_t> rgb_data(resolution.x() * resolution.y() * 3);
+    static_assert(sizeof(Vec3f) == 3 * sizeof(float), "the pixels are encoded as a float array");
+    encodeGamma8(data.front().data(), rgb_data.data(), rgb_data.size());
+
+    stbi_flip_vertically_on_write(true);
+    stbi_write_png(file_name.c_str(), resolution.x(), resolution.y(), 3, rgb_data.data(), 0);
+}
+
+void ImageRGB::writeHDRToFile(const std::string &file_name) {
+    std::vector<float> rgb_data(resolution.x() * resolution.y() * 3);
     for (int i = 0; i < data.size(); i++) {
-        rgb_data[3 * i] = utils::gammaCorrection(data[i].x());
-        rgb_data[3 * i + 1] = utils::gammaCorrection(data[i].y());
-        rgb_data[3 * i + 2] = utils::gammaCorrection(data[i].z());
+        rgb_data[3 * i] = data[i].x();
+        rgb_data[3 * i + 1] = data[i].y();
+        rgb_data[3 * i + 2] = data[i].z();
     }
 
     stbi_flip_vertically_on_write(true);
-    stbi_write_png(file_name.c_str(), resolution.x(), resolution.y(), 3, rgb_data.data(), 0);
+    stbi_write_hdr(file_name.c_str(), resolution.x(), resolution.y(), 3, rgb_data.data());
+}
+
+ImageRGB ImageRGB::readHDRFromFile(const std::string &file_name) {
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(true);
+    float *raw = stbi_loadf(file_name.c_str(), &width, &height, &channels, 3);
+    if (!raw) {
+        std::cerr << "Can not load image " << file_name << ": " << stbi_failure_reason() << std::endl;
+        exit(-1);
+    }
+
+    ImageRGB img(width, height);
+    for (int i = 0; i < width * height; i++) {
+        img.data[i] = Vec3f(raw[3 * i], raw[3 * i + 1], raw[3 * i + 2]);
+    }
+    stbi_image_free(raw);
+    return img;
+}
+
+double ImageRGB::rmse(const ImageRGB &other, const Vec2i &low, const Vec2i &high) const {
+    double sum = 0;
+    for (int y = low.y(); y < high.y(); y++) {
+        for (int x = low.x(); x < high.x(); x++) {
+            sum += (getPixel(x, y) - other.getPixel(x, y)).squaredNorm();
+        }
+    }
+    const double count = 3.0 * (high.x() - low.x()) * (high.y() - low.y());
+    return count > 0 ? std::sqrt(sum / count) : 0.0;
+}
+
+ImageRGB ImageRGB::difference(const ImageRGB &other) const {
+    ImageRGB diff(resolution.x(), resolution.y());
+    for (size_t i = 0; i < data.size(); i++) {
+        diff.data[i] = (data[i] - other.data[i]).cwiseAbs();
+    }
+    return diff;
 }
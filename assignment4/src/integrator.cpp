@@ -1,4 +1,8 @@
 #include "integrator.h"
+#include "bdpt_integrator.h"
+#include "guided_integrator.h"
+#include "photon_integrator.h"
+#include "stats.h"
 #include "utils.h"
 #include <omp.h>
 
@@ -9,11 +13,69 @@ Integrator::Integrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene
       scene(std::move(scene)),
       spp(spp),
       spp_sqrt(static_cast<int>(std::sqrt(spp))),
-      max_depth(max_depth) {
+      max_depth(max_depth),
+      crop_low(0, 0),
+      crop_high(camera->getImage()->getResolution()) {
 }
 
 void Integrator::render() const {
+    if (time_budget > 0) {
+        renderWithinBudget();
+        return;
+    }
+    Vec2i resolution = camera->getImage()->getResolution();
+    Framebuffer accum(resolution.x(), resolution.y());
+    renderPass(0, spp_sqrt, accum);
+    writePixels(accum);
+}
+
+void Integrator::renderWithinBudget() const {
+    const double start = omp_get_wtime();
+    Vec2i resolution = camera->getImage()->getResolution();
+    Framebuffer accum(resolution.x(), resolution.y());
+    // Running mean and variance of the pass durations (Welford). The next pass is only started
+    // when it is expected to end within the budget, with a margin of two standard deviations.
+    double mean = 0, m2 = 0;
+    int pass = 0;
+    while (true) {
+        const double pass_start = omp_get_wtime();
+        renderPass(pass, 1, accum);
+        pass++;
+        // the image always holds the average of the finished passes
+        writePixels(accum);
+
+        const double duration = omp_get_wtime() - pass_start;
+        const double delta = duration - mean;
+        mean += delta / pass;
+        m2 += delta * (duration - mean);
+        // a single pass says nothing about the spread, assume half of its duration
+        const double deviation = pass > 1 ? std::sqrt(m2 / (pass - 1)) : 0.5 * mean;
+        const double elapsed = omp_get_wtime() - start;
+        printf("\rPass %d: %.3fs, %.2fs of %.2fs used", pass, duration, elapsed, time_budget);
+        if (elapsed + mean + 2 * deviation > time_budget) {
+            break;
+        }
+    }
+    printf("\n%d spp rendered within the time budget\n", pass);
+}
+
+void Integrator::writePixels(const Framebuffer &accum) const {
+    accum.resolve(*camera->getImage(), crop_low, crop_high);
+}
+
+void Integrator::renderPass(int pass, int pass_spp_sqrt, Framebuffer &accum) const {
     Vec2i resolution = camera->getImage()->getResolution();
+    // The tile grid covers the whole image, so the random sequence of a tile does not depend on
+    // the crop window
+    const int tiles_x = (resolution.x() + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (resolution.y() + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<int> tiles;
+    for (int ty = crop_low.y() / TILE_SIZE; ty * TILE_SIZE < crop_high.y(); ty++) {
+        for (int tx = crop_low.x() / TILE_SIZE; tx * TILE_SIZE < crop_high.x(); tx++) {
+            tiles.push_back(ty * tiles_x + tx);
+        }
+    }
+    const int n_tiles = static_cast<int>(tiles.size());
     int cnt = 0;
     Sampler sampler;
 
@@ -24,96 +86,157 @@ void Integrator::render() const {
     rotator << std::sin(magic_angle), -std::cos(magic_angle), std::cos(magic_angle), std::sin(magic_angle);
     #endif
 
-    #pragma omp parallel for schedule(dynamic), shared(cnt, resolution), private(sampler), default(none)
-    for (int dx = 0; dx < resolution.x(); dx++) {
-        #pragma omp atomic
-        ++cnt;
-        printf("\r%.02f%%", cnt * 100.0 / resolution.x());
-        sampler.setSeed(omp_get_thread_num());
-
-        for (int dy = 0; dy < resolution.y(); dy++) {
-            Vec3f L(0, 0, 0);
-            // Generate #spp rays for each pixel and use Monte Carlo integration to compute radiance.
-
-            // Generate pixel samples for pixel (dx, dy)
-            for (int i = 0; i < spp_sqrt; i++) {
-                for (int j = 0; j < spp_sqrt; j++) {
-                    float x = ((float)i + 0.5f) / (float)spp_sqrt;
-                    float y = ((float)j + 0.5f) / (float)spp_sqrt;
-                    
-                    #ifdef USE_ROTATED_GRID
-                    Vec2f sample = rotator * Vec2f(x, y) + Vec2f(0.5f + (float)dx, 0.5f + (float)dy);
-                    Ray ray = camera->generateRay(sample.x(), sample.y());
-                    #else 
-                    Ray ray = camera->generateRay(x + dx, y + dy);
-                    #endif
-                    L += radiance(ray, sampler, 0);
+    // Every thread adds the radiance of its tiles to a buffer of its own, allocated and first
+    // touched by the thread so that its pages are on the NUMA node of the thread. The buffers
+    // are added to accum once all tiles are rendered, each thread writing whole tile rows,
+    // instead of all threads writing interleaved pixels of the shared image while rendering.
+    std::vector<ThreadTiles> thread_tiles(omp_get_max_threads());
+
+    #pragma omp parallel default(none) shared(cnt, resolution, accum, pass, pass_spp_sqrt, tiles, n_tiles, tiles_x, tiles_y, thread_tiles) private(sampler)
+    {
+        ThreadTiles &local = thread_tiles[omp_get_thread_num()];
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < n_tiles; t++) {
+            #pragma omp atomic
+            ++cnt;
+            printf("\r%.02f%%", cnt * 100.0 / n_tiles);
+            STATS_TIMER_START(tile_start);
+            const int tile = tiles[t];
+            // one random sequence per tile and pass, independent of the thread scheduling
+            sampler.setSeed(static_cast<uint64_t>(pass) * tiles_x * tiles_y + tile);
+
+            const Vec2i low(std::max(crop_low.x(), tile % tiles_x * TILE_SIZE),
+                            std::max(crop_low.y(), tile / tiles_x * TILE_SIZE));
+            const Vec2i high(std::min(crop_high.x(), low.x() - low.x() % TILE_SIZE + TILE_SIZE),
+                             std::min(crop_high.y(), low.y() - low.y() % TILE_SIZE + TILE_SIZE));
+            local.tiles.push_back({low, high, local.radiance.size()});
+
+            for (int dy = low.y(); dy < high.y(); dy++) {
+                for (int dx = low.x(); dx < high.x(); dx++) {
+                    Vec3f L(0, 0, 0);
+                    // Generate #spp rays for each pixel and use Monte Carlo integration to compute radiance.
+
+                    // Generate pixel samples for pixel (dx, dy)
+                    for (int i = 0; i < pass_spp_sqrt; i++) {
+                        for (int j = 0; j < pass_spp_sqrt; j++) {
+                            float x = ((float)i + 0.5f) / (float)pass_spp_sqrt;
+                            float y = ((float)j + 0.5f) / (float)pass_spp_sqrt;
+
+                            #ifdef USE_ROTATED_GRID
+                            Vec2f sample = rotator * Vec2f(x, y) + Vec2f(0.5f + (float)dx, 0.5f + (float)dy);
+                            Ray ray = camera->generateRay(sample.x(), sample.y(), sampler);
+                            #else
+                            Ray ray = camera->generateRay(x + dx, y + dy, sampler);
+                            #endif
+                            STATS_INC(PRIMARY_RAYS);
+                            // the features are recorded along the path traced for the radiance
+                            FeatureSample features;
+                            L += radiance(ray, sampler, 0, aovs ? &features : nullptr);
+                            if (aovs) {
+                                aovs->addSample(dx + dy * resolution.x(), features.albedo, features.normal,
+                                                features.depth);
+                            }
+                        }
+                    }
+
+                    local.radiance.push_back(L);
                 }
             }
+            STATS_TIMER_STOP(tile_start);
+        }
 
-            camera->getImage()->setPixel(dx, dy, L / spp);
+        // (the implicit barrier of the loop above separates the rendering and the merge)
+        const auto pass_samples = static_cast<float>(pass_spp_sqrt * pass_spp_sqrt);
+        for (const ThreadTiles::Tile &tile : local.tiles) {
+            const int tile_width = tile.high.x() - tile.low.x();
+            const Vec3f *L = &local.radiance[tile.offset];
+            for (int dy = tile.low.y(); dy < tile.high.y(); dy++, L += tile_width) {
+                accum.addRow(tile.low.x(), dy, tile_width, L, pass_samples);
+            }
         }
     }
 }
 
-Vec3f Integrator::radiance(Ray &ray, Sampler &sampler, int depth) const {
+bool Integrator::recordFeatures(FeatureSample &features, const Ray &ray, const Interaction &interaction,
+                                int depth) const {
+    if (depth == 0 && interaction.type != Interaction::NONE) {
+        features.depth = interaction.dist;
+    }
+    // the environment has a white albedo, so that it is not altered by the denoiser
+    if (interaction.type == Interaction::NONE) {
+        features.albedo = scene->getEnvLight() ? features.throughput : Vec3f(0, 0, 0);
+        features.normal = Vec3f(0, 0, 0);
+        return false;
+    }
+    // normals facing the camera
+    features.normal = interaction.normal.dot(ray.direction) > 0 ? Vec3f(-interaction.normal) : interaction.normal;
+    if (interaction.type == Interaction::LIGHT) {
+        features.albedo = features.throughput;
+        return false;
+    }
+
+    // Follow delta BSDFs, the features are taken from what is seen in the mirror or through the glass
+    const BSDF &material = scene->getMaterial(interaction.material_id);
+    if (std::visit([](const auto &bsdf) { return bsdf.isDelta(); }, material) && depth + 1 < max_depth) {
+        return true;
+    }
+    features.albedo = std::visit([](const auto &bsdf) { return bsdf.albedo(); }, material)
+                          .cwiseProduct(interaction.texture)
+                          .cwiseProduct(features.throughput);
+    return false;
+}
+
+Vec3f Integrator::radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const {
 
     // If max depth exceeded, return zero
     if (depth >= max_depth) {
         return {0.f, 0.f, 0.f};
     }
 
-    // Check intersection with the scene. If no intersection, return zero.
+    // Check intersection with the scene.
     Interaction interaction;
-    if (!scene->intersect(ray, interaction)) {
+    scene->intersect(ray, interaction);
+    return radiance(ray, interaction, sampler, depth, features);
+}
+
+Vec3f Integrator::radiance(Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                           FeatureSample *features) const {
+
+    // If max depth exceeded, return zero
+    if (depth >= max_depth) {
         return {0.f, 0.f, 0.f};
     }
+    // the features are only carried on behind delta BSDFs
+    if (features && !recordFeatures(*features, ray, interaction, depth)) {
+        features = nullptr;
+    }
 
-    // There is an intersection. Check intersection type.
+    // Check intersection type.
     switch (interaction.type) {
-        
-        // No intersection. Return zero.
+
+        // No intersection. The ray escapes to the environment, if there is one.
+        // (Only camera rays and rays leaving delta BSDFs get here, see shade())
         case Interaction::NONE: {
+            if (scene->getEnvLight()) {
+                return scene->getEnvLight()->emission(ray.direction);
+            }
             return {0.f, 0.f, 0.f};
         }
 
         // Intersection with light. Directly get light emission color.
         case Interaction::LIGHT: {
+            STATS_INC(PATH_VERTICES);
             return scene->getLight()->emission(interaction.normal, ray.direction);
         }
 
         // Intersection with geometry. Calculate direct light and recursively calculate indirect light.
+        // Dispatch on the material type once, the rest of the bounce is specialized for it.
         case Interaction::GEOMETRY: {
-            // Calculate direct light.
-            Vec3f directLight = directLighting(interaction, sampler);
-
-            // Calculate indirect light.
-            Vec3f indirectLight(0, 0, 0);
-            interaction.wo = -ray.direction;
-
-            // ideal diffusion
-            if (!interaction.material->isDelta()) {
-                Vec3f wi = interaction.material->sample(interaction, sampler);
-                Ray nextRay(interaction.pos, wi);
-                if (!scene->isShadowed(nextRay)) {
-                    return directLight;
-                }
-                Vec3f L = radiance(nextRay, sampler, depth + 1);
-                indirectLight = interaction.material->evaluate(interaction).cwiseProduct(L) *
-                                wi.dot(interaction.normal) / interaction.material->pdf(interaction);
-            }
-
-            // ideal specular (mirror)
-            else {
-                Vec3f wi = -interaction.wo + 2 * (interaction.wo.dot(interaction.normal)) * interaction.normal;
-                Ray nextRay(interaction.pos, wi);
-                if (!scene->isShadowed(nextRay)) {
-                    return directLight;
-                }
-                indirectLight = radiance(nextRay, sampler, depth + 1);
-            }
-
-            return directLight + indirectLight;
+            STATS_INC(PATH_VERTICES);
+            return std::visit(
+                [&](const auto &bsdf) { return shade(bsdf, ray, interaction, sampler, depth, features); },
+                scene->getMaterial(interaction.material_id));
         }
 
         // (unreachable code)
@@ -123,23 +246,122 @@ Vec3f Integrator::radiance(Ray &ray, Sampler &sampler, int depth) const {
     }
 }
 
+template <typename BSDFType>
+Vec3f Integrator::shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler, int depth,
+                        FeatureSample *features) const {
+    interaction.wo = -ray.direction.normalized();
+
+    // Calculate direct light. Delta BSDFs can not be connected to a light sample.
+    Vec3f directLight(0, 0, 0);
+    if (!bsdf.isDelta()) {
+        directLight = directLighting(bsdf, interaction, sampler);
+    }
+
+    // Calculate indirect light.
+    Vec3f indirectLight(0, 0, 0);
+
+    // non-delta BSDF (diffuse, glossy), importance sampled by the BSDF
+    if (!bsdf.isDelta()) {
+        Vec3f wi = bsdf.sample(interaction, sampler);
+        float pdf = bsdf.pdf(interaction);
+        if (pdf <= 0) {
+            return directLight;
+        }
+        Vec3f weight = bsdf.evaluate(interaction) * std::abs(wi.dot(interaction.normal)) / pdf;
+        Ray nextRay(interaction.pos, wi);
+        nextRay.continuePath(ray, interaction.dist, ROUGH_CONE_SPREAD);
+        Interaction next;
+        scene->intersect(nextRay, next);
+
+        // The area light is already accounted for by direct lighting.
+        // The environment is sampled by both, so the two estimates are combined with MIS.
+        if (next.type == Interaction::NONE && scene->getEnvLight()) {
+            float light_pdf = scene->getEnvLight()->pdf(wi);
+            indirectLight = weight.cwiseProduct(scene->getEnvLight()->emission(wi)) *
+                            utils::powerHeuristic(pdf, light_pdf);
+        } else if (next.type == Interaction::GEOMETRY) {
+            indirectLight = weight.cwiseProduct(radiance(nextRay, next, sampler, depth + 1, nullptr));
+        }
+    }
+
+    // delta BSDF (mirror, smooth conductor or glass)
+    // the light source may be hit directly since it was not sampled by direct lighting
+    else {
+        Vec3f wi = bsdf.sample(interaction, sampler);
+        Ray nextRay(interaction.pos, wi);
+        nextRay.continuePath(ray, interaction.dist);
+        const Vec3f f = bsdf.evaluate(interaction);
+        if (features) {
+            features->throughput = features->throughput.cwiseProduct(f);
+        }
+        indirectLight = f.cwiseProduct(radiance(nextRay, sampler, depth + 1, features));
+    }
+
+    return directLight + indirectLight;
+}
+
 Vec3f Integrator::directLighting(Interaction &interaction, Sampler &sampler) const {
+    return std::visit([&](const auto &bsdf) { return directLighting(bsdf, interaction, sampler); },
+                      scene->getMaterial(interaction.material_id));
+}
+
+template <typename BSDFType>
+Vec3f Integrator::directLighting(const BSDFType &bsdf, Interaction &interaction, Sampler &sampler) const {
     Vec3f L(0, 0, 0);
     // Compute direct lighting.
 
     Vec3f sample_pos = scene->getLight()->sample(interaction, nullptr, sampler);
     Vec3f ray_dir = sample_pos - interaction.pos;
     Ray shadowRay(interaction.pos, ray_dir);
+    shadowRay.time = interaction.time;
 
     if (!scene->isShadowed(shadowRay)) {
-        float cos_theta_i = interaction.normal.dot(ray_dir.normalized());
-        float cos_theta_o = scene->getLight()->getNormal().dot(-ray_dir.normalized());
+        interaction.wi = ray_dir.normalized();
+        float cos_theta_i = std::abs(interaction.normal.dot(interaction.wi));
+        float cos_theta_o = scene->getLight()->getNormal().dot(-interaction.wi);
 
         L = cos_theta_i * cos_theta_o *
-            scene->getLight()->emission(sample_pos, ray_dir).cwiseProduct(interaction.material->evaluate(interaction));
+            scene->getLight()->emission(sample_pos, interaction.wi).cwiseProduct(bsdf.evaluate(interaction));
         L /= (float)std::pow((sample_pos - interaction.pos).norm(), 2);
         L /= scene->getLight()->pdf(interaction, sample_pos);
     }
 
+    // Importance sample the environment light, MIS weighted against BSDF sampling
+    if (const auto &env_light = scene->getEnvLight()) {
+        Vec3f env_dir;
+        float light_pdf;
+        Vec3f Le = env_light->sample(&env_dir, &light_pdf, sampler);
+        Ray envShadowRay(interaction.pos, env_dir);
+        envShadowRay.time = interaction.time;
+        if (light_pdf > 0 && !scene->isShadowed(envShadowRay)) {
+            interaction.wi = env_dir;
+            float bsdf_pdf = bsdf.pdf(interaction);
+            L += Le.cwiseProduct(bsdf.evaluate(interaction)) * std::abs(interaction.normal.dot(env_dir)) /
+                 light_pdf * utils::powerHeuristic(light_pdf, bsdf_pdf);
+        }
+    }
+
     return L;
 }
+
+std::unique_ptr<Integrator> makeIntegrator(const Config &config, std::shared_ptr<Camera> camera,
+                                           std::shared_ptr<Scene> scene) {
+    switch (config.integrator) {
+        case IntegratorType::PHOTON_MAPPING:
+        case IntegratorType::PROGRESSIVE_PHOTON_MAPPING: {
+            bool progressive = config.integrator == IntegratorType::PROGRESSIVE_PHOTON_MAPPING;
+            return std::make_unique<PhotonMappingIntegrator>(std::move(camera), std::move(scene), config.spp,
+                                                             config.max_depth, config.photon_config, progressive);
+        }
+        case IntegratorType::BDPT: {
+            return std::make_unique<BDPTIntegrator>(std::move(camera), std::move(scene), config.spp, config.max_depth);
+        }
+        case IntegratorType::GUIDED: {
+            return std::make_unique<GuidedIntegrator>(std::move(camera), std::move(scene), config.spp,
+                                                      config.max_depth, config.guiding_config);
+        }
+        default: {
+            return std::make_unique<Integrator>(std::move(camera), std::move(scene), config.spp, config.max_depth);
+        }
+    }
+}
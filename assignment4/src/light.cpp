@@ -18,11 +18,14 @@ SquareAreaLight::SquareAreaLight(const Vec3f &pos, const Vec3f &color, const Vec
     v3 = pos + Vec3f(-size.x() / 2, 0.f, size.y() / 2);
     v4 = pos + Vec3f(size.x() / 2, 0.f, size.y() / 2);
     light_mesh = TriangleMesh({v1, v2, v3, v4}, {Vec3f(0, -1, 0)}, {0, 1, 2, 0, 2, 3}, {0, 0, 0, 0, 0, 0});
+    // (the scene has a single area light)
+    light_mesh.setLight(0);
 }
 
 Vec3f SquareAreaLight::emission(const Vec3f &pos, const Vec3f &dir) const { 
+    // constant radiance, emitted from the front side only
     float cos_theta = getNormal().dot(-dir);
-    return radiance * std::max(0.f, cos_theta);
+    return cos_theta > 0 ? radiance : Vec3f(0, 0, 0);
 }
 
 float SquareAreaLight::pdf(const Interaction &interaction, Vec3f pos) { 
@@ -35,9 +38,64 @@ Vec3f SquareAreaLight::sample(Interaction &interaction, float *pdf, Sampler &sam
 }
 
 bool SquareAreaLight::intersect(Ray &ray, Interaction &interaction) const {
-    if (light_mesh.intersect(ray, interaction)) {
-        interaction.type = Interaction::Type::LIGHT;
-        return true;
+    return light_mesh.intersect(ray, interaction);
+}
+
+EnvironmentLight::EnvironmentLight(const std::string &hdr_path, float scale)
+    : image(ImageRGB::readHDRFromFile(hdr_path)), scale(scale) {
+    // Pixel importance is luminance, weighted by sin(theta) to account for
+    // the compression of the latitude-longitude mapping near the poles.
+    Vec2i res = image.getResolution();
+    std::vector<float> func(res.x() * res.y());
+    for (int y = 0; y < res.y(); y++) {
+        float sin_theta = std::sin(PI * (static_cast<float>(y) + 0.5f) / static_cast<float>(res.y()));
+        for (int x = 0; x < res.x(); x++) {
+            const Vec3f &c = image.getPixel(x, y);
+            func[x + y * res.x()] = (0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z()) * sin_theta;
+        }
+    }
+    distribution = Distribution2D(func, res.x(), res.y());
+}
+
+// u follows the azimuth, v goes from the bottom (-y, v = 0) to the top (+y, v = 1) of the sphere
+Vec2f EnvironmentLight::dirToUV(const Vec3f &dir) {
+    Vec3f d = dir.normalized();
+    float theta = std::acos(std::clamp(d.y(), -1.f, 1.f));
+    float phi = std::atan2(d.x(), -d.z());
+    return {phi / (2.f * PI) + 0.5f, 1.f - theta / PI};
+}
+
+Vec3f EnvironmentLight::uvToDir(const Vec2f &uv) {
+    float theta = (1.f - uv.y()) * PI;
+    float phi = (uv.x() - 0.5f) * 2.f * PI;
+    float sin_theta = std::sin(theta);
+    return {sin_theta * std::sin(phi), std::cos(theta), -sin_theta * std::cos(phi)};
+}
+
+Vec3f EnvironmentLight::emission(const Vec3f &dir) const {
+    Vec2f uv = dirToUV(dir);
+    Vec2i res = image.getResolution();
+    int x = std::clamp(static_cast<int>(uv.x() * static_cast<float>(res.x())), 0, res.x() - 1);
+    int y = std::clamp(static_cast<int>(uv.y() * static_cast<float>(res.y())), 0, res.y() - 1);
+    return scale * image.getPixel(x, y);
+}
+
+Vec3f EnvironmentLight::sample(Vec3f *dir, float *pdf, Sampler &sampler) const {
+    float uv_pdf;
+    Vec2f uv = distribution.sample(sampler.get2D(), &uv_pdf);
+    *dir = uvToDir(uv);
+
+    // change of variables from [0,1]^2 to the sphere: dw = 2 pi^2 sin(theta) du dv
+    float sin_theta = std::sin((1.f - uv.y()) * PI);
+    *pdf = sin_theta > 0 ? uv_pdf / (2.f * PI * PI * sin_theta) : 0.f;
+    return emission(*dir);
+}
+
+float EnvironmentLight::pdf(const Vec3f &dir) const {
+    Vec2f uv = dirToUV(dir);
+    float sin_theta = std::sin((1.f - uv.y()) * PI);
+    if (sin_theta <= 0) {
+        return 0;
     }
-    return false;
+    return distribution.pdf(uv) / (2.f * PI * PI * sin_theta);
 }
@@ -5,7 +5,8 @@
 #include <tiny_obj_loader.h>
 
 static bool loadObj(const std::string &path, std::vector<Vec3f> &vertices, std::vector<Vec3f> &normals,
-                    std::vector<int> &v_index, std::vector<int> &n_index) {
+                    std::vector<Vec2f> &uvs, std::vector<int> &v_index, std::vector<int> &n_index,
+                    std::vector<int> &t_index) {
     std::cout << "-- Loading model " << path << std::endl;
 
     tinyobj::ObjReaderConfig readerConfig;
@@ -36,6 +37,10 @@ static bool loadObj(const std::string &path, std::vector<Vec3f> &vertices, std::
         normals.emplace_back(attrib.normals[i], attrib.normals[i + 1], attrib.normals[i + 2]);
     }
 
+    for (size_t i = 0; i < attrib.texcoords.size(); i += 2) {
+        uvs.emplace_back(attrib.texcoords[i], attrib.texcoords[i + 1]);
+    }
+
     // Loop over shapes
     for (const tinyobj::shape_t &shape : shapes) {
         // Loop over faces(polygon)
@@ -48,6 +53,7 @@ static bool loadObj(const std::string &path, std::vector<Vec3f> &vertices, std::
                 tinyobj::index_t idx = shape.mesh.indices[index_offset + v];
                 v_index.push_back(idx.vertex_index);
                 n_index.push_back(idx.normal_index);
+                t_index.push_back(idx.texcoord_index);
             }
             index_offset += fv;
         }
@@ -62,7 +68,9 @@ std::shared_ptr<TriangleMesh> makeMeshObject(const std::string& path_to_obj, con
     std::vector<Vec3f> normals;
     std::vector<int> v_idx;
     std::vector<int> n_idx;
-    loadObj(path_to_obj, vertices, normals, v_idx, n_idx);
+    std::vector<Vec2f> uvs;
+    std::vector<int> t_idx;
+    loadObj(path_to_obj, vertices, normals, uvs, v_idx, n_idx, t_idx);
     for (auto &v : vertices) v = v * scale + translation;
-    return std::make_shared<TriangleMesh>(vertices, normals, v_idx, n_idx);
+    return std::make_shared<TriangleMesh>(vertices, normals, v_idx, n_idx, uvs, t_idx);
 }
\ No newline at end of file
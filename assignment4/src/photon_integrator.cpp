@@ -0,0 +1,234 @@
+#include "photon_integrator.h"
+
+#include <omp.h>
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "stats.h"
+#include "utils.h"
+
+PhotonMappingIntegrator::PhotonMappingIntegrator(std::shared_ptr<Camera> cam, std::shared_ptr<Scene> scene, int spp,
+                                                 int max_depth, const Config::PhotonConfig &config, bool progressive)
+    : Integrator(std::move(cam), std::move(scene), spp, max_depth),
+      config(config),
+      progressive(progressive),
+      gather_radius(config.radius) {
+    if (this->scene->getEnvLight()) {
+        std::cerr << "Warning: photons are only emitted by the area light, the environment light is missing "
+                     "from the indirect lighting of the photon mapping integrator."
+                  << std::endl;
+    }
+}
+
+void PhotonMappingIntegrator::render() const {
+    if (!progressive) {
+        buildPhotonMap(0);
+        Integrator::render();
+        return;
+    }
+
+    // Spread the samples over the passes, each pass has its own photon map. The passes render
+    // square sample grids, the largest whose size divides spp and which leaves at least the
+    // configured number of passes (or spp passes of 1 sample when there are fewer samples), so
+    // that exactly spp samples are rendered.
+    Vec2i resolution = camera->getImage()->getResolution();
+    Framebuffer accum(resolution.x(), resolution.y());
+    const int total_spp = std::max(spp, 1);
+    int pass_spp_sqrt = std::max(1, static_cast<int>(std::sqrt(static_cast<float>(total_spp) /
+                                                                static_cast<float>(std::max(config.passes, 1)))));
+    while (total_spp % (pass_spp_sqrt * pass_spp_sqrt) != 0) {
+        pass_spp_sqrt--;
+    }
+    const int passes = total_spp / (pass_spp_sqrt * pass_spp_sqrt);
+    if (passes != config.passes) {
+        printf("Progressive photon mapping: %d passes of %d spp\n", passes, pass_spp_sqrt * pass_spp_sqrt);
+    }
+
+    float radius_sq = config.radius * config.radius;
+    for (int pass = 0; pass < passes; pass++) {
+        gather_radius = std::sqrt(radius_sq);
+        buildPhotonMap(pass);
+        renderPass(pass, pass_spp_sqrt, accum);
+        // r_{i+1}^2 = r_i^2 * (i + alpha) / (i + 1), with i starting at 1
+        radius_sq *= (static_cast<float>(pass + 1) + config.alpha) / static_cast<float>(pass + 2);
+    }
+
+    writePixels(accum);
+}
+
+void PhotonMappingIntegrator::buildPhotonMap(int pass) const {
+    auto start = std::chrono::steady_clock::now();
+
+    const int num_photons = config.num_photons;
+    const std::shared_ptr<Light> &light = scene->getLight();
+    const Vec3f light_normal = light->getNormal();
+    // the light emits uniformly over its area, pdf is constant
+    const float area_pdf = light->pdf(Interaction(), light_normal);
+    // used to sample cosine-weighted emission directions
+    const IdealDiffusion lambert(Vec3f(1, 1, 1));
+
+    // every thread collects its own photons, merged afterwards
+    std::vector<std::vector<Photon>> thread_photons(omp_get_max_threads());
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int i = 0; i < num_photons; i++) {
+        std::vector<Photon> &photons = thread_photons[omp_get_thread_num()];
+        Sampler sampler;
+        // (in 64 bits, the photons of all passes exceed the int range)
+        sampler.setSeed(static_cast<uint64_t>(pass) * num_photons + i);
+
+        // sample a position on the light and a cosine-weighted direction around its normal
+        Interaction emit;
+        emit.normal = light_normal;
+        Vec3f pos = light->sample(emit, nullptr, sampler);
+        Vec3f dir = lambert.sample(emit, sampler);
+        // Le * cos / (pdf_area * cos / pi) / N
+        Vec3f power = light->emission(pos, -light_normal) * PI / (area_pdf * static_cast<float>(num_photons));
+
+        Ray ray(pos, dir);
+        // photons of a blurred scene are spread over the shutter interval
+        ray.time = camera->sampleTime(sampler);
+        for (int bounce = 0; bounce < max_depth; bounce++) {
+            Interaction interaction;
+            scene->intersect(ray, interaction);
+            if (interaction.type != Interaction::GEOMETRY) {
+                break;
+            }
+            interaction.wo = -ray.direction;
+
+            bool alive = std::visit(
+                [&](const auto &bsdf) {
+                    // Direct illumination is computed by light sampling, so only indirect photons are stored
+                    if (!bsdf.isDelta() && bounce > 0) {
+                        photons.push_back(Photon{interaction.pos, power, interaction.wo});
+                    }
+
+                    Vec3f wi = bsdf.sample(interaction, sampler);
+                    Vec3f weight;
+                    if (bsdf.isDelta()) {
+                        weight = bsdf.evaluate(interaction);
+                    } else {
+                        float pdf = bsdf.pdf(interaction);
+                        if (pdf <= 0) {
+                            return false;
+                        }
+                        weight = bsdf.evaluate(interaction) * std::abs(wi.dot(interaction.normal)) / pdf;
+                    }
+
+                    // Russian roulette keeps the photon power roughly constant
+                    float survive = std::min(1.f, weight.maxCoeff());
+                    if (survive <= 0 || sampler.get1D() >= survive) {
+                        return false;
+                    }
+                    power = power.cwiseProduct(weight) / survive;
+                    Ray next(interaction.pos, wi);
+                    next.continuePath(ray, interaction.dist);
+                    ray = next;
+                    return true;
+                },
+                scene->getMaterial(interaction.material_id));
+            if (!alive) {
+                break;
+            }
+        }
+    }
+
+    std::vector<Photon> photons;
+    size_t total = 0;
+    for (const auto &p : thread_photons) total += p.size();
+    photons.reserve(total);
+    for (auto &p : thread_photons) {
+        photons.insert(photons.end(), p.begin(), p.end());
+        std::vector<Photon>().swap(p);
+    }
+    photon_map.build(std::move(photons));
+
+    auto end = std::chrono::steady_clock::now();
+    printf("\rPhoton map (pass %d): %zu photons stored, %.2f MB, radius %.4f, built in %lld ms\n", pass,
+           photon_map.size(), static_cast<double>(photon_map.memoryFootprint()) / (1024.0 * 1024.0), gather_radius,
+           static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()));
+}
+
+Vec3f PhotonMappingIntegrator::radiance(Ray &ray, Sampler &sampler, int depth, FeatureSample *features) const {
+    if (depth >= max_depth) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    Interaction interaction;
+    scene->intersect(ray, interaction);
+    // the features are only carried on behind delta BSDFs
+    if (features && !recordFeatures(*features, ray, interaction, depth)) {
+        features = nullptr;
+    }
+    switch (interaction.type) {
+        case Interaction::NONE: {
+            if (scene->getEnvLight()) {
+                return scene->getEnvLight()->emission(ray.direction);
+            }
+            return {0.f, 0.f, 0.f};
+        }
+        // only reached by camera rays and after delta bounces
+        case Interaction::LIGHT: {
+            STATS_INC(PATH_VERTICES);
+            return scene->getLight()->emission(interaction.normal, ray.direction);
+        }
+        case Interaction::GEOMETRY: {
+            STATS_INC(PATH_VERTICES);
+            return std::visit(
+                [&](const auto &bsdf) { return shade(bsdf, ray, interaction, sampler, depth, features); },
+                scene->getMaterial(interaction.material_id));
+        }
+        default: {
+            return {0.f, 0.f, 0.f};
+        }
+    }
+}
+
+template <typename BSDFType>
+Vec3f PhotonMappingIntegrator::shade(const BSDFType &bsdf, Ray &ray, Interaction &interaction, Sampler &sampler,
+                                     int depth, FeatureSample *features) const {
+    interaction.wo = -ray.direction.normalized();
+
+    // follow specular paths, the photon map can not be evaluated for delta BSDFs
+    if (bsdf.isDelta()) {
+        Vec3f wi = bsdf.sample(interaction, sampler);
+        Ray nextRay(interaction.pos, wi);
+        nextRay.continuePath(ray, interaction.dist);
+        const Vec3f f = bsdf.evaluate(interaction);
+        if (features) {
+            features->throughput = features->throughput.cwiseProduct(f);
+        }
+        return f.cwiseProduct(radiance(nextRay, sampler, depth + 1, features));
+    }
+
+    return directLighting(interaction, sampler) + estimateIndirect(bsdf, interaction);
+}
+
+template <typename BSDFType>
+Vec3f PhotonMappingIntegrator::estimateIndirect(const BSDFType &bsdf, Interaction &interaction) const {
+    Vec3f L(0, 0, 0);
+
+    // Progressive photon mapping gathers within the radius of the current pass
+    if (progressive) {
+        photon_map.forEachInRadius(interaction.pos, gather_radius, [&](const Photon &photon) {
+            interaction.wi = photon.wi;
+            L += bsdf.evaluate(interaction).cwiseProduct(photon.power);
+        });
+        return L / (PI * gather_radius * gather_radius);
+    }
+
+    // Otherwise the radius adapts to the k nearest photons
+    thread_local std::vector<std::pair<float, int>> nearest;
+    photon_map.kNearest(interaction.pos, config.k_nearest, gather_radius * gather_radius, nearest);
+    if (nearest.empty()) {
+        return L;
+    }
+    for (const auto &[dist_sq, index] : nearest) {
+        interaction.wi = photon_map[index].wi;
+        L += bsdf.evaluate(interaction).cwiseProduct(photon_map[index].power);
+    }
+    // the farthest photon is on top of the heap
+    return L / (PI * nearest.front().first);
+}
@@ -0,0 +1,88 @@
+#include "photon_map.h"
+
+#include <algorithm>
+
+// ranges with less photons than this are built sequentially
+constexpr int PARALLEL_BUILD_THRESHOLD = 4096;
+
+void PhotonMap::build(std::vector<Photon> new_photons) {
+    photons = std::move(new_photons);
+    photons.shrink_to_fit();
+
+    #pragma omp parallel default(none)
+    #pragma omp single nowait
+    buildRange(0, static_cast<int>(photons.size()));
+}
+
+void PhotonMap::buildRange(int first, int last) {
+    if (last - first <= 1) {
+        return;
+    }
+
+    // split along the axis of largest extent
+    Vec3f low = photons[first].pos, high = photons[first].pos;
+    for (int i = first + 1; i < last; i++) {
+        low = low.cwiseMin(photons[i].pos);
+        high = high.cwiseMax(photons[i].pos);
+    }
+    int axis;
+    (high - low).maxCoeff(&axis);
+
+    int mid = (first + last) / 2;
+    std::nth_element(photons.begin() + first, photons.begin() + mid, photons.begin() + last,
+                     [axis](const Photon &a, const Photon &b) { return a.pos[axis] < b.pos[axis]; });
+    photons[mid].axis = static_cast<uint8_t>(axis);
+
+    // the two halves are disjoint, so they can be built concurrently
+    if (last - first > PARALLEL_BUILD_THRESHOLD) {
+        #pragma omp task firstprivate(first, mid)
+        buildRange(first, mid);
+        buildRange(mid + 1, last);
+        #pragma omp taskwait
+    } else {
+        buildRange(first, mid);
+        buildRange(mid + 1, last);
+    }
+}
+
+void PhotonMap::kNearest(const Vec3f &pos, int k, float max_dist_sq, std::vector<std::pair<float, int>> &nearest) const {
+    nearest.clear();
+    if (!photons.empty() && k > 0) {
+        kNearest(pos, k, max_dist_sq, 0, static_cast<int>(photons.size()), nearest);
+    }
+}
+
+void PhotonMap::kNearest(const Vec3f &pos, int k, float &max_dist_sq, int first, int last,
+                         std::vector<std::pair<float, int>> &nearest) const {
+    while (first < last) {
+        int mid = (first + last) / 2;
+        const Photon &p = photons[mid];
+        float diff = pos[p.axis] - p.pos[p.axis];
+
+        // visit the side containing pos first, it is more likely to shrink the search radius
+        int near_first = diff < 0 ? first : mid + 1;
+        int near_last = diff < 0 ? mid : last;
+        kNearest(pos, k, max_dist_sq, near_first, near_last, nearest);
+
+        float dist_sq = (p.pos - pos).squaredNorm();
+        if (dist_sq < max_dist_sq) {
+            nearest.emplace_back(dist_sq, mid);
+            std::push_heap(nearest.begin(), nearest.end());
+            if (static_cast<int>(nearest.size()) > k) {
+                std::pop_heap(nearest.begin(), nearest.end());
+                nearest.pop_back();
+            }
+            // once k photons are found, only closer ones are of interest
+            if (static_cast<int>(nearest.size()) == k) {
+                max_dist_sq = nearest.front().first;
+            }
+        }
+
+        // the far side only matters if it is closer than the current search radius
+        if (diff * diff >= max_dist_sq) {
+            return;
+        }
+        first = diff < 0 ? mid + 1 : first;
+        last = diff < 0 ? last : mid;
+    }
+}
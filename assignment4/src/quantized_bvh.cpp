@@ -0,0 +1,186 @@
+#include "quantized_bvh.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+constexpr int WIDTH = 4;
+// traversal stack entries, at most WIDTH - 1 are pushed per level
+constexpr int STACK_SIZE = 256;
+
+float surfaceArea(const AABB &box) {
+    Vec3f d = box.upper_bnd - box.low_bnd;
+    return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+}
+
+bool isLeaf(const BVHNode *node) {
+    return !node->left && !node->right;
+}
+
+// Set the quantization grid of the node to the bounds of its children and quantize them. The
+// grid has a power of two cell size per axis, such that 255 cells cover the extent.
+void quantize(QuantizedBVHNode &quantized, const BVHNode *const children[], int count) {
+    AABB box = children[0]->aabb;
+    for (int i = 1; i < count; i++) {
+        box.merge(children[i]->aabb);
+    }
+    for (int a = 0; a < 3; a++) {
+        const float low = box.low_bnd[a], high = box.upper_bnd[a];
+        const float extent = high - low;
+        float scale = extent > 0 ? std::ldexp(1.f, std::ilogb(extent / 255.f) + 1) : 1.f;
+        while (low + 255.f * scale < high) scale *= 2;
+        quantized.origin[a] = low;
+        quantized.scale[a] = scale;
+
+        for (int i = 0; i < count; i++) {
+            const float child_low = children[i]->aabb.low_bnd[a], child_high = children[i]->aabb.upper_bnd[a];
+            // Round outwards, and check against the decoded value to absorb the rounding of
+            // origin + q * scale
+            int q_low = std::clamp(static_cast<int>(std::floor((child_low - low) / scale)), 0, 255);
+            int q_high = std::clamp(static_cast<int>(std::ceil((child_high - low) / scale)), 0, 255);
+            while (q_low > 0 && low + static_cast<float>(q_low) * scale > child_low) q_low--;
+            while (q_high < 255 && low + static_cast<float>(q_high) * scale < child_high) q_high++;
+            quantized.low[a][i] = static_cast<uint8_t>(q_low);
+            quantized.high[a][i] = static_cast<uint8_t>(q_high);
+        }
+    }
+    std::fill(quantized.child, quantized.child + WIDTH, QuantizedBVHNode::EMPTY);
+}
+
+}  // namespace
+
+void QuantizedBVH::build(const BVHNode *root) {
+    nodes.clear();
+    max_depth = 0;
+    if (!root) {
+        return;
+    }
+    if (isLeaf(root)) {
+        // a single leaf still needs a node for its bounds
+        QuantizedBVHNode node{};
+        quantize(node, &root, 1);
+        node.child[0] = encodeLeaf(root);
+        nodes.push_back(node);
+        return;
+    }
+    collapse(root, 1);
+    if ((WIDTH - 1) * max_depth >= STACK_SIZE) {
+        std::cerr << "The BVH is too deep for the quantized BVH traversal. Exit." << std::endl;
+        exit(-1);
+    }
+}
+
+uint32_t QuantizedBVH::encodeLeaf(const BVHNode *leaf) {
+    const int count = leaf->end - leaf->start + 1;
+    if (leaf->start >= (1 << 28) || count > 8) {
+        std::cerr << "Too many triangles for the quantized BVH leaf encoding. Exit." << std::endl;
+        exit(-1);
+    }
+    return QuantizedBVHNode::LEAF_BIT | (static_cast<uint32_t>(leaf->start) << 3) | static_cast<uint32_t>(count - 1);
+}
+
+uint32_t QuantizedBVH::collapse(const BVHNode *node, int depth) {
+    max_depth = std::max(max_depth, depth);
+
+    // Open the internal child of largest surface area until there are WIDTH children
+    const BVHNode *children[WIDTH] = {node->left, node->right};
+    int count = 2;
+    while (count < WIDTH) {
+        int best = -1;
+        for (int i = 0; i < count; i++) {
+            if (!isLeaf(children[i]) && (best < 0 || surfaceArea(children[i]->aabb) > surfaceArea(children[best]->aabb))) {
+                best = i;
+            }
+        }
+        if (best < 0) break;
+        const BVHNode *opened = children[best];
+        children[best] = opened->left;
+        children[count++] = opened->right;
+    }
+
+    QuantizedBVHNode quantized{};
+    quantize(quantized, children, count);
+
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(quantized);
+    for (int i = 0; i < count; i++) {
+        uint32_t child = isLeaf(children[i]) ? encodeLeaf(children[i]) : collapse(children[i], depth + 1);
+        // (the vector may have grown during the recursion)
+        nodes[index].child[i] = child;
+    }
+    return index;
+}
+
+bool QuantizedBVH::intersect(const Ray &ray, HitRecord &hit, const std::vector<Triangle> &triangles) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    const SlabRay slab_ray(ray);
+
+    struct Entry {
+        uint32_t child;
+        float t_in;
+    };
+    Entry stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = {0, ray.t_min};
+    bool found = false;
+    // counted locally and added once per ray
+    int nodes_visited = 0, triangle_tests = 0;
+
+    while (stack_size > 0) {
+        const Entry entry = stack[--stack_size];
+        // farther than the closest hit found since it was pushed
+        if (entry.t_in > hit.t) {
+            continue;
+        }
+
+        if (entry.child & QuantizedBVHNode::LEAF_BIT) {
+            const int start = static_cast<int>((entry.child & ~QuantizedBVHNode::LEAF_BIT) >> 3);
+            const int count = static_cast<int>(entry.child & 7) + 1;
+            triangle_tests += count;
+            for (int i = start; i < start + count; i++) {
+                found |= triangles[i].intersect(ray, hit, i);
+            }
+            continue;
+        }
+
+        const QuantizedBVHNode &node = nodes[entry.child];
+        nodes_visited++;
+
+        // Decode the 4 child boxes (the loops vectorize) and test them together
+        alignas(16) float low[3][WIDTH], high[3][WIDTH];
+        for (int a = 0; a < 3; a++) {
+            for (int i = 0; i < WIDTH; i++) {
+                // decoded exactly like in quantize, so that the boxes stay conservative
+                low[a][i] = node.origin[a] + static_cast<float>(node.low[a][i]) * node.scale[a];
+                high[a][i] = node.origin[a] + static_cast<float>(node.high[a][i]) * node.scale[a];
+            }
+        }
+        float t_in[WIDTH];
+        const int hit_mask = intersectBoxes4(slab_ray, low, high, ray.t_min, std::min(ray.t_max, hit.t), t_in);
+
+        // Push the hit children so that the nearest one is popped first
+        Entry hits[WIDTH];
+        int num_hits = 0;
+        for (int i = 0; i < WIDTH && node.child[i] != QuantizedBVHNode::EMPTY; i++) {
+            if (hit_mask >> i & 1) {
+                int j = num_hits++;
+                while (j > 0 && hits[j - 1].t_in < t_in[i]) {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j] = {node.child[i], t_in[i]};
+            }
+        }
+        for (int i = 0; i < num_hits; i++) {
+            stack[stack_size++] = hits[i];
+        }
+    }
+    STATS_ADD(BVH_NODES_VISITED, nodes_visited);
+    STATS_ADD(TRIANGLE_TESTS, triangle_tests);
+    return found;
+}
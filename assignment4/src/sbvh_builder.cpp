@@ -0,0 +1,361 @@
+#include "sbvh_builder.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr int MAX_LEAF_SIZE = 8;
+// past this depth only object splits (and median splits) are made, so that the tree stays
+// shallow enough for the traversal stacks
+constexpr int MAX_SPATIAL_DEPTH = 48;
+constexpr int MAX_SAH_DEPTH = 64;
+// SAH costs of a node traversal and of a triangle test
+constexpr float TRAVERSAL_COST = 1.f;
+constexpr float TRIANGLE_COST = 1.f;
+
+AABB emptyBox() {
+    const float inf = std::numeric_limits<float>::infinity();
+    return {Vec3f(inf, inf, inf), Vec3f(-inf, -inf, -inf)};
+}
+
+bool isEmpty(const AABB &box) {
+    return (box.upper_bnd.array() < box.low_bnd.array()).any();
+}
+
+float surfaceArea(const AABB &box) {
+    if (isEmpty(box)) return 0;
+    Vec3f d = box.upper_bnd - box.low_bnd;
+    return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+AABB intersection(const AABB &a, const AABB &b) {
+    return {a.low_bnd.cwiseMax(b.low_bnd), a.upper_bnd.cwiseMin(b.upper_bnd)};
+}
+
+void grow(AABB &box, const Vec3f &point) {
+    box.low_bnd = box.low_bnd.cwiseMin(point);
+    box.upper_bnd = box.upper_bnd.cwiseMax(point);
+}
+
+}  // namespace
+
+SBVHBuilder::SBVHBuilder(std::vector<Triangle> &triangles, const Config::SBVHConfig &config)
+    : triangles(triangles), config(config) {
+    // the sweeps need two bins at least
+    this->config.bins = std::max(2, config.bins);
+}
+
+BVHNode *SBVHBuilder::build() {
+    std::vector<Reference> refs;
+    refs.reserve(triangles.size());
+    AABB box = emptyBox();
+    bool moving = false;
+    for (int i = 0; i < static_cast<int>(triangles.size()); i++) {
+        refs.push_back({i, triangles[i].aabb});
+        box.merge(triangles[i].aabb);
+        moving = moving || !triangles[i].motion.isZero();
+    }
+    root_area = surfaceArea(box);
+    num_references = refs.size();
+    max_references = static_cast<size_t>(static_cast<double>(refs.size()) * (1.0 + config.max_duplication));
+    // The clipped bounds of a moving triangle can not be interpolated between the keyframes, a
+    // scene with motion only gets object splits
+    if (moving) {
+        max_references = refs.size();
+    }
+    spatial_splits = 0;
+    leaf_triangles.clear();
+    leaf_triangles.reserve(refs.size());
+
+    BVHNode *root = buildNode(refs, box, 0);
+    triangles.swap(leaf_triangles);
+    std::vector<Triangle>().swap(leaf_triangles);
+    return root;
+}
+
+BVHNode *SBVHBuilder::buildNode(std::vector<Reference> &refs, const AABB &box, int depth) {
+    const int count = static_cast<int>(refs.size());
+    if (count <= 1) {
+        return makeLeaf(refs, box);
+    }
+
+    Split split;
+    if (depth < MAX_SAH_DEPTH) {
+        split = findObjectSplit(refs);
+        // Try a spatial split when the children of the object split overlap significantly
+        if (depth < MAX_SPATIAL_DEPTH && num_references < max_references && split.axis >= 0) {
+            float overlap = surfaceArea(intersection(split.left, split.right));
+            if (overlap > config.alpha * root_area) {
+                Split spatial = findSpatialSplit(refs, box);
+                if (spatial.cost < split.cost) split = spatial;
+            }
+        }
+    }
+
+    // A leaf if it is small enough and cheaper than the split
+    const float area = surfaceArea(box);
+    const float leaf_cost = TRIANGLE_COST * static_cast<float>(count);
+    const float split_cost = area > 0 ? TRAVERSAL_COST + TRIANGLE_COST * split.cost / area : leaf_cost;
+    if (count <= MAX_LEAF_SIZE && (split.axis < 0 || leaf_cost <= split_cost)) {
+        return makeLeaf(refs, box);
+    }
+
+    std::vector<Reference> left, right;
+    if (split.axis < 0) {
+        // no usable split (identical centroids, or too deep): split the list in the middle
+        left.assign(refs.begin(), refs.begin() + count / 2);
+        right.assign(refs.begin() + count / 2, refs.end());
+    } else if (split.spatial) {
+        partitionSpatial(refs, split, left, right);
+    } else {
+        partitionObject(refs, split, left, right);
+    }
+    std::vector<Reference>().swap(refs);
+
+    AABB left_box = emptyBox(), right_box = emptyBox();
+    for (const Reference &ref : left) left_box.merge(ref.box);
+    for (const Reference &ref : right) right_box.merge(ref.box);
+    BVHNode *left_node = buildNode(left, left_box, depth + 1);
+    BVHNode *right_node = buildNode(right, right_box, depth + 1);
+
+    auto *node = new BVHNode();
+    node->aabb = box;
+    node->left = left_node;
+    node->right = right_node;
+    node->size = left_node->size + right_node->size + 1;
+    return node;
+}
+
+BVHNode *SBVHBuilder::makeLeaf(const std::vector<Reference> &refs, const AABB &box) {
+    auto *node = new BVHNode();
+    node->aabb = box;
+    node->start = static_cast<int>(leaf_triangles.size());
+    for (const Reference &ref : refs) {
+        leaf_triangles.push_back(triangles[ref.triangle]);
+    }
+    node->end = static_cast<int>(leaf_triangles.size()) - 1;
+    node->size = 1;
+    return node;
+}
+
+SBVHBuilder::Split SBVHBuilder::findObjectSplit(const std::vector<Reference> &refs) const {
+    const int num_bins = config.bins;
+    AABB centroid_box = emptyBox();
+    for (const Reference &ref : refs) {
+        grow(centroid_box, ref.box.getCenter());
+    }
+
+    Split best;
+    std::vector<AABB> bin_boxes(num_bins), right_boxes(num_bins);
+    std::vector<int> bin_counts(num_bins);
+    for (int axis = 0; axis < 3; axis++) {
+        const float low = centroid_box.low_bnd[axis];
+        const float extent = centroid_box.getDist(axis);
+        if (!(extent > 0)) continue;
+        const float scale = static_cast<float>(num_bins) / extent;
+        const auto binOf = [&](const Reference &ref) {
+            return std::min(num_bins - 1, static_cast<int>((ref.box.getCenter()[axis] - low) * scale));
+        };
+
+        std::fill(bin_boxes.begin(), bin_boxes.end(), emptyBox());
+        std::fill(bin_counts.begin(), bin_counts.end(), 0);
+        for (const Reference &ref : refs) {
+            int bin = binOf(ref);
+            bin_boxes[bin].merge(ref.box);
+            bin_counts[bin]++;
+        }
+
+        // Sweep from the right for the suffix bounds, then from the left for the costs
+        AABB right_box = emptyBox();
+        for (int b = num_bins - 1; b > 0; b--) {
+            right_box.merge(bin_boxes[b]);
+            right_boxes[b] = right_box;
+        }
+        AABB left_box = emptyBox();
+        int left_count = 0;
+        for (int b = 1; b < num_bins; b++) {
+            left_box.merge(bin_boxes[b - 1]);
+            left_count += bin_counts[b - 1];
+            const int right_count = static_cast<int>(refs.size()) - left_count;
+            if (left_count == 0 || right_count == 0) continue;
+            float cost = surfaceArea(left_box) * static_cast<float>(left_count) +
+                         surfaceArea(right_boxes[b]) * static_cast<float>(right_count);
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = low + static_cast<float>(b) / scale;
+                best.left = left_box;
+                best.right = right_boxes[b];
+                best.left_count = left_count;
+                best.right_count = right_count;
+            }
+        }
+    }
+    return best;
+}
+
+SBVHBuilder::Split SBVHBuilder::findSpatialSplit(const std::vector<Reference> &refs, const AABB &box) const {
+    const int num_bins = config.bins;
+    Split best;
+    best.spatial = true;
+    std::vector<AABB> bin_boxes(num_bins), right_boxes(num_bins);
+    // references starting and ending in every bin
+    std::vector<int> entries(num_bins), exits(num_bins);
+
+    for (int axis = 0; axis < 3; axis++) {
+        const float low = box.low_bnd[axis];
+        const float extent = box.getDist(axis);
+        if (!(extent > 0)) continue;
+        const float width = extent / static_cast<float>(num_bins);
+        const auto binOf = [&](float x) {
+            return std::clamp(static_cast<int>((x - low) / width), 0, num_bins - 1);
+        };
+
+        std::fill(bin_boxes.begin(), bin_boxes.end(), emptyBox());
+        std::fill(entries.begin(), entries.end(), 0);
+        std::fill(exits.begin(), exits.end(), 0);
+        for (const Reference &ref : refs) {
+            const int first = binOf(ref.box.low_bnd[axis]);
+            const int last = binOf(ref.box.upper_bnd[axis]);
+            // Chop the triangle at every bin boundary it crosses
+            Reference current = ref;
+            for (int b = first; b < last; b++) {
+                Reference left, right;
+                splitReference(current, axis, low + static_cast<float>(b + 1) * width, left, right);
+                bin_boxes[b].merge(left.box);
+                current = right;
+            }
+            bin_boxes[last].merge(current.box);
+            entries[first]++;
+            exits[last]++;
+        }
+
+        AABB right_box = emptyBox();
+        for (int b = num_bins - 1; b > 0; b--) {
+            right_box.merge(bin_boxes[b]);
+            right_boxes[b] = right_box;
+        }
+        AABB left_box = emptyBox();
+        int left_count = 0, right_count = static_cast<int>(refs.size());
+        for (int b = 1; b < num_bins; b++) {
+            left_box.merge(bin_boxes[b - 1]);
+            left_count += entries[b - 1];
+            right_count -= exits[b - 1];
+            if (left_count == 0 || right_count == 0) continue;
+            float cost = surfaceArea(left_box) * static_cast<float>(left_count) +
+                         surfaceArea(right_boxes[b]) * static_cast<float>(right_count);
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = low + static_cast<float>(b) * width;
+                best.left = left_box;
+                best.right = right_boxes[b];
+                best.left_count = left_count;
+                best.right_count = right_count;
+            }
+        }
+    }
+    return best;
+}
+
+void SBVHBuilder::partitionObject(std::vector<Reference> &refs, const Split &split, std::vector<Reference> &left,
+                                  std::vector<Reference> &right) const {
+    for (const Reference &ref : refs) {
+        (ref.box.getCenter()[split.axis] < split.position ? left : right).push_back(ref);
+    }
+    // the binning and this test may disagree on a centroid right at the boundary
+    if (left.empty() || right.empty()) {
+        std::vector<Reference> all = std::move(left.empty() ? right : left);
+        left.assign(all.begin(), all.begin() + static_cast<long>(all.size() / 2));
+        right.assign(all.begin() + static_cast<long>(all.size() / 2), all.end());
+    }
+}
+
+void SBVHBuilder::partitionSpatial(std::vector<Reference> &refs, const Split &split, std::vector<Reference> &left,
+                                   std::vector<Reference> &right) {
+    const int axis = split.axis;
+    AABB left_box = split.left, right_box = split.right;
+    int left_count = split.left_count, right_count = split.right_count;
+    std::vector<Reference> straddling;
+    for (const Reference &ref : refs) {
+        if (ref.box.upper_bnd[axis] <= split.position) {
+            left.push_back(ref);
+        } else if (ref.box.low_bnd[axis] >= split.position) {
+            right.push_back(ref);
+        } else {
+            straddling.push_back(ref);
+        }
+    }
+
+    for (const Reference &ref : straddling) {
+        // Unsplitting: keep the whole reference on one side if that is cheaper than duplicating it
+        const float split_cost = surfaceArea(left_box) * static_cast<float>(left_count) +
+                                 surfaceArea(right_box) * static_cast<float>(right_count);
+        const AABB left_grown(left_box, ref.box), right_grown(right_box, ref.box);
+        const float left_only = surfaceArea(left_grown) * static_cast<float>(left_count) +
+                                surfaceArea(right_box) * static_cast<float>(right_count - 1);
+        const float right_only = surfaceArea(left_box) * static_cast<float>(left_count - 1) +
+                                 surfaceArea(right_grown) * static_cast<float>(right_count);
+
+        if (left_only < split_cost && left_only <= right_only) {
+            left.push_back(ref);
+            left_box = left_grown;
+            right_count--;
+        } else if (right_only < split_cost || num_references >= max_references) {
+            // (over the duplication budget, the reference goes to the cheaper side)
+            if (right_only <= left_only) {
+                right.push_back(ref);
+                right_box = right_grown;
+                left_count--;
+            } else {
+                left.push_back(ref);
+                left_box = left_grown;
+                right_count--;
+            }
+        } else {
+            Reference left_ref, right_ref;
+            splitReference(ref, axis, split.position, left_ref, right_ref);
+            // (a part may be empty when the triangle only touches the plane)
+            if (isEmpty(left_ref.box)) {
+                right.push_back(ref);
+            } else if (isEmpty(right_ref.box)) {
+                left.push_back(ref);
+            } else {
+                left.push_back(left_ref);
+                right.push_back(right_ref);
+                num_references++;
+            }
+        }
+    }
+    spatial_splits++;
+}
+
+void SBVHBuilder::splitReference(const Reference &ref, int axis, float position, Reference &left,
+                                 Reference &right) const {
+    const Triangle &triangle = triangles[ref.triangle];
+    const Vec3f *vertices[3] = {&triangle.v0, &triangle.v1, &triangle.v2};
+    AABB left_box = emptyBox(), right_box = emptyBox();
+
+    // Walk the edges: vertices go to their side, and edges crossing the plane add their
+    // intersection point to both sides
+    for (int i = 0; i < 3; i++) {
+        const Vec3f &v0 = *vertices[i];
+        const Vec3f &v1 = *vertices[(i + 1) % 3];
+        const float p0 = v0[axis], p1 = v1[axis];
+        if (p0 <= position) grow(left_box, v0);
+        if (p0 >= position) grow(right_box, v0);
+        if ((p0 < position && position < p1) || (p1 < position && position < p0)) {
+            Vec3f point = v0 + (v1 - v0) * std::clamp((position - p0) / (p1 - p0), 0.f, 1.f);
+            point[axis] = position;
+            grow(left_box, point);
+            grow(right_box, point);
+        }
+    }
+
+    left.triangle = right.triangle = ref.triangle;
+    left.box = intersection(left_box, ref.box);
+    right.box = intersection(right_box, ref.box);
+    left.box.upper_bnd[axis] = std::min(left.box.upper_bnd[axis], position);
+    right.box.low_bnd[axis] = std::max(right.box.low_bnd[axis], position);
+}
@@ -1,9 +1,22 @@
 #include "scene.h"
 #include "load_obj.h"
+#include "sbvh_builder.h"
+#include "treelet_optimizer.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <iostream>
+#include <queue>
+
+// child pairs of the linear BVH per layout block, 64 pairs of 64 bytes fill a 4 KiB page
+constexpr int LAYOUT_BLOCK_PAIRS = 64;
 
 void Scene::addObject(std::shared_ptr<TriangleMesh> &mesh) {
+    // the out-of-core objects are not kept in memory, they are staged right away
+    if (accel == AccelType::OUT_OF_CORE && !chunked_geometry) {
+        stage(*mesh);
+        return;
+    }
     objects.push_back(mesh);
 }
 
@@ -11,44 +24,99 @@ void Scene::setLight(const std::shared_ptr<Light> &new_light) {
     light = new_light;
 }
 
+int Scene::addMaterial(const BSDF &material, int texture) {
+    materials.push_back(material);
+    material_textures.push_back(texture);
+    return (int) materials.size() - 1;
+}
+
+AABB Scene::getAABB() const {
+    AABB box;
+    if (has_scene_aabb) {
+        box = scene_aabb;
+    } else if (!objects.empty()) {
+        box = objects[0]->getAABB();
+    }
+    for (const std::shared_ptr<TriangleMesh> &object : objects) {
+        box.merge(object->getAABB());
+    }
+    return box;
+}
+
 bool Scene::isShadowed(Ray &shadow_ray) {
+    STATS_INC(SHADOW_RAYS);
     Interaction in;
-    return intersect(shadow_ray, in) && in.type == Interaction::Type::GEOMETRY;
+    return intersectClosest(shadow_ray, in) && in.type == Interaction::Type::GEOMETRY;
 }
 
 bool Scene::intersect(Ray &ray, Interaction &interaction) {
+    interaction.time = ray.time;
+    if (!intersectClosest(ray, interaction)) {
+        return false;
+    }
+    if (interaction.type == Interaction::GEOMETRY && material_textures[interaction.material_id] >= 0) {
+        // Footprint of the ray cone at the hit, stretched at grazing angles, mapped to uv units.
+        // It selects the mip levels, in the spirit of ray differentials.
+        const float cos_theta = std::max(std::abs(interaction.normal.dot(ray.direction)), 1e-3f);
+        const float width = (ray.cone_width + ray.cone_spread * interaction.dist) / cos_theta;
+        interaction.texture = textures->lookup(material_textures[interaction.material_id], interaction.uv,
+                                               width * interaction.uv_density);
+    }
+    return true;
+}
 
-    #ifdef USE_GLOBAL_BVH
-    /* With-BVH acceleration structure implementation.*/
-    // Check intersection with BVH, not with each object.
-    if (bvh_root != nullptr) {
+bool Scene::intersectClosest(Ray &ray, Interaction &interaction) {
+    STATS_INC(RAYS);
+    return (this->*intersect_accel)(ray, interaction);
+}
+
+void Scene::setAccel(AccelType new_accel) {
+    accel = new_accel;
+    switch (accel) {
+        case AccelType::NONE: intersect_accel = &Scene::intersectWith<AccelType::NONE>; break;
+        case AccelType::BVH: intersect_accel = &Scene::intersectWith<AccelType::BVH>; break;
+        case AccelType::OUT_OF_CORE: intersect_accel = &Scene::intersectWith<AccelType::OUT_OF_CORE>; break;
+        case AccelType::QUANTIZED_BVH: intersect_accel = &Scene::intersectWith<AccelType::QUANTIZED_BVH>; break;
+        default: intersect_accel = &Scene::intersectWith<AccelType::LINEAR_BVH>; break;
+    }
+}
+
+template <AccelType accel_type>
+bool Scene::intersectWith(Ray &ray, Interaction &interaction) {
+    if constexpr (accel_type == AccelType::NONE) {
+        /* Ordinary implementation (without BVH acceleration). */
+        // Traverse each object (TriangleMesh) in the scene.
+        // (a mesh only updates the interaction with a closer hit)
         light->intersect(ray, interaction);
-        #ifdef USE_LINEARIZED_BVH
-        return LinearBVHHit(ray, interaction);
-        #else 
-        return bvhHit(ray, interaction, bvh_root);
-        #endif
-    }
-
-    // We must have a BVH here! If no BVH, there must be an error!
-    assert(false);
-    return false;
-    
-    #else 
-
-    /* Ordinary implementation (without BVH acceleration). */
-    // Traverse each object (TriangleMesh) in the scene.
-    light->intersect(ray, interaction);
-    for (const auto &obj : objects) {
-        Interaction cur_it;
-        if (obj->intersect(ray, cur_it) && (cur_it.dist < interaction.dist)) {
-            interaction = cur_it;
+        for (const auto &obj : objects) {
+            obj->intersect(ray, interaction);
+        }
+        return interaction.type != Interaction::Type::NONE;
+    } else {
+        /* With-BVH acceleration structure implementation.*/
+        // Check intersection with BVH, not with each object.
+        // We must have a BVH here! If no BVH, there must be an error!
+        // The emitters are triangles of the BVH, the traversal finds the lights with the geometry.
+        HitRecord hit;
+        if constexpr (accel_type == AccelType::BVH) {
+            assert(bvh_root != nullptr);
+            bvhHit(ray, SlabRay(ray), hit, bvh_root);
+        } else if constexpr (accel_type == AccelType::QUANTIZED_BVH) {
+            assert(!quantized_bvh.empty());
+            quantized_bvh.intersect(ray, hit, triangles);
+        } else {
+            assert(!linear_bvh_nodes.empty());
+            LinearBVHHit<accel_type == AccelType::OUT_OF_CORE>(ray, hit);
         }
+        if (hit.prim >= 0) {
+            if constexpr (accel_type == AccelType::OUT_OF_CORE) {
+                chunked_geometry->fetch(hit.prim)->fillInteraction(ray, hit, interaction);
+            } else {
+                triangles[hit.prim].fillInteraction(ray, hit, interaction);
+            }
+        }
+        return interaction.type != Interaction::Type::NONE;
     }
-    return interaction.type != Interaction::Type::NONE;
-
-    #endif
-
 }
 
 const std::shared_ptr<Light> &Scene::getLight() const {
@@ -60,19 +128,48 @@ void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene) {
     std::shared_ptr<Light> light = std::make_shared<SquareAreaLight>(
         Vec3f(config.light_config.position), Vec3f(config.light_config.radiance), Vec2f(config.light_config.size));
     scene->setLight(light);
+    // add environment light to scene.
+    if (!config.env_config.hdr_path.empty()) {
+        std::cout << "loading environment map " << config.env_config.hdr_path << std::endl;
+        scene->setEnvLight(std::make_shared<EnvironmentLight>(config.env_config.hdr_path, config.env_config.scale));
+    }
+    // load the textures, materials sharing an image share the texture.
+    std::shared_ptr<TextureStore> textures;
+    std::map<std::string, int> texture_list;
+    for (const auto &mat : config.materials) {
+        if (mat.texture.empty() || texture_list.count(mat.texture)) {
+            continue;
+        }
+        if (!textures) {
+            textures = std::make_shared<TextureStore>(config.texture_config);
+        }
+        texture_list[mat.texture] = textures->load(mat.texture);
+    }
+    if (textures) {
+        textures->finalize();
+        scene->setTextures(textures);
+    }
     // init all materials.
-    std::map<std::string, std::shared_ptr<BSDF>> mat_list;
+    std::map<std::string, int> mat_list;
     for (const auto &mat : config.materials) {
-        std::shared_ptr<BSDF> p_mat;
+        const int texture = mat.texture.empty() ? -1 : texture_list[mat.texture];
         switch (mat.type) {
             case MaterialType::DIFFUSE: {
-                p_mat = std::make_shared<IdealDiffusion>(Vec3f(mat.color));
-                mat_list[mat.name] = p_mat;
+                mat_list[mat.name] = scene->addMaterial(IdealDiffusion(Vec3f(mat.color)), texture);
                 break;
             }
             case MaterialType::SPECULAR: {
-                p_mat = std::make_shared<IdealSpecular>(Vec3f(mat.color));
-                mat_list[mat.name] = p_mat;
+                mat_list[mat.name] = scene->addMaterial(IdealSpecular(Vec3f(mat.color)), texture);
+                break;
+            }
+            case MaterialType::CONDUCTOR: {
+                mat_list[mat.name] =
+                    scene->addMaterial(MicrofacetConductor(Vec3f(mat.color), mat.roughness), texture);
+                break;
+            }
+            case MaterialType::DIELECTRIC: {
+                mat_list[mat.name] =
+                    scene->addMaterial(MicrofacetDielectric(Vec3f(mat.color), mat.roughness, mat.ior), texture);
                 break;
             }
             default: {
@@ -81,12 +178,18 @@ void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene) {
             }
         }
     }
+    // the out-of-core objects are staged as they are added, the structure is selected first
+    scene->setAccel(config.accel);
+    scene->setOutOfCoreConfig(config.out_of_core_config);
+    scene->setBVHBuilder(config.bvh_builder, config.sbvh_config, config.treelet_config);
+
     // add mesh objects to scene. Translation and scaling are directly applied to
     // vertex coordinates. then set corresponding material by name.
     std::cout << "loading obj files..." << std::endl;
     for (auto &object : config.objects) {
         auto mesh_obj = makeMeshObject(object.obj_file_path, Vec3f(object.translate), object.scale);
         mesh_obj->setMaterial(mat_list[object.material_name]);
+        mesh_obj->setMotion(Vec3f(object.translate_end) - Vec3f(object.translate));
         // We don't build a BVH for each object. Instead, we build a global BVH.
         // Therefore, the following sentence is commented.
         // if (object.has_bvh) {
@@ -95,17 +198,26 @@ void initSceneFromConfig(const Config &config, std::shared_ptr<Scene> &scene) {
         scene->addObject(mesh_obj);
     }
 
-    #ifdef USE_GLOBAL_BVH
     // build a global BVH for the whole scene
     scene->build_global_BVH();
-    #endif
 }
 
-#ifdef USE_GLOBAL_BVH
-
 // Scene BVH construction
 
 void Scene::build_global_BVH() {
+    // brute force intersection does not need any BVH
+    if (accel == AccelType::NONE) {
+        return;
+    }
+    if (chunked_geometry) {
+        std::cerr << "The out-of-core geometry can not be rebuilt." << std::endl;
+        return;
+    }
+    if (accel == AccelType::OUT_OF_CORE) {
+        buildOutOfCore();
+        return;
+    }
+
     // Calculate the AABB large enough to hold the whole scene
     AABB scene_box;
     if (!objects.empty()) {
@@ -114,6 +226,15 @@ void Scene::build_global_BVH() {
     for (const std::shared_ptr<TriangleMesh> &object: objects) {
         scene_box.merge(object->getAABB());
     }
+    if (light) {
+        scene_box.merge(light->getMesh().getAABB());
+    }
+
+    // (the BVH may be rebuilt after adding objects)
+    deleteHierarchy(bvh_root);
+    bvh_root = nullptr;
+    linear_bvh_nodes.clear();
+    linear_bvh_end_bounds.clear();
 
     // Calculate morton code for each triangle.
     // For each triangleMesh, calculate their morton code and merge them to a large triangle vector.
@@ -125,46 +246,156 @@ void Scene::build_global_BVH() {
         // triangles.insert(triangles.end(), tmp_triangles.begin(), tmp_triangles.end());
         object->addToGlobalTriangles(triangles, scene_box);
     }
+    // the emitters are primitives of the BVH too, found by the same traversal as the geometry
+    if (light) {
+        light->getMesh().addToGlobalTriangles(triangles, scene_box);
+    }
 
-    // Sort triangles by their morton code.
-    // Lambda function is used as a comparator: [] (Triangle a, b) { return a.mortonCode > b.mortonCode }
-    std::sort(triangles.begin(), triangles.end(), [](const Triangle &a, const Triangle &b) { return a.morton_code > b.morton_code; });
+    if (bvh_builder == BVHBuilderType::SBVH) {
+        // SAH and spatial splits, the triangles are reordered (and partly duplicated) for the leaves
+        SBVHBuilder builder(triangles, sbvh_config);
+        bvh_root = builder.build();
+        std::cout << "SBVH: " << builder.numSpatialSplits() << " spatial splits, " << triangles.size()
+                  << " triangle references" << std::endl;
+    } else {
+        // Sort triangles by their morton code.
+        // Lambda function is used as a comparator: [] (Triangle a, b) { return a.mortonCode > b.mortonCode }
+        std::sort(triangles.begin(), triangles.end(), [](const Triangle &a, const Triangle &b) { return a.morton_code > b.morton_code; });
+
+        // Construct BVH
+        bvh_root = generateHierarchy(triangles, 0, (int) triangles.size() - 1);
+
+        if (bvh_builder == BVHBuilderType::TRBVH) {
+            // Lower the SAH cost of the Morton tree, the leaves stay the same
+            TreeletOptimizer optimizer(treelet_config);
+            optimizer.optimize(bvh_root);
+            std::cout << "TRBVH: SAH cost " << optimizer.initialCost() << " -> " << optimizer.finalCost() << ", "
+                      << optimizer.numRestructured() << " treelets restructured" << std::endl;
+        }
+    }
 
-    // Construct BVH
-    bvh_root = generateHierarchy(0, (int) triangles.size() - 1);
+    if (accel == AccelType::BVH) {
+        return;
+    }
+    if (accel == AccelType::QUANTIZED_BVH) {
+        quantized_bvh.build(bvh_root);
+        deleteHierarchy(bvh_root);
+        bvh_root = nullptr;
+        return;
+    }
 
-    #ifdef USE_LINEARIZED_BVH
-    // Construct linearized BVH
+    // Construct linearized BVH, the pointer-based BVH is not needed anymore
     genLinearBVH(bvh_root);
-    #endif
+    deleteHierarchy(bvh_root);
+    bvh_root = nullptr;
+
+    // With moving triangles, the nodes bound them at both keyframes instead of over the whole
+    // motion, so that a ray only visits the nodes where the geometry is at its time
+    if (std::any_of(triangles.begin(), triangles.end(), [](const Triangle &t) { return !t.motion.isZero(); })) {
+        refitMotionBounds();
+    }
+}
+
+
+void Scene::stage(const TriangleMesh &mesh) {
+    if (!stager) {
+        stager = std::make_unique<TriangleStager>(out_of_core_config.chunk_path + ".staging");
+    }
+    stager->add(mesh);
+    if (has_scene_aabb) {
+        scene_aabb.merge(mesh.getAABB());
+    } else {
+        scene_aabb = mesh.getAABB();
+        has_scene_aabb = true;
+    }
+}
+
+// Same Morton construction as build_global_BVH, on the build primitives. The triangles are
+// staged in the order build_global_BVH expands them, so both give the same hierarchy.
+void Scene::buildOutOfCore() {
+    if (bvh_builder == BVHBuilderType::SBVH) {
+        std::cerr << "The out-of-core geometry does not support the SBVH builder, the LBVH builder is used."
+                  << std::endl;
+    }
+    // objects added before the structure was selected, and the emitters last
+    for (const std::shared_ptr<TriangleMesh> &object : objects) {
+        stage(*object);
+    }
+    objects.clear();
+    if (light) {
+        stage(light->getMesh());
+    }
+    if (!stager) {
+        return;
+    }
+
+    stager->computeMortonCodes(scene_aabb);
+    std::vector<BuildPrimitive> &primitives = stager->getPrimitives();
+    std::sort(primitives.begin(), primitives.end(),
+              [](const BuildPrimitive &a, const BuildPrimitive &b) { return a.morton_code > b.morton_code; });
+    BVHNode *root = generateHierarchy(primitives, 0, (int) primitives.size() - 1);
+    if (bvh_builder == BVHBuilderType::TRBVH) {
+        TreeletOptimizer optimizer(treelet_config);
+        optimizer.optimize(root);
+        std::cout << "TRBVH: SAH cost " << optimizer.initialCost() << " -> " << optimizer.finalCost() << ", "
+                  << optimizer.numRestructured() << " treelets restructured" << std::endl;
+    }
+    genLinearBVH(root);
+    deleteHierarchy(root);
+
+    // Group the leaves (in triangle order) into chunks of at least chunk_triangles triangles
+    std::vector<int> leaf_starts;
+    for (const LinearBVHNode &node : linear_bvh_nodes) {
+        if (node.start != -1) leaf_starts.push_back(node.start);
+    }
+    std::sort(leaf_starts.begin(), leaf_starts.end());
+    std::vector<int> chunk_starts;
+    for (int start : leaf_starts) {
+        if (chunk_starts.empty() || start - chunk_starts.back() >= out_of_core_config.chunk_triangles) {
+            chunk_starts.push_back(start);
+        }
+    }
+    chunked_geometry = std::make_unique<ChunkedGeometry>(out_of_core_config.chunk_path, *stager, primitives,
+                                                         std::move(chunk_starts),
+                                                         static_cast<size_t>(out_of_core_config.cache_mb) << 20);
+    std::cout << "Geometry streamed from " << chunked_geometry->numChunks() << " chunks" << std::endl;
+    const bool has_motion = stager->hasMotion();
+    // Only the chunk file holds the triangles from now on
+    stager.reset();
+
+    if (has_motion) {
+        refitMotionBounds();
+    }
 }
 
 
 // Excerpt from: https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
 // Top-Down Hierarchy Generation
-BVHNode *Scene::generateHierarchy(const int first, const int last) {
+template <typename Primitive>
+BVHNode *Scene::generateHierarchy(const std::vector<Primitive> &primitives, const int first, const int last) {
 
     // Single object (or less than 8 object) --> Create a leaf node
     int len = last - first + 1;
     if (len >= 1 && len <= 8) {
-        return newLeafNode(first, last);
+        return newLeafNode(primitives, first, last);
     }
 
     // Determine where to split the range
-    int split = findSplit(first, last);
+    int split = findSplit(primitives, first, last);
 
     // Process the resulting sub-ranges recursively
-    BVHNode *childA = generateHierarchy(first, split);
-    BVHNode *childB = generateHierarchy(split + 1, last);
+    BVHNode *childA = generateHierarchy(primitives, first, split);
+    BVHNode *childB = generateHierarchy(primitives, split + 1, last);
     return newInternalNode(childA, childB);
 
 }
 
 // Excerpt from: https://developer.nvidia.com/blog/thinking-parallel-part-iii-tree-construction-gpu/
-int Scene::findSplit(int first, int last) {
+template <typename Primitive>
+int Scene::findSplit(const std::vector<Primitive> &primitives, int first, int last) {
     // Get morton code
-    unsigned int firstCode = triangles[first].morton_code;
-    unsigned int lastCode = triangles[last].morton_code;
+    unsigned int firstCode = primitives[first].morton_code;
+    unsigned int lastCode = primitives[last].morton_code;
 
     // Identical morton codes --> split range in the middle
     if (firstCode == lastCode) {
@@ -184,7 +415,7 @@ int Scene::findSplit(int first, int last) {
         int newSplit = split + step;  // proposed new position
 
         if (newSplit < last) {
-            unsigned int splitCode = triangles[newSplit].morton_code;
+            unsigned int splitCode = primitives[newSplit].morton_code;
             int splitPrefix = __builtin_clz(firstCode ^ splitCode);
             if (splitPrefix > commonPrefix) {
                 split = newSplit;  // accept proposal
@@ -196,14 +427,15 @@ int Scene::findSplit(int first, int last) {
 }
 
 // Create a new leaf BVH node containing triangles [start:end]
-BVHNode *Scene::newLeafNode(int start, int end) {
+template <typename Primitive>
+BVHNode *Scene::newLeafNode(const std::vector<Primitive> &primitives, int start, int end) {
     BVHNode *node = new BVHNode();
     node->start = start;
     node->end = end;
 
-    AABB aabb = triangles[start].aabb;
+    AABB aabb = primitives[start].aabb;
     for (int i = start; i <= end; i++) {
-        aabb.merge(triangles[i].aabb);
+        aabb.merge(primitives[i].aabb);
     }
     node->aabb = aabb;
 
@@ -223,77 +455,188 @@ BVHNode *Scene::newInternalNode(BVHNode *left, BVHNode *right) {
     return node;
 }
 
-#ifndef USE_LINEARIZED_BVH
+size_t Scene::accelMemoryFootprint() const {
+    switch (accel) {
+        case AccelType::BVH: return bvh_root ? bvh_root->size * sizeof(BVHNode) : 0;
+        case AccelType::LINEAR_BVH:
+        case AccelType::OUT_OF_CORE:
+            return linear_bvh_nodes.capacity() * sizeof(LinearBVHNode) +
+                   linear_bvh_end_bounds.capacity() * sizeof(AABB);
+        case AccelType::QUANTIZED_BVH: return quantized_bvh.memoryFootprint();
+        default: return 0;
+    }
+}
+
+void Scene::deleteHierarchy(BVHNode *node) {
+    if (!node) {
+        return;
+    }
+    deleteHierarchy(node->left);
+    deleteHierarchy(node->right);
+    delete node;
+}
 
 // Check intersection with the ray. Recursive function.
-bool Scene::bvhHit(Ray &ray, Interaction &interaction, BVHNode *node) {
+bool Scene::bvhHit(Ray &ray, const SlabRay &slab_ray, HitRecord &hit, BVHNode *node) {
     float t_in, t_out;
 
     // If the node is null, return false
     if (!node) {
         return false;
     }
+    STATS_INC(BVH_NODES_VISITED);
 
     // If the ray does not intersect with the AABB of the node, return false
-    if (!node->aabb.intersect(ray, &t_in, &t_out)) {
+    if (!node->aabb.intersect(slab_ray, ray.t_min, ray.t_max, &t_in, &t_out)) {
         return false;
     }
 
     // If the node is a leaf node (both left and right child are null),
     // check intersection with each triangle inside it
     if (!node->left && !node->right) {
+        STATS_ADD(TRIANGLE_TESTS, node->end - node->start + 1);
+        bool hit_leaf = false;
         for (int i = node->start; i <= node->end; i++) {
-            Interaction in;
-            if (triangles[i].intersect(ray, in) && in.dist < interaction.dist) {
-                interaction = in;
-            }
+            hit_leaf |= triangles[i].intersect(ray, hit, i);
         }
-        return interaction.type != Interaction::NONE;
+        return hit_leaf;
     }
 
     // Otherwise, if the node is an internal node, use recursion:
-    // check intersection with its left child and right child respectively
-    return bvhHit(ray, interaction, node->left) || bvhHit(ray, interaction, node->right);
+    // check intersection with its left child and right child respectively.
+    // Both children are visited, the closest hit may be in the right one.
+    bool hit_left = bvhHit(ray, slab_ray, hit, node->left);
+    bool hit_right = bvhHit(ray, slab_ray, hit, node->right);
+    return hit_left || hit_right;
 }
 
-#endif
-
-// Generate linearized BVH by recursion.
-void Scene::genLinearBVH(BVHNode *node) {
-    if (!node) {
+// Linearize the BVH. The children of an internal node are stored as a pair in one cache line,
+// and the pairs are grouped into blocks of a page: a block holds the top of a subtree, grown
+// from the pairs most likely to be visited (the largest first), and the subtrees below the
+// block are laid out after it, depth first. A traversal then enters few lines and pages,
+// where the preorder layout put the second child of a large subtree far from the first one.
+void Scene::genLinearBVH(BVHNode *root) {
+    linear_bvh_nodes.clear();
+    if (!root) {
         return;
     }
+    auto area = [](const BVHNode *node) {
+        Vec3f d = node->aabb.upper_bnd - node->aabb.low_bnd;
+        return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    };
+    auto place = [&](const BVHNode *node, int index) {
+        LinearBVHNode &linear_node = linear_bvh_nodes[index];
+        linear_node.aabb = node->aabb;
+        if (!node->left && !node->right) {
+            linear_node.start = node->start;
+            linear_node.end = node->end;
+        }
+    };
+
+    // node 0 is the root, node 1 aligns the pairs (an empty leaf, never visited)
+    linear_bvh_nodes.reserve(root->size + 1);
+    linear_bvh_nodes.resize(2);
+    linear_bvh_nodes[1].start = 0;
+    place(root, 0);
+
+    using Entry = std::pair<const BVHNode *, int>;
+    auto smaller = [&](const Entry &a, const Entry &b) { return area(a.first) < area(b.first); };
+    // placed internal nodes whose children are not, each one starts a block
+    std::vector<Entry> block_roots;
+    if (root->left) {
+        block_roots.emplace_back(root, 0);
+    }
+    while (!block_roots.empty()) {
+        std::priority_queue<Entry, std::vector<Entry>, decltype(smaller)> frontier(smaller);
+        frontier.push(block_roots.back());
+        block_roots.pop_back();
+        for (int pairs = 0; pairs < LAYOUT_BLOCK_PAIRS && !frontier.empty(); pairs++) {
+            const auto [node, index] = frontier.top();
+            frontier.pop();
+            const int first = static_cast<int>(linear_bvh_nodes.size());
+            linear_bvh_nodes.resize(first + 2);
+            linear_bvh_nodes[index].children = first;
+            place(node->left, first);
+            place(node->right, first + 1);
+            if (node->left->left) frontier.emplace(node->left, first);
+            if (node->right->left) frontier.emplace(node->right, first + 1);
+        }
+        // the smallest subtrees first on the stack, so that the largest follows this block
+        std::vector<Entry> below;
+        for (; !frontier.empty(); frontier.pop()) {
+            below.push_back(frontier.top());
+        }
+        block_roots.insert(block_roots.end(), below.rbegin(), below.rend());
+    }
+}
 
-    LinearBVHNode linear_node;
-    linear_node.aabb = node->aabb;
-
-    // If this node is a leaf node (both left and right are nullptr)
-    if (!node->left && !node->right) {
-        linear_node.start = node->start;
-        linear_node.end = node->end;
-    } else {
-        linear_node.right = (int) linear_bvh_nodes.size() + node->left->size + 1;
+void Scene::refitMotionBounds() {
+    linear_bvh_end_bounds.resize(linear_bvh_nodes.size());
+    // children are stored after their parent, a backward sweep visits them first
+    for (int i = static_cast<int>(linear_bvh_nodes.size()) - 1; i >= 0; i--) {
+        LinearBVHNode &node = linear_bvh_nodes[i];
+        AABB start_box, end_box;
+        if (node.start != -1) {
+            // (the leaf triangles follow each other in the chunk too)
+            const Triangle *leaf_triangles =
+                chunked_geometry ? chunked_geometry->fetch(node.start) : &triangles[node.start];
+            for (int k = node.start; k <= node.end; k++) {
+                const Triangle &t = leaf_triangles[k - node.start];
+                AABB start(t.v0, t.v1, t.v2), end(t.v0 + t.motion, t.v1 + t.motion, t.v2 + t.motion);
+                start_box = k == node.start ? start : AABB(start_box, start);
+                end_box = k == node.start ? end : AABB(end_box, end);
+            }
+        } else {
+            start_box = AABB(linear_bvh_nodes[node.children].aabb, linear_bvh_nodes[node.children + 1].aabb);
+            end_box = AABB(linear_bvh_end_bounds[node.children], linear_bvh_end_bounds[node.children + 1]);
+        }
+        node.aabb = start_box;
+        linear_bvh_end_bounds[i] = end_box;
     }
-    linear_bvh_nodes.push_back(linear_node);
+}
 
-    // recursively generate linear BVH for its left and right child
-    genLinearBVH(node->left);
-    genLinearBVH(node->right);
+AABB Scene::linearNodeBounds(int index, float time) const {
+    const AABB &start = linear_bvh_nodes[index].aabb;
+    if (linear_bvh_end_bounds.empty()) {
+        return start;
+    }
+    // the vertices move linearly, so do the bounds of any set of them
+    const AABB &end = linear_bvh_end_bounds[index];
+    return {start.low_bnd + time * (end.low_bnd - start.low_bnd),
+            start.upper_bnd + time * (end.upper_bnd - start.upper_bnd)};
 }
 
 // Linear BVH hit is same in theory as the ordinary BVH hit function.
 // The difference is that we have to 'rewrite' a 'leftChild', 'rightChild' function.
-bool Scene::LinearBVHHit(Ray &ray, Interaction &interaction) {
+template <bool streamed>
+bool Scene::LinearBVHHit(Ray &ray, HitRecord &hit) {
     // DFS traversal
+    const SlabRay slab_ray(ray);
     std::stack<int> fringe;  // the nodes we need to visit
     int curr_node = 0;  // store the index of the current visiting node
-    bool hit = false;
+    bool found = false;
+    // counted locally and added once per ray
+    int nodes_visited = 0, triangle_tests = 0;
+    int node_lines = 0, node_pages = 0;
+    uintptr_t last_line = 0, last_page = 0;
+    // count the cache lines and pages entered by reading a node
+    auto touch = [&](int index) {
+        if constexpr (stats::enabled()) {
+            const auto address = reinterpret_cast<uintptr_t>(&linear_bvh_nodes[index]);
+            node_lines += address / 64 != last_line;
+            node_pages += address / 4096 != last_page;
+            last_line = address / 64;
+            last_page = address / 4096;
+        }
+    };
 
     while (true) {
         // Start from curr_node (index), check intersection with AABB
+        touch(curr_node);
         LinearBVHNode node = linear_bvh_nodes[curr_node];
+        nodes_visited++;
         float t_in, t_out;
-        if (!node.aabb.intersect(ray, &t_in, &t_out)) {
+        if (!linearNodeBounds(curr_node, ray.time).intersect(slab_ray, ray.t_min, ray.t_max, &t_in, &t_out)) {
             if (fringe.empty()) {
                 break;
             }
@@ -303,14 +646,15 @@ bool Scene::LinearBVHHit(Ray &ray, Interaction &interaction) {
 
         // If the node is a leaf node, check intersection with the triangles inside it.
         if (node.start != -1) {
-            for (int i = node.start; i <= node.end; i++) {
-                Interaction in;
-                if (triangles[i].intersect(ray, in) && in.dist < interaction.dist) {
-                    interaction = in;
-                }
+            triangle_tests += node.end - node.start + 1;
+            const Triangle *leaf_triangles;
+            if constexpr (streamed) {
+                leaf_triangles = chunked_geometry->fetch(node.start);
+            } else {
+                leaf_triangles = &triangles[node.start];
             }
-            if (interaction.type != Interaction::Type::NONE) {
-                hit = true;
+            for (int i = 0; i <= node.end - node.start; i++) {
+                found |= leaf_triangles[i].intersect(ray, hit, node.start + i);
             }
             if (fringe.empty()) {
                 break;
@@ -322,33 +666,39 @@ bool Scene::LinearBVHHit(Ray &ray, Interaction &interaction) {
         // If the current node is an internal node.
         // We need to check if its left and right child
         else {
+            // both children are in the same cache line
+            const int left = node.children, right = node.children + 1;
+            touch(left);
+
             // check intersection with right child
             float t_in_right, t_out_right;
-            bool hit_right = linear_bvh_nodes[node.right].aabb.intersect(ray, &t_in_right, &t_out_right);
+            bool hit_right = linearNodeBounds(right, ray.time)
+                                 .intersect(slab_ray, ray.t_min, ray.t_max, &t_in_right, &t_out_right);
 
             // check intersection with left child
             float t_in_left, t_out_left;
-            bool hit_left = linear_bvh_nodes[curr_node + 1].aabb.intersect(ray, &t_in_left, &t_out_left);
+            bool hit_left = linearNodeBounds(left, ray.time)
+                                .intersect(slab_ray, ray.t_min, ray.t_max, &t_in_left, &t_out_left);
 
             // If it can hit both left and right child, choose the closer one
             if (hit_left && hit_right) {
                 if (t_in_left < t_in_right) {
-                    fringe.push(node.right);
-                    curr_node++;
+                    fringe.push(right);
+                    curr_node = left;
                 } else {
-                    fringe.push(curr_node + 1);
-                    curr_node = node.right;
+                    fringe.push(left);
+                    curr_node = right;
                 }
             }
 
             // if only left child is hit
             else if (hit_left) {
-                curr_node++;
+                curr_node = left;
             }
 
             // if only right child is hit
             else if (hit_right) {
-                curr_node = node.right;
+                curr_node = right;
             }
 
             // if both are not hit
@@ -361,7 +711,9 @@ bool Scene::LinearBVHHit(Ray &ray, Interaction &interaction) {
             }
         }
     }
-    return hit;
+    STATS_ADD(BVH_NODES_VISITED, nodes_visited);
+    STATS_ADD(TRIANGLE_TESTS, triangle_tests);
+    STATS_ADD(BVH_NODE_LINES, node_lines);
+    STATS_ADD(BVH_NODE_PAGES, node_pages);
+    return found;
 }
-
-#endif // USE_GLOBAL_BVH
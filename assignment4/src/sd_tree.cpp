@@ -0,0 +1,218 @@
+#include "sd_tree.h"
+
+#include <omp.h>
+
+#include <algorithm>
+
+#include "utils.h"
+
+namespace {
+
+// Cylindrical mapping between unit directions and the unit square, +y is the polar axis
+Vec2f dirToSquare(const Vec3f &dir) {
+    float u = (dir.y() + 1) * 0.5f;
+    float v = std::atan2(dir.z(), dir.x()) / (2 * PI);
+    if (v < 0) v += 1;
+    // keep the coordinates in [0, 1) so that every point falls into exactly one quadrant
+    return {std::clamp(u, 0.f, 0.99999994f), std::clamp(v, 0.f, 0.99999994f)};
+}
+
+Vec3f squareToDir(const Vec2f &p) {
+    float cos_theta = 2 * p.x() - 1;
+    float sin_theta = std::sqrt(std::max(0.f, 1 - cos_theta * cos_theta));
+    float phi = 2 * PI * p.y();
+    return {sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi)};
+}
+
+// Quadrant of p in the current node, p is rescaled to the coordinates of the quadrant
+int descend(Vec2f &p) {
+    int q = 0;
+    for (int a = 0; a < 2; a++) {
+        if (p[a] < 0.5f) {
+            p[a] *= 2;
+        } else {
+            p[a] = p[a] * 2 - 1;
+            q |= 1 << a;
+        }
+    }
+    return q;
+}
+
+}  // namespace
+
+DTree::DTree() : nodes(1) {
+}
+
+void DTree::record(const Vec3f &dir, float value) {
+    if (!(value > 0) || std::isinf(value)) {
+        value = 0;
+    }
+    Vec2f p = dirToSquare(dir);
+    int i = 0;
+    while (true) {
+        int q = descend(p);
+        #pragma omp atomic
+        nodes[i].sum[q] += value;
+        if (!nodes[i].child[q]) break;
+        i = nodes[i].child[q];
+    }
+    #pragma omp atomic
+    sample_count += 1;
+}
+
+Vec3f DTree::sample(Sampler &sampler) const {
+    Vec2f origin(0, 0);
+    float size = 1;
+    int i = 0;
+    while (true) {
+        const Node &node = nodes[i];
+        float total = node.total();
+        // nothing recorded below this node, sample it uniformly
+        if (total <= 0) break;
+
+        float r = sampler.get1D() * total;
+        int q = 0;
+        while (q < 3 && (r >= node.sum[q] || node.sum[q] <= 0)) {
+            r -= node.sum[q];
+            q++;
+        }
+        // guard against rounding choosing an empty last quadrant
+        while (node.sum[q] <= 0) q--;
+
+        size *= 0.5f;
+        origin += size * Vec2f(static_cast<float>(q & 1), static_cast<float>(q >> 1));
+        if (!node.child[q]) break;
+        i = node.child[q];
+    }
+    return squareToDir(origin + size * sampler.get2D());
+}
+
+float DTree::pdf(const Vec3f &dir) const {
+    Vec2f p = dirToSquare(dir);
+    float density = 1;
+    int i = 0;
+    while (true) {
+        const Node &node = nodes[i];
+        float total = node.total();
+        if (total <= 0) break;
+        int q = descend(p);
+        density *= 4 * node.sum[q] / total;
+        if (!node.child[q] || density <= 0) break;
+        i = node.child[q];
+    }
+    // the mapping to the square has a constant jacobian of 4 * pi
+    return density / (4 * PI);
+}
+
+void DTree::rebuild(const DTree &previous, float threshold, int max_depth) {
+    nodes.assign(1, Node());
+    sample_count = 0;
+
+    const float total = previous.energy();
+    if (total <= 0) {
+        return;
+    }
+
+    struct Item {
+        int node;
+        // matching node of the previous tree, -1 when it was a leaf there
+        int prev;
+        // fraction of the total energy, used below the leaves of the previous tree
+        float fraction;
+        int depth;
+    };
+    std::vector<Item> stack{{0, 0, 1.f, 1}};
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; q++) {
+            // the energy of a leaf is assumed to be uniform over its quadrants
+            float fraction = item.prev >= 0 ? previous.nodes[item.prev].sum[q] / total : item.fraction / 4;
+            if (fraction <= threshold || item.depth >= max_depth) {
+                continue;
+            }
+            int child = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+            nodes[item.node].child[q] = child;
+            int prev_child = item.prev >= 0 && previous.nodes[item.prev].child[q] ? previous.nodes[item.prev].child[q] : -1;
+            stack.push_back({child, prev_child, fraction, item.depth + 1});
+        }
+    }
+}
+
+float DTree::energy() const {
+    return nodes[0].total();
+}
+
+SDTree::SDTree(const AABB &scene_bounds) : bounds(scene_bounds), nodes(1), leaves(1) {
+    nodes[0].leaf = 0;
+    // enlarge the bounds a little, points on the boundary of the scene are still inside
+    Vec3f margin = (bounds.upper_bnd - bounds.low_bnd) * 1e-3f + Vec3f(1e-4f, 1e-4f, 1e-4f);
+    bounds.low_bnd -= margin;
+    bounds.upper_bnd += margin;
+}
+
+SDTree::Leaf &SDTree::lookup(const Vec3f &pos) {
+    Vec3f p = (pos - bounds.low_bnd).cwiseQuotient(bounds.upper_bnd - bounds.low_bnd);
+    int i = 0;
+    while (nodes[i].leaf < 0) {
+        int a = nodes[i].axis;
+        if (p[a] < 0.5f) {
+            p[a] *= 2;
+            i = nodes[i].child[0];
+        } else {
+            p[a] = p[a] * 2 - 1;
+            i = nodes[i].child[1];
+        }
+    }
+    return leaves[nodes[i].leaf];
+}
+
+void SDTree::refine(float spatial_threshold, float energy_threshold, int max_depth, size_t max_bytes) {
+    // Split the leaves, each half receives a copy of the directional trees and half of the samples.
+    // New nodes are appended, so they are visited by the same loop and split again if necessary.
+    size_t bytes = memoryFootprint();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].leaf < 0) continue;
+        const int leaf_index = nodes[i].leaf;
+        Leaf &leaf = leaves[leaf_index];
+        if (leaf.building.samples() <= spatial_threshold) continue;
+
+        size_t split_bytes =
+            sizeof(Leaf) + 2 * sizeof(Node) + leaf.sampling.memoryFootprint() + leaf.building.memoryFootprint();
+        if (bytes + split_bytes > max_bytes) continue;
+        bytes += split_bytes;
+
+        leaf.building.halveSamples();
+        const int axis = (nodes[i].axis + 1) % 3;
+        const int first_child = static_cast<int>(nodes.size());
+        nodes[i].child[0] = first_child;
+        nodes[i].child[1] = first_child + 1;
+        nodes[i].leaf = -1;
+
+        Node left, right;
+        left.axis = right.axis = axis;
+        left.leaf = leaf_index;
+        right.leaf = static_cast<int>(leaves.size());
+        // (copy first, push_back may reallocate the leaves)
+        Leaf copy = leaves[leaf_index];
+        leaves.push_back(std::move(copy));
+        nodes.push_back(left);
+        nodes.push_back(right);
+    }
+
+    // The distributions recorded in this pass are used for sampling in the next one
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < leaves.size(); i++) {
+        leaves[i].sampling = leaves[i].building;
+        leaves[i].building.rebuild(leaves[i].sampling, energy_threshold, max_depth);
+    }
+}
+
+size_t SDTree::memoryFootprint() const {
+    size_t bytes = nodes.capacity() * sizeof(Node) + leaves.capacity() * sizeof(Leaf);
+    for (const Leaf &leaf : leaves) {
+        bytes += leaf.sampling.memoryFootprint() + leaf.building.memoryFootprint();
+    }
+    return bytes;
+}
@@ -0,0 +1,120 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace stats {
+
+namespace {
+
+std::mutex registry_mutex;
+// owns the counters of every thread that has counted something
+std::vector<std::unique_ptr<ThreadCounters>> registry;
+
+const char *counterName(int counter) {
+    switch (counter) {
+        case RAYS: return "rays";
+        case SHADOW_RAYS: return "shadow_rays";
+        case PRIMARY_RAYS: return "primary_rays";
+        case BVH_NODES_VISITED: return "bvh_nodes_visited";
+        case TRIANGLE_TESTS: return "triangle_tests";
+        case BVH_NODE_LINES: return "bvh_node_lines";
+        case BVH_NODE_PAGES: return "bvh_node_pages";
+        case PATH_VERTICES: return "path_vertices";
+        case GEOMETRY_CHUNK_LOADS: return "geometry_chunk_loads";
+        default: return "unknown";
+    }
+}
+
+}  // namespace
+
+ThreadCounters *registerThread() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::make_unique<ThreadCounters>());
+    return registry.back().get();
+}
+
+std::array<uint64_t, NUM_COUNTERS> totals() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::array<uint64_t, NUM_COUNTERS> total{};
+    for (const auto &counters : registry) {
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            total[c] += counters->values[c];
+        }
+    }
+    return total;
+}
+
+void report(double seconds, const std::string &json_path) {
+    if (!enabled()) {
+        std::cout << "Render statistics are not compiled in, configure with -DRENDER_STATS=ON." << std::endl;
+        return;
+    }
+
+    const std::array<uint64_t, NUM_COUNTERS> total = totals();
+    std::vector<double> busy;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto &counters : registry) {
+            if (counters->busy_seconds > 0) {
+                busy.push_back(counters->busy_seconds);
+            }
+        }
+    }
+
+    const auto ratio = [](uint64_t a, uint64_t b) { return b ? static_cast<double>(a) / static_cast<double>(b) : 0.0; };
+    const uint64_t indirect = total[RAYS] - total[SHADOW_RAYS] - total[PRIMARY_RAYS];
+    double busy_max = 0, busy_sum = 0;
+    for (double b : busy) {
+        busy_max = std::max(busy_max, b);
+        busy_sum += b;
+    }
+
+    nlohmann::json j;
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        j["counters"][counterName(c)] = total[c];
+    }
+    // rays that are neither primary nor shadow rays: bounces, photon and light paths, feature rays
+    j["counters"]["indirect_rays"] = indirect;
+    j["seconds"] = seconds;
+    j["mrays_per_second"] = seconds > 0 ? static_cast<double>(total[RAYS]) / seconds * 1e-6 : 0.0;
+    j["bvh_nodes_per_ray"] = ratio(total[BVH_NODES_VISITED], total[RAYS]);
+    j["triangle_tests_per_ray"] = ratio(total[TRIANGLE_TESTS], total[RAYS]);
+    j["bvh_node_lines_per_ray"] = ratio(total[BVH_NODE_LINES], total[RAYS]);
+    j["bvh_node_pages_per_ray"] = ratio(total[BVH_NODE_PAGES], total[RAYS]);
+    j["average_path_length"] = ratio(total[PATH_VERTICES], total[PRIMARY_RAYS]);
+    j["thread_busy_seconds"] = busy;
+    // slowest thread relative to the average, 1 for a perfect balance
+    j["load_imbalance"] = busy.empty() ? 1.0 : busy_max / (busy_sum / static_cast<double>(busy.size()));
+
+    printf("Rays: %llu (primary %llu, shadow %llu, indirect %llu), %.2f Mrays/s\n",
+           static_cast<unsigned long long>(total[RAYS]), static_cast<unsigned long long>(total[PRIMARY_RAYS]),
+           static_cast<unsigned long long>(total[SHADOW_RAYS]), static_cast<unsigned long long>(indirect),
+           j["mrays_per_second"].get<double>());
+    printf("BVH nodes per ray: %.2f, triangle tests per ray: %.2f, average path length: %.2f\n",
+           j["bvh_nodes_per_ray"].get<double>(), j["triangle_tests_per_ray"].get<double>(),
+           j["average_path_length"].get<double>());
+    if (total[BVH_NODE_LINES] > 0) {
+        printf("Linear BVH node cache lines per ray: %.2f, pages per ray: %.2f\n",
+               j["bvh_node_lines_per_ray"].get<double>(), j["bvh_node_pages_per_ray"].get<double>());
+    }
+    printf("Threads: %zu, load imbalance: %.3f\n", busy.size(), j["load_imbalance"].get<double>());
+
+    if (!json_path.empty()) {
+        std::ofstream fout(json_path);
+        if (!fout.is_open()) {
+            std::cerr << "Can not write statistics to " << json_path << std::endl;
+            return;
+        }
+        fout << j.dump(2) << std::endl;
+        std::cout << "Statistics saved to " << json_path << std::endl;
+    }
+}
+
+}  // namespace stats
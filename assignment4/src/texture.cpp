@@ -0,0 +1,196 @@
+#include "texture.h"
+
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <stb_image.h>
+
+namespace {
+
+float srgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t linearToSrgb(float c) {
+    c = std::clamp(c, 0.f, 1.f);
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::lround(c * 255));
+}
+
+// Linear values of the 8-bit sRGB levels
+const std::array<float, 256> &srgbTable() {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> values{};
+        for (int i = 0; i < 256; i++) values[i] = srgbToLinear(static_cast<float>(i) / 255);
+        return values;
+    }();
+    return table;
+}
+
+int wrap(int x, int size) {
+    x %= size;
+    return x < 0 ? x + size : x;
+}
+
+}  // namespace
+
+TextureStore::TextureStore(const Config::TextureConfig &config) : config(config), caches(omp_get_max_threads()) {
+    fd = open(config.tile_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        std::cerr << "Can not create the texture tile file " << config.tile_path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    // at least a 2 x 2 tile neighbourhood per thread for the bilinear lookups
+    const size_t tiles_per_thread =
+        std::max<size_t>(4, (static_cast<size_t>(config.cache_mb) << 20) / caches.size() / TILE_BYTES);
+    for (ThreadCache &cache : caches) {
+        cache.tiles.setCapacity(tiles_per_thread);
+    }
+}
+
+TextureStore::~TextureStore() {
+    if (tile_data) munmap(const_cast<uint8_t *>(tile_data), mapped_bytes);
+    if (fd >= 0) close(fd);
+}
+
+int TextureStore::load(const std::string &path) {
+    // row 0 is the bottom row, where v = 0
+    stbi_set_flip_vertically_on_load(true);
+    int width, height, channels;
+    unsigned char *raw = stbi_load(path.c_str(), &width, &height, &channels, 3);
+    if (!raw) {
+        std::cerr << "Can not load texture " << path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    std::vector<Vec3f> texels(static_cast<size_t>(width) * height);
+    const auto &table = srgbTable();
+    for (size_t i = 0; i < texels.size(); i++) {
+        texels[i] = Vec3f(table[raw[3 * i]], table[raw[3 * i + 1]], table[raw[3 * i + 2]]);
+    }
+    stbi_image_free(raw);
+
+    // Mip chain, every level averages 2 x 2 texels of the previous one (in linear space)
+    Texture texture;
+    while (true) {
+        texture.levels.push_back({width, height, (width + TILE_SIZE - 1) / TILE_SIZE, num_tiles});
+        writeLevel(texels, width, height);
+        if (width == 1 && height == 1) break;
+
+        const int next_width = std::max(1, width / 2), next_height = std::max(1, height / 2);
+        std::vector<Vec3f> next(static_cast<size_t>(next_width) * next_height);
+        for (int y = 0; y < next_height; y++) {
+            for (int x = 0; x < next_width; x++) {
+                const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                next[y * next_width + x] = 0.25f * (texels[y0 * width + x0] + texels[y0 * width + x1] +
+                                                    texels[y1 * width + x0] + texels[y1 * width + x1]);
+            }
+        }
+        texels.swap(next);
+        width = next_width;
+        height = next_height;
+    }
+    std::cout << "loaded texture " << path << " (" << texture.levels[0].width << " x " << texture.levels[0].height
+              << ", " << texture.levels.size() << " levels)" << std::endl;
+    textures.push_back(std::move(texture));
+    return static_cast<int>(textures.size()) - 1;
+}
+
+void TextureStore::writeLevel(const std::vector<Vec3f> &texels, int width, int height) {
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<uint8_t> buffer(TILE_BYTES);
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            // texels past the image border are never read, they stay black
+            std::fill(buffer.begin(), buffer.end(), 0);
+            for (int y = 0; y < TILE_SIZE && ty * TILE_SIZE + y < height; y++) {
+                for (int x = 0; x < TILE_SIZE && tx * TILE_SIZE + x < width; x++) {
+                    const Vec3f &c = texels[(ty * TILE_SIZE + y) * width + tx * TILE_SIZE + x];
+                    uint8_t *out = &buffer[(y * TILE_SIZE + x) * 4];
+                    for (int k = 0; k < 3; k++) out[k] = linearToSrgb(c[k]);
+                }
+            }
+            if (write(fd, buffer.data(), TILE_BYTES) != static_cast<ssize_t>(TILE_BYTES)) {
+                std::cerr << "Can not write the texture tile file " << config.tile_path << ". Exit." << std::endl;
+                exit(-1);
+            }
+            num_tiles++;
+        }
+    }
+}
+
+void TextureStore::finalize() {
+    if (num_tiles == 0) {
+        return;
+    }
+    mapped_bytes = num_tiles * TILE_BYTES;
+    void *mapping = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Can not map the texture tile file " << config.tile_path << ". Exit." << std::endl;
+        exit(-1);
+    }
+    tile_data = static_cast<const uint8_t *>(mapping);
+    // the file is only a scratch file, it is removed from the disk once unmapped
+    unlink(config.tile_path.c_str());
+}
+
+Vec3f TextureStore::lookup(int texture, const Vec2f &uv, float width) const {
+    const std::vector<Level> &levels = textures[texture].levels;
+    const int last = static_cast<int>(levels.size()) - 1;
+    // level whose texels are as large as the footprint
+    const float size = static_cast<float>(std::max(levels[0].width, levels[0].height));
+    const float lod = width > 0 ? std::clamp(std::log2(width * size), 0.f, static_cast<float>(last)) : 0.f;
+    const int level = std::min(static_cast<int>(lod), last);
+    const float t = lod - static_cast<float>(level);
+    Vec3f color = bilinear(levels[level], uv);
+    if (t > 0 && level < last) {
+        color = (1 - t) * color + t * bilinear(levels[level + 1], uv);
+    }
+    return color;
+}
+
+Vec3f TextureStore::bilinear(const Level &level, const Vec2f &uv) const {
+    const float x = uv.x() * static_cast<float>(level.width) - 0.5f;
+    const float y = uv.y() * static_cast<float>(level.height) - 0.5f;
+    const float fx = std::floor(x), fy = std::floor(y);
+    const int x0 = static_cast<int>(fx), y0 = static_cast<int>(fy);
+    const float dx = x - fx, dy = y - fy;
+    return (1 - dy) * ((1 - dx) * texel(level, x0, y0) + dx * texel(level, x0 + 1, y0)) +
+           dy * ((1 - dx) * texel(level, x0, y0 + 1) + dx * texel(level, x0 + 1, y0 + 1));
+}
+
+Vec3f TextureStore::texel(const Level &level, int x, int y) const {
+    x = wrap(x, level.width);
+    y = wrap(y, level.height);
+    const uint8_t *texels = tile(level.first_tile + (y / TILE_SIZE) * level.tiles_x + x / TILE_SIZE);
+    const uint8_t *c = texels + ((y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * 4;
+    const auto &table = srgbTable();
+    return {table[c[0]], table[c[1]], table[c[2]]};
+}
+
+const uint8_t *TextureStore::tile(size_t index) const {
+    ThreadCache &cache = caches[omp_get_thread_num()];
+    if (index == cache.last_tile) {
+        return cache.last_texels;
+    }
+    Tile *found = cache.tiles.find(index);
+    if (!found) {
+        found = &cache.tiles.insert(index, [&](Tile &texels) {
+            const uint8_t *source = tile_data + index * TILE_BYTES;
+            texels.assign(source, source + TILE_BYTES);
+            // the copy is all we need, drop the mapped pages from the resident memory
+            madvise(const_cast<uint8_t *>(source), TILE_BYTES, MADV_DONTNEED);
+        });
+    }
+    cache.last_tile = index;
+    cache.last_texels = found->data();
+    return cache.last_texels;
+}
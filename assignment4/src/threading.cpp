@@ -0,0 +1,114 @@
+#include "threading.h"
+
+#include <omp.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+namespace {
+
+// CPUs of a sysfs cpu list such as "0-15,32-47"
+std::vector<int> parseCpuList(const std::string &text) {
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        if (range.empty()) continue;
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+}  // namespace
+
+std::vector<int> cpuNodes() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return {};
+    }
+    std::vector<int> nodes(CPU_SETSIZE, -1);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) nodes[cpu] = 0;
+    }
+    for (int node = 0;; node++) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!cpulist.is_open()) break;
+        std::string text;
+        std::getline(cpulist, text);
+        for (int cpu : parseCpuList(text)) {
+            if (cpu < CPU_SETSIZE && nodes[cpu] >= 0) nodes[cpu] = node;
+        }
+    }
+    while (!nodes.empty() && nodes.back() < 0) nodes.pop_back();
+    return nodes;
+}
+
+std::string setupThreads(const Config::ThreadConfig &config) {
+    if (config.threads > 0) {
+        omp_set_num_threads(config.threads);
+    }
+    const int threads = omp_get_max_threads();
+    std::ostringstream summary;
+    summary << threads << " threads";
+    if (config.affinity == ThreadAffinity::NONE) {
+        return summary.str();
+    }
+
+    // CPUs in the order threads are placed on them
+    const std::vector<int> nodes = cpuNodes();
+    std::vector<std::vector<int>> node_cpus;
+    for (int cpu = 0; cpu < static_cast<int>(nodes.size()); cpu++) {
+        if (nodes[cpu] < 0) continue;
+        if (nodes[cpu] >= static_cast<int>(node_cpus.size())) node_cpus.resize(nodes[cpu] + 1);
+        node_cpus[nodes[cpu]].push_back(cpu);
+    }
+    node_cpus.erase(std::remove_if(node_cpus.begin(), node_cpus.end(), [](const auto &cpus) { return cpus.empty(); }),
+                    node_cpus.end());
+    std::vector<int> order;
+    if (config.affinity == ThreadAffinity::COMPACT) {
+        for (const auto &cpus : node_cpus) order.insert(order.end(), cpus.begin(), cpus.end());
+    } else {
+        size_t most_cpus = 0;
+        for (const auto &cpus : node_cpus) most_cpus = std::max(most_cpus, cpus.size());
+        for (size_t i = 0; i < most_cpus; i++) {
+            for (const auto &cpus : node_cpus) {
+                if (i < cpus.size()) order.push_back(cpus[i]);
+            }
+        }
+    }
+    if (order.empty()) {
+        std::cerr << "Can not read the CPUs of the process, the threads are not pinned." << std::endl;
+        return summary.str();
+    }
+
+    // every thread pins itself, more threads than CPUs wrap around
+    std::vector<int> pinned(threads, -1);
+    #pragma omp parallel default(none) shared(order, pinned)
+    {
+        const int thread = omp_get_thread_num();
+        const int cpu = order[thread % order.size()];
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpu, &mask);
+        if (sched_setaffinity(0, sizeof(mask), &mask) == 0) {
+            pinned[thread] = cpu;
+        }
+    }
+    std::set<int> used_cpus, used_nodes;
+    for (int cpu : pinned) {
+        if (cpu < 0) continue;
+        used_cpus.insert(cpu);
+        used_nodes.insert(nodes[cpu]);
+    }
+    summary << " pinned " << (config.affinity == ThreadAffinity::COMPACT ? "compact" : "scatter") << " on "
+            << used_cpus.size() << " CPUs of " << used_nodes.size() << " of " << node_cpus.size() << " NUMA nodes";
+    return summary.str();
+}
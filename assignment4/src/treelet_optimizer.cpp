@@ -0,0 +1,170 @@
+#include "treelet_optimizer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// SAH costs of a node traversal and of a triangle test, as in the SBVH builder
+constexpr float TRAVERSAL_COST = 1.f;
+constexpr float TRIANGLE_COST = 1.f;
+// subtrees with more nodes are optimized in their own task
+constexpr int TASK_NODES = 4096;
+
+float surfaceArea(const AABB &box) {
+    Vec3f d = box.upper_bnd - box.low_bnd;
+    return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+bool isLeaf(const BVHNode *node) { return !node->left && !node->right; }
+
+float leafCost(const BVHNode *leaf) {
+    return TRIANGLE_COST * static_cast<float>(leaf->end - leaf->start + 1) * surfaceArea(leaf->aabb);
+}
+
+// Cost of every node of the subtree, sequentially
+float subtreeCost(BVHNode *node) {
+    if (isLeaf(node)) {
+        return node->sah_cost = leafCost(node);
+    }
+    const float children = subtreeCost(node->left) + subtreeCost(node->right);
+    return node->sah_cost = TRAVERSAL_COST * surfaceArea(node->aabb) + children;
+}
+
+struct Treelet {
+    static constexpr int SUBSETS = 1 << TreeletOptimizer::MAX_TREELET_SIZE;
+
+    // subtrees hanging below the treelet, and the internal nodes of the treelet but its root
+    BVHNode *leaves[TreeletOptimizer::MAX_TREELET_SIZE];
+    BVHNode *internals[TreeletOptimizer::MAX_TREELET_SIZE];
+    int num_leaves = 0, num_internals = 0;
+
+    // per subset of the leaves: bounds, lowest cost of a subtree over them, and the part of
+    // the subset going to the left child of that subtree
+    AABB box[SUBSETS];
+    float cost[SUBSETS];
+    int split[SUBSETS];
+
+    // Link the optimal subtree over 'subset', rooted at 'node' or at the next unused internal node
+    BVHNode *link(int subset, int &next_internal, BVHNode *node = nullptr) {
+        if ((subset & (subset - 1)) == 0) {
+            return leaves[__builtin_ctz(subset)];
+        }
+        if (!node) {
+            node = internals[next_internal++];
+        }
+        BVHNode *left = link(split[subset], next_internal);
+        BVHNode *right = link(subset ^ split[subset], next_internal);
+        node->left = left;
+        node->right = right;
+        node->aabb = box[subset];
+        node->size = left->size + right->size + 1;
+        node->sah_cost = cost[subset];
+        return node;
+    }
+};
+
+}  // namespace
+
+TreeletOptimizer::TreeletOptimizer(const Config::TreeletConfig &config) : config(config) {
+    this->config.treelet_size = std::clamp(config.treelet_size, 3, MAX_TREELET_SIZE);
+}
+
+void TreeletOptimizer::optimize(BVHNode *root) {
+    restructured = 0;
+    if (!root || isLeaf(root)) {
+        return;
+    }
+    const float root_area = surfaceArea(root->aabb);
+    initial_cost = subtreeCost(root) / root_area;
+    for (int pass = 0; pass < config.passes; pass++) {
+        #pragma omp parallel default(none) shared(root)
+        #pragma omp single
+        optimizeSubtree(root);
+    }
+    final_cost = root->sah_cost / root_area;
+}
+
+void TreeletOptimizer::optimizeSubtree(BVHNode *node) {
+    if (isLeaf(node)) {
+        return;
+    }
+    if (node->size > TASK_NODES) {
+        #pragma omp task
+        optimizeSubtree(node->left);
+        optimizeSubtree(node->right);
+        #pragma omp taskwait
+    } else {
+        optimizeSubtree(node->left);
+        optimizeSubtree(node->right);
+    }
+    node->sah_cost = TRAVERSAL_COST * surfaceArea(node->aabb) + node->left->sah_cost + node->right->sah_cost;
+    if (restructure(node)) {
+        #pragma omp atomic
+        restructured++;
+    }
+}
+
+bool TreeletOptimizer::restructure(BVHNode *root) const {
+    // Grow the treelet from the children of the root, expanding the largest internal leaf
+    Treelet treelet;
+    treelet.leaves[treelet.num_leaves++] = root->left;
+    treelet.leaves[treelet.num_leaves++] = root->right;
+    while (treelet.num_leaves < config.treelet_size) {
+        int largest = -1;
+        float largest_area = -1;
+        for (int i = 0; i < treelet.num_leaves; i++) {
+            const float area = surfaceArea(treelet.leaves[i]->aabb);
+            if (!isLeaf(treelet.leaves[i]) && area > largest_area) {
+                largest = i;
+                largest_area = area;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        BVHNode *expanded = treelet.leaves[largest];
+        treelet.internals[treelet.num_internals++] = expanded;
+        treelet.leaves[largest] = expanded->left;
+        treelet.leaves[treelet.num_leaves++] = expanded->right;
+    }
+    // two leaves have a single topology
+    const int n = treelet.num_leaves;
+    if (n < 3) {
+        return false;
+    }
+
+    // Lowest cost of every subset, from the smaller ones (a proper subset is a smaller number)
+    const int full = (1 << n) - 1;
+    for (int subset = 1; subset <= full; subset++) {
+        const int lowest = subset & -subset;
+        if (subset == lowest) {
+            const BVHNode *leaf = treelet.leaves[__builtin_ctz(subset)];
+            treelet.box[subset] = leaf->aabb;
+            treelet.cost[subset] = leaf->sah_cost;
+            continue;
+        }
+        treelet.box[subset] = AABB(treelet.box[subset ^ lowest], treelet.box[lowest]);
+        // every partition once: the part holding the lowest leaf goes left
+        float best = std::numeric_limits<float>::infinity();
+        int best_split = lowest;
+        for (int part = (subset - 1) & subset; part > 0; part = (part - 1) & subset) {
+            if (!(part & lowest)) continue;
+            const float cost = treelet.cost[part] + treelet.cost[subset ^ part];
+            if (cost < best) {
+                best = cost;
+                best_split = part;
+            }
+        }
+        treelet.cost[subset] = TRAVERSAL_COST * surfaceArea(treelet.box[subset]) + best;
+        treelet.split[subset] = best_split;
+    }
+
+    // (a relative margin, so that rounding does not relink equivalent treelets forever)
+    if (!(treelet.cost[full] < root->sah_cost * (1 - 1e-5f))) {
+        return false;
+    }
+    int next_internal = 0;
+    treelet.link(full, next_internal, root);
+    return true;
+}